@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Verifies the base64 and URI encoding kernels against simple reference implementations with random inputs,
+// and reports their speed on the inputs of SAS tokens and on large buffers.
+// iotc-bench-codec-scalar is the same benchmark built with IOTC_CODEC_SCALAR_ONLY, for comparison.
+//
+// Usage: iotc-bench-codec [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_algorithms.h"
+#include "iotc_codec.h"
+#include "iotc_platform.h"
+
+#define LARGE_SIZE (64 * 1024)
+#define MAX_VERIFY_SIZE 2000
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Byte by byte, for verification
+static size_t reference_base64_encode(const unsigned char *input, size_t len, char *output) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        const unsigned long v = (unsigned long) input[i] << 16
+                                | (i + 1 < len ? (unsigned long) input[i + 1] << 8 : 0)
+                                | (i + 2 < len ? (unsigned long) input[i + 2] : 0);
+        output[out++] = alphabet[(v >> 18) & 0x3F];
+        output[out++] = alphabet[(v >> 12) & 0x3F];
+        output[out++] = i + 1 < len ? alphabet[(v >> 6) & 0x3F] : '=';
+        output[out++] = i + 2 < len ? alphabet[v & 0x3F] : '=';
+    }
+    output[out] = 0;
+    return out;
+}
+
+static size_t reference_uri_encode(const char *input, size_t len, char *output) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char c = (unsigned char) input[i];
+        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+            || c == '-' || c == '_' || c == '.' || c == '~') {
+            output[out++] = (char) c;
+        } else {
+            out += (size_t) sprintf(&output[out], "%%%02X", c);
+        }
+    }
+    output[out] = 0;
+    return out;
+}
+
+// Returns the number of inputs that did not match
+static int verify(void) {
+    static unsigned char input[MAX_VERIFY_SIZE];
+    static char expected[IOTC_URI_ENCODED_MAX_LEN(MAX_VERIFY_SIZE) + 1];
+    static char actual[IOTC_URI_ENCODED_MAX_LEN(MAX_VERIFY_SIZE) + 1];
+    static unsigned char decoded[MAX_VERIFY_SIZE];
+    int num_failed = 0;
+    srand(1);
+    for (size_t len = 0; len < MAX_VERIFY_SIZE; len++) {
+        for (size_t i = 0; i < len; i++) {
+            input[i] = (unsigned char) rand();
+        }
+        const size_t expected_len = reference_base64_encode(input, len, expected);
+        const size_t actual_len = iotc_base64_encode(input, len, actual);
+        const long decoded_len = iotc_base64_decode(actual, actual_len, decoded, sizeof(decoded));
+        if (actual_len != expected_len || strcmp(actual, expected)
+            || decoded_len != (long) len || memcmp(decoded, input, len)) {
+            printf("base64 mismatch with %lu bytes\n", (unsigned long) len);
+            num_failed++;
+        }
+        if (len > 0) {
+            actual[len / 2] = '*'; // not base64
+            if (-1 != iotc_base64_decode(actual, actual_len, decoded, sizeof(decoded))) {
+                printf("base64 accepted an invalid character with %lu bytes\n", (unsigned long) len);
+                num_failed++;
+            }
+        }
+
+        // mostly printable, as URIs are
+        for (size_t i = 0; i < len; i++) {
+            input[i] = (unsigned char) (0 == rand() % 8 ? rand() % 256 : ' ' + rand() % 95);
+        }
+        reference_uri_encode((const char *) input, len, expected);
+        iotc_uri_encode((const char *) input, len, actual);
+        if (strcmp(actual, expected)) {
+            printf("URI encoding mismatch with %lu bytes\n", (unsigned long) len);
+            num_failed++;
+        }
+    }
+    return num_failed;
+}
+
+static void report(const char *name, uint64_t start_us, int iterations, size_t bytes) {
+    const double us = (double) (iotc_platform_now_us() - start_us);
+    if (bytes) {
+        printf("%-28s %10.2f GB/s\n", name, (double) bytes * iterations / us / 1e3);
+    } else {
+        printf("%-28s %10.1f ns\n", name, us * 1e3 / iterations);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    const int num_failed = verify();
+    if (num_failed) {
+        printf("%d verification failures\n", num_failed);
+        return 1;
+    }
+    printf("verified inputs of 0 to %d bytes\n", MAX_VERIFY_SIZE - 1);
+
+    // the inputs of a SAS token
+    const char *key = "bXlTZWNyZXRLZXlGb3JUZXN0aW5nUHVycG9zZXMxMjM0NTY3ODkwMTI=";
+    const char *resource = "my-hub.azure-devices.net/devices/cpid-device_01";
+    unsigned char digest[32];
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        digest[i] = (unsigned char) (i * 37 + 11);
+    }
+    char out[256];
+    unsigned char bin[64];
+    volatile size_t sink = 0;
+    uint64_t start;
+
+    start = iotc_platform_now_us();
+    for (int i = 0; i < iterations; i++) {
+        sink += iotc_base64_encode(digest, sizeof(digest), out);
+    }
+    report("encode 32 byte digest", start, iterations, 0);
+    start = iotc_platform_now_us();
+    for (int i = 0; i < iterations; i++) {
+        sink += (size_t) iotc_base64_decode(key, strlen(key), bin, sizeof(bin));
+    }
+    report("decode 56 character key", start, iterations, 0);
+    start = iotc_platform_now_us();
+    for (int i = 0; i < iterations; i++) {
+        sink += iotc_uri_encode(resource, strlen(resource), out);
+    }
+    report("uri encode resource URI", start, iterations, 0);
+
+    static unsigned char large[LARGE_SIZE];
+    static char large_encoded[IOTC_BASE64_ENCODED_LEN(LARGE_SIZE) + 1];
+    static unsigned char large_decoded[LARGE_SIZE];
+    for (size_t i = 0; i < sizeof(large); i++) {
+        large[i] = (unsigned char) rand();
+    }
+    const int large_iterations = iterations / 500 > 0 ? iterations / 500 : 1;
+    size_t encoded_len = 0;
+    start = iotc_platform_now_us();
+    for (int i = 0; i < large_iterations; i++) {
+        encoded_len = iotc_base64_encode(large, sizeof(large), large_encoded);
+    }
+    report("encode 64 KiB", start, large_iterations, sizeof(large));
+    start = iotc_platform_now_us();
+    for (int i = 0; i < large_iterations; i++) {
+        sink += (size_t) iotc_base64_decode(large_encoded, encoded_len, large_decoded, sizeof(large_decoded));
+    }
+    report("decode 64 KiB", start, large_iterations, sizeof(large));
+
+    const int token_iterations = iterations / 10 > 0 ? iterations / 10 : 1;
+    start = iotc_platform_now_us();
+    for (int i = 0; i < token_iterations; i++) {
+        char *token = gen_sas_token("my-hub.azure-devices.net", "cpid-device_01", key, 3600);
+        sink += token ? 1 : 0;
+        free(token);
+    }
+    report("gen_sas_token()", start, token_iterations, 0);
+    return (int) (sink & 0);
+}
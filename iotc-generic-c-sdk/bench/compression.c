@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Reports the compression ratio and the CPU cost of compressing batched telemetry of different sizes,
+// with the built-in dictionary and with a dictionary of the application's own telemetry.
+//
+// Usage: iotc-bench-compression [iterations] [<trust_store> <device_cert> <device_key> [records]]
+//
+// With the certificates, the same telemetry is also sent end to end through the telemetry batch and
+// its flush path over the engine to a local broker, as JSON and compressed.
+// The broker must listen on localhost:8883, as for iotc-bench-engine-scale.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotc_compression.h"
+#include "iotc_engine.h"
+#include "iotc_platform.h"
+#include "iotc_telemetry_batch.h"
+
+#define MAX_BATCH_SIZE (64 * 1024)
+
+// A sample of this application's telemetry, with the most common strings at the end
+static const char app_dictionary[] =
+    "{\"dt\":\"2024-05-01T12:00:00.000Z\",\"d\":{\"version\":\"1.0\",\"temperature\":21.5,\"humidity\":40}}";
+
+// Builds a batch like the one the telemetry batch sends, with a different timestamp and values for each record
+static size_t build_batch(char *buf, size_t size, int num_records) {
+    size_t len = (size_t) snprintf(buf, size, "{\"d\":[");
+    for (int i = 0; i < num_records && len < size; i++) {
+        len += (size_t) snprintf(&buf[len], size - len,
+                                 "%s{\"dt\":\"2024-05-01T12:%02d:%02d.000Z\",\"d\":{\"version\":\"1.0\","
+                                 "\"temperature\":%d.%d,\"humidity\":%d}}",
+                                 i ? "," : "", i / 60, i % 60, 20 + i % 5, i % 10, 40 + i % 17);
+    }
+    if (len < size) {
+        len += (size_t) snprintf(&buf[len], size - len, "]}");
+    }
+    return len < size ? len : 0;
+}
+
+static void run(const char *name, const IotConnectCompressionConfig *config, int num_records, int iterations) {
+    static char batch[MAX_BATCH_SIZE];
+    const size_t batch_len = build_batch(batch, sizeof(batch), num_records);
+    IotcCompressor *c = iotc_compressor_create(config);
+    if (!c || !batch_len) {
+        printf("Unable to set up the compressor. Was the SDK built with zlib?\n");
+        exit(1);
+    }
+    const unsigned char *out = NULL;
+    size_t out_len = batch_len;
+    bool is_compressed = false;
+    const clock_t start = clock();
+    for (int i = 0; i < iterations; i++) {
+        is_compressed = iotc_compressor_compress(c, batch, batch_len, &out, &out_len);
+    }
+    const double us = (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC / iterations;
+    if (!is_compressed) {
+        out_len = batch_len; // sent as JSON
+    }
+    printf("%-12s %7d %9lu %9lu %7.2f %10.1f %12.2f\n", name, num_records, (unsigned long) batch_len,
+           (unsigned long) out_len, (double) batch_len / (double) out_len, us, us / num_records);
+    iotc_compressor_destroy(c);
+}
+
+static IotcMutex lock;
+static IotcCond cond;
+static unsigned long num_delivered = 0; // protected by lock
+static unsigned long num_failed = 0; // protected by lock
+
+static void on_delivery(void *context, uint32_t message_id, bool is_delivered) {
+    (void) context;
+    (void) message_id;
+    iotc_platform_mutex_lock(&lock);
+    if (is_delivered) {
+        num_delivered++;
+    } else {
+        num_failed++;
+    }
+    iotc_platform_cond_signal(&cond);
+    iotc_platform_mutex_unlock(&lock);
+}
+
+static bool on_c2d_message(void *context, const unsigned char *message, size_t message_len) {
+    (void) context;
+    (void) message;
+    (void) message_len;
+    return true;
+}
+
+typedef struct {
+    IotcEngineSession *session;
+    IotcCompressor *compressor; // NULL to send JSON
+    uint32_t message_id;
+    unsigned long num_sent;
+    size_t bytes_sent; // payload bytes
+} BrokerSink;
+
+// Does what the SDK does when the telemetry batch is flushed
+static void on_batch_flush(void *context, const char *json_str, size_t json_len) {
+    BrokerSink *sink = (BrokerSink *) context;
+    IotConnectBuffer buf = {json_str, json_len};
+    const unsigned char *compressed;
+    size_t compressed_len;
+    if (sink->compressor
+        && iotc_compressor_compress(sink->compressor, json_str, json_len, &compressed, &compressed_len)) {
+        buf.data = compressed;
+        buf.len = compressed_len;
+    }
+    sink->num_sent++;
+    sink->bytes_sent += buf.len;
+    if (iotc_engine_session_send_message_iov(sink->session, "bench/rpt", &buf, 1, 1, ++sink->message_id)) {
+        on_delivery(NULL, sink->message_id, false);
+    }
+}
+
+// Sends num_records telemetry messages through a batch of batch_size records and waits until all are delivered.
+// Compressed with the given configuration, or sent as JSON if it is NULL.
+static void run_end_to_end(IotcEngineSession *session, const char *name,
+                           const IotConnectCompressionConfig *config, int batch_size, int num_records) {
+    BrokerSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.session = session;
+    if (config) {
+        sink.compressor = iotc_compressor_create(config);
+        if (!sink.compressor) {
+            printf("Unable to set up the compressor. Was the SDK built with zlib?\n");
+            exit(1);
+        }
+    }
+    IotConnectBatchConfig batch_config = {(size_t) batch_size, 0, 0};
+    IotcTelemetryBatch b;
+    iotc_batch_init(&b, &batch_config, on_batch_flush, &sink);
+    iotc_platform_mutex_lock(&lock);
+    num_delivered = 0;
+    num_failed = 0;
+    iotc_platform_mutex_unlock(&lock);
+
+    const time_t first_timestamp = 1714564800; // 2024-05-01T12:00:00Z
+    char message[128];
+    const clock_t start = clock();
+    const uint64_t wall_start_us = iotc_platform_now_us();
+    for (int i = 0; i < num_records; i++) {
+        // what iotcl_telemetry_create_serialized_string() makes of a message without a timestamp
+        snprintf(message, sizeof(message),
+                 "{\"d\":[{\"d\":{\"version\":\"1.0\",\"temperature\":%d.%d,\"humidity\":%d}}]}", 20 + i % 5,
+                 i % 10, 40 + i % 17);
+        if (iotc_batch_add(&b, message, first_timestamp + i)) {
+            printf("Unable to batch the telemetry\n");
+            exit(1);
+        }
+    }
+    iotc_batch_flush(&b);
+    iotc_platform_mutex_lock(&lock);
+    while (num_delivered + num_failed < sink.num_sent) {
+        iotc_platform_cond_wait(&cond, &lock);
+    }
+    const unsigned long failed = num_failed;
+    iotc_platform_mutex_unlock(&lock);
+    const double us = (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC;
+    const double wall_ms = (double) (iotc_platform_now_us() - wall_start_us) / 1e3;
+
+    printf("%-12s %7d %9lu %12.1f %12.2f %10.1f %7lu\n", name, batch_size, sink.num_sent,
+           (double) sink.bytes_sent / num_records, us / num_records, wall_ms, failed);
+    iotc_batch_deinit(&b);
+    iotc_compressor_destroy(sink.compressor);
+}
+
+// Returns non-zero if unable to connect to the broker
+static int run_broker(char *argv[], int num_records, const int *batch_sizes, size_t num_batch_sizes,
+                      const IotConnectCompressionConfig *builtin, const IotConnectCompressionConfig *app) {
+    IotConnectAuthInfo auth;
+    memset(&auth, 0, sizeof(auth));
+    auth.type = IOTC_AT_X509;
+    auth.trust_store = argv[0];
+    auth.data.cert_info.device_cert = argv[1];
+    auth.data.cert_info.device_key = argv[2];
+    IotConnectMqttIdentity mqtt = {"localhost", "bench-compression", NULL, "bench/rpt", "bench/ack",
+                                   "bench/c2d"};
+    IotConnectDeviceClientConfig c;
+    memset(&c, 0, sizeof(c));
+    c.qos = 1;
+    c.auth = &auth;
+    c.mqtt = &mqtt;
+    c.c2d_msg_cb = on_c2d_message;
+    c.delivery_cb = on_delivery;
+
+    iotc_platform_mutex_init(&lock);
+    iotc_platform_cond_init(&cond);
+    IotcEngineConfig ec = {1};
+    IotcEngine *engine = iotc_engine_create(&ec);
+    IotcEngineSession *session = engine ? iotc_engine_session_create(engine) : NULL;
+    int status = session ? iotc_engine_session_connect(session, &c) : IOTCL_ERR_FAILED;
+    if (status) {
+        printf("Unable to connect to the broker. Status %d\n", status);
+    } else {
+        printf("\n%d records sent to the broker\n", num_records);
+        printf("%-12s %7s %9s %12s %12s %10s %7s\n", "dictionary", "records", "messages", "bytes/record",
+               "cpu us/rec", "wall ms", "failed");
+        for (size_t i = 0; i < num_batch_sizes; i++) {
+            run_end_to_end(session, "none (JSON)", NULL, batch_sizes[i], num_records);
+        }
+        for (size_t i = 0; i < num_batch_sizes; i++) {
+            run_end_to_end(session, "built-in", builtin, batch_sizes[i], num_records);
+        }
+        for (size_t i = 0; i < num_batch_sizes; i++) {
+            run_end_to_end(session, "application", app, batch_sizes[i], num_records);
+        }
+        iotc_engine_session_disconnect(session);
+    }
+    if (session) {
+        iotc_engine_session_destroy(session);
+    }
+    if (engine) {
+        iotc_engine_destroy(engine);
+    }
+    iotc_platform_cond_destroy(&cond);
+    iotc_platform_mutex_destroy(&lock);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    const int num_records = argc > 5 ? atoi(argv[5]) : 20000;
+    const int batch_sizes[] = {1, 5, 20, 50, 200};
+    if (iterations <= 0 || (argc > 2 && argc < 5) || num_records <= 0) {
+        printf("Usage: %s [iterations] [<trust_store> <device_cert> <device_key> [records]]\n", argv[0]);
+        return 1;
+    }
+
+    IotConnectCompressionConfig builtin = {true, 0, NULL, 0, 0};
+    IotConnectCompressionConfig app = {true, 0, app_dictionary, sizeof(app_dictionary) - 1, 0};
+    printf("%-12s %7s %9s %9s %7s %10s %12s\n", "dictionary", "records", "json", "sent", "ratio", "us/batch",
+           "us/record");
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        run("built-in", &builtin, batch_sizes[i], iterations);
+    }
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        run("application", &app, batch_sizes[i], iterations);
+    }
+    if (argc > 4) {
+        const size_t num_batch_sizes = sizeof(batch_sizes) / sizeof(batch_sizes[0]);
+        return run_broker(&argv[2], num_records, batch_sizes, num_batch_sizes, &builtin, &app) ? 1 : 0;
+    }
+    return 0;
+}
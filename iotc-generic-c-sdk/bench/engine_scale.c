@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Connects many devices over the engine to a local broker and reports the memory and CPU cost per device.
+//
+// Usage: iotc-bench-engine-scale <devices> <trust_store> <device_cert> <device_key>
+//                                 [workers] [idle_s] [messages]
+//
+// The broker must listen on localhost:8883 with a certificate for "localhost" that the trust store verifies,
+// and accept any client ID and certificate, e.g. mosquitto with "require_certificate true" and a test CA.
+// Each device publishes the given number of QOS 1 messages once all devices are connected.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L // for getrusage() and sleep() with -std=c99
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "iotc_engine.h"
+#include "iotc_platform.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned long num_delivered = 0; // protected by lock
+static unsigned long num_failed = 0; // protected by lock
+
+static void on_delivery(void *context, uint32_t message_id, bool is_delivered) {
+    (void) context;
+    (void) message_id;
+    pthread_mutex_lock(&lock);
+    if (is_delivered) {
+        num_delivered++;
+    } else {
+        num_failed++;
+    }
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void on_status(void *context, IotConnectMqttStatus status) {
+    (void) context;
+    if (IOTC_CS_MQTT_DISCONNECTED == status) {
+        printf("A device was disconnected by the broker\n");
+    }
+}
+
+static bool on_c2d_message(void *context, const unsigned char *message, size_t message_len) {
+    (void) context;
+    (void) message;
+    (void) message_len;
+    return true;
+}
+
+// Returns a value from /proc/self/status, such as "VmRSS:" in KiB or "Threads:", or zero if unknown
+static unsigned long get_process_status(const char *name) {
+    unsigned long value = 0;
+    const size_t name_len = strlen(name);
+    char line[128];
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (0 == strncmp(line, name, name_len)) {
+            value = strtoul(&line[name_len], NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+// User and system CPU time of the process in microseconds
+static uint64_t get_cpu_us(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+           + (uint64_t) (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        printf("Usage: %s <devices> <trust_store> <device_cert> <device_key> [workers] [idle_s] [messages]\n",
+               argv[0]);
+        return 1;
+    }
+    const int num_devices = atoi(argv[1]);
+    IotcEngineConfig ec = {argc > 5 ? atoi(argv[5]) : 0};
+    const int idle_s = argc > 6 ? atoi(argv[6]) : 10;
+    const int num_messages = argc > 7 ? atoi(argv[7]) : 10;
+    if (num_devices <= 0) {
+        printf("The number of devices must be positive\n");
+        return 1;
+    }
+
+    IotConnectAuthInfo auth;
+    memset(&auth, 0, sizeof(auth));
+    auth.type = IOTC_AT_X509;
+    auth.trust_store = argv[2];
+    auth.data.cert_info.device_cert = argv[3];
+    auth.data.cert_info.device_key = argv[4];
+
+    IotcEngine *engine = iotc_engine_create(&ec);
+    IotcEngineSession **sessions = calloc((size_t) num_devices, sizeof(IotcEngineSession *));
+    if (!engine || !sessions) {
+        printf("Unable to create the engine\n");
+        return 1;
+    }
+
+    const unsigned long rss_before = get_process_status("VmRSS:");
+    uint64_t cpu_start = get_cpu_us();
+    uint64_t wall_start_ms = iotc_platform_now_ms();
+    for (int i = 0; i < num_devices; i++) {
+        char client_id[32];
+        snprintf(client_id, sizeof(client_id), "bench-%d", i);
+        IotConnectMqttIdentity mqtt = {"localhost", client_id, NULL, "bench/rpt", "bench/ack", "bench/c2d"};
+        IotConnectDeviceClientConfig c;
+        memset(&c, 0, sizeof(c));
+        c.qos = 1;
+        c.auth = &auth;
+        c.mqtt = &mqtt;
+        c.c2d_msg_cb = on_c2d_message;
+        c.status_cb = on_status;
+        c.delivery_cb = on_delivery;
+        sessions[i] = iotc_engine_session_create(engine);
+        int status = sessions[i] ? iotc_engine_session_connect(sessions[i], &c) : IOTCL_ERR_OUT_OF_MEMORY;
+        if (status) {
+            printf("Device %d failed to connect with status %d\n", i, status);
+            return 1;
+        }
+    }
+    const uint64_t connect_cpu_us = get_cpu_us() - cpu_start;
+    const uint64_t connect_wall_ms = iotc_platform_now_ms() - wall_start_ms;
+    const unsigned long rss_connected = get_process_status("VmRSS:");
+
+    cpu_start = get_cpu_us();
+    sleep((unsigned int) idle_s);
+    const uint64_t idle_cpu_us = get_cpu_us() - cpu_start;
+
+    cpu_start = get_cpu_us();
+    wall_start_ms = iotc_platform_now_ms();
+    const char payload[] = "{\"d\":[{\"d\":{\"temperature\":21.5,\"humidity\":40}}]}";
+    IotConnectBuffer buf = {payload, sizeof(payload) - 1};
+    uint32_t message_id = 0;
+    for (int m = 0; m < num_messages; m++) {
+        for (int i = 0; i < num_devices; i++) {
+            if (iotc_engine_session_send_message_iov(sessions[i], "bench/rpt", &buf, 1, 1, ++message_id)) {
+                on_delivery(NULL, message_id, false);
+            }
+        }
+    }
+    const unsigned long total_messages = (unsigned long) num_devices * (unsigned long) num_messages;
+    pthread_mutex_lock(&lock);
+    while (num_delivered + num_failed < total_messages) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    const uint64_t publish_cpu_us = get_cpu_us() - cpu_start;
+    const uint64_t publish_wall_ms = iotc_platform_now_ms() - wall_start_ms;
+    const unsigned long rss_published = get_process_status("VmRSS:");
+
+    printf("devices %d, workers %d, threads %lu\n", num_devices, ec.num_workers,
+           get_process_status("Threads:"));
+    printf("connect: %.2f s, cpu %.2f s, %.0f us cpu per device\n", connect_wall_ms / 1e3, connect_cpu_us / 1e6,
+           (double) connect_cpu_us / num_devices);
+    printf("rss: %lu KiB before, %lu KiB connected, %.1f KiB per device\n", rss_before, rss_connected,
+           (double) (rss_connected - rss_before) / num_devices);
+    printf("idle %d s: cpu %.3f s, %.3f us cpu per device per second\n", idle_s, idle_cpu_us / 1e6,
+           (double) idle_cpu_us / num_devices / idle_s);
+    printf("publish %lu messages: %.2f s, cpu %.2f s, %.1f us cpu per message, %lu delivered, %lu failed\n",
+           total_messages, publish_wall_ms / 1e3, publish_cpu_us / 1e6,
+           total_messages ? (double) publish_cpu_us / total_messages : 0.0, num_delivered, num_failed);
+    printf("rss after publishing: %lu KiB\n", rss_published);
+
+    for (int i = 0; i < num_devices; i++) {
+        iotc_engine_session_disconnect(sessions[i]);
+        iotc_engine_session_destroy(sessions[i]);
+    }
+    free(sessions);
+    iotc_engine_destroy(engine);
+    return 0;
+}
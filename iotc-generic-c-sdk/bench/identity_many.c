@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Compares sending N identity requests one after the other with sending them concurrently,
+// as iotconnect_client_create_many() does. The requests go to a local HTTP stand-in, which adds
+// a fixed latency to each response.
+//
+// Usage: iotc-bench-identity-many [latency_ms] [max_concurrent]
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L // for nanosleep() and the sockets with -std=c99
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "iotc_http_request.h"
+#include "iotc_platform.h"
+
+// Shaped like an identity response, so that the client does the same amount of parsing and copying
+static const char response_body[] =
+    "{\"d\":{\"ec\":0,\"ct\":200,\"meta\":{\"at\":2,\"df\":60,\"cd\":\"XG4E2EX\",\"gtw\":null,\"edge\":0,"
+    "\"pf\":0,\"hwv\":\"\",\"swv\":\"\",\"v\":2.1},\"has\":{\"d\":0,\"attr\":1,\"set\":0,\"r\":0,\"ota\":0},"
+    "\"p\":{\"n\":\"mqtt\",\"h\":\"poc-iotconnect-iothub-030-eu2.azure-devices.net\",\"p\":8883,"
+    "\"id\":\"bench-device\",\"un\":\"poc-iotconnect-iothub-030-eu2.azure-devices.net/bench-device/"
+    "?api-version=2018-06-30\",\"topics\":{\"rpt\":\"devices/bench-device/messages/events/cd=XG4E2EX&v=2.1\","
+    "\"ack\":\"devices/bench-device/messages/events/cd=XG4E2EX&v=2.1&mt=3\","
+    "\"c2d\":\"devices/bench-device/messages/devicebound/#\"}},\"dt\":\"2024-05-01T12:00:00.000Z\"},"
+    "\"status\":200,\"message\":\"Device info loaded successfully.\"}";
+
+static int latency_ms = 50;
+
+static void sleep_ms(int ms) {
+    struct timespec ts = {ms / 1000, (long) (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// Serves keep-alive requests on one connection until the client closes it
+static void *serve_connection(void *arg) {
+    const int fd = (int) (intptr_t) arg;
+    char request[4096];
+    size_t len = 0;
+    for (;;) {
+        ssize_t n = recv(fd, &request[len], sizeof(request) - len - 1, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t) n;
+        request[len] = 0;
+        char *end = strstr(request, "\r\n\r\n");
+        if (!end) {
+            if (len == sizeof(request) - 1) {
+                break; // headers too large for a stand-in
+            }
+            continue;
+        }
+        // the requests are GETs, so there is no body to skip
+        len -= (size_t) (end + 4 - request);
+        memmove(request, end + 4, len);
+
+        sleep_ms(latency_ms);
+        char response[2048];
+        int response_len = snprintf(response, sizeof(response),
+                                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                                    "Content-Length: %lu\r\n\r\n%s",
+                                    (unsigned long) (sizeof(response_body) - 1), response_body);
+        if (send(fd, response, (size_t) response_len, 0) != response_len) {
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *serve(void *arg) {
+    const int listen_fd = (int) (intptr_t) arg;
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        pthread_t thread;
+        if (fd >= 0 && 0 == pthread_create(&thread, NULL, serve_connection, (void *) (intptr_t) fd)) {
+            pthread_detach(thread);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+// Starts the stand-in on an ephemeral port. Returns the port, or zero on error.
+static int start_server(void) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    pthread_t thread;
+    if (fd < 0
+        || bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(fd, 1024)
+        || getsockname(fd, (struct sockaddr *) &addr, &addr_len)
+        || pthread_create(&thread, NULL, serve, (void *) (intptr_t) fd)) {
+        return 0;
+    }
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
+
+int main(int argc, char *argv[]) {
+    latency_ms = argc > 1 ? atoi(argv[1]) : 50;
+    const unsigned int max_concurrent = argc > 2 ? (unsigned int) atoi(argv[2]) : 8;
+    const size_t counts[] = {1, 4, 16, 64, 256};
+
+    const int port = start_server();
+    if (!port) {
+        printf("Unable to start the HTTP stand-in\n");
+        return 1;
+    }
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/api/2.1/dsdk/id/bench-device", port);
+    IotcHttpContext *ctx = iotc_http_context_create();
+    IotcHttpRequest *requests = calloc(counts[sizeof(counts) / sizeof(counts[0]) - 1], sizeof(IotcHttpRequest));
+    if (!ctx || !requests) {
+        printf("Unable to create the HTTP context\n");
+        return 1;
+    }
+
+    printf("latency %d ms, max_concurrent %u\n", latency_ms, max_concurrent);
+    printf("%6s %12s %15s %8s\n", "N", "serial ms", "concurrent ms", "speedup");
+    for (size_t k = 0; k < sizeof(counts) / sizeof(counts[0]); k++) {
+        const size_t n = counts[k];
+        size_t num_ok = 0;
+
+        uint64_t start = iotc_platform_now_us();
+        for (size_t i = 0; i < n; i++) {
+            IotConnectHttpResponse response = {0};
+            if (0 == iotc_http_request(ctx, &response, url, NULL) && response.data) {
+                num_ok++;
+            }
+            iotconnect_free_https_response(&response);
+        }
+        const uint64_t serial_us = iotc_platform_now_us() - start;
+
+        memset(requests, 0, n * sizeof(IotcHttpRequest));
+        for (size_t i = 0; i < n; i++) {
+            requests[i].url = url;
+        }
+        start = iotc_platform_now_us();
+        iotc_http_request_many(ctx, requests, n, max_concurrent);
+        const uint64_t concurrent_us = iotc_platform_now_us() - start;
+        for (size_t i = 0; i < n; i++) {
+            if (0 == requests[i].status && requests[i].response.data) {
+                num_ok++;
+            }
+            iotconnect_free_https_response(&requests[i].response);
+        }
+
+        printf("%6lu %12.0f %15.0f %8.1f", (unsigned long) n, serial_us / 1e3, concurrent_us / 1e3,
+               (double) serial_us / (double) concurrent_us);
+        if (num_ok != 2 * n) {
+            printf("  %lu of %lu requests failed", (unsigned long) (2 * n - num_ok), (unsigned long) (2 * n));
+        }
+        printf("\n");
+    }
+    free(requests);
+    iotc_http_context_destroy(ctx);
+    return 0;
+}
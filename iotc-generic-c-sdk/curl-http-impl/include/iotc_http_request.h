@@ -5,15 +5,58 @@
 
 #ifndef IOTC_HTTP_REQUEST_H
 #define IOTC_HTTP_REQUEST_H
+#include <stdbool.h>
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern   "C" {
 #endif
 typedef struct IotConnectHttpResponse {
     char *data; // add flexibility for future, but at this point we only have response data
+    size_t size; // of data, without the NUL terminator
+    // Found while the response was received, so that the data does not need to be searched again
+    long json_start; // offset of the JSON object in data, or -1 if there is none
+    bool is_json_complete; // the JSON object was closed, so the response is not truncated
 } IotConnectHttpResponse;
 
+// Keeps curl handles between requests, along with a connection, TLS session and DNS cache that they share,
+// so that sequential requests to the same host reuse a keep-alive connection. Thread safe.
+typedef struct IotcHttpContext IotcHttpContext;
+
+IotcHttpContext *iotc_http_context_create(void);
+
+void iotc_http_context_destroy(IotcHttpContext *ctx);
+
+// For transfers that need their own curl options, as (CURL *). The handle uses the context's caches.
+// Options are reset when it is returned to the pool with iotc_http_release_handle().
+void *iotc_http_acquire_handle(IotcHttpContext *ctx);
+
+void iotc_http_release_handle(IotcHttpContext *ctx, void *curl);
+
+// Same as iotconnect_https_request(), with a handle from the context's pool
+int iotc_http_request(
+        IotcHttpContext *ctx,
+        IotConnectHttpResponse* response,
+        const char *url,
+        const char *send_str
+);
+
+// One of the requests for iotc_http_request_many()
+typedef struct {
+    const char *url;
+    const char *send_str; // POST data, or NULL for GET
+    IotConnectHttpResponse response; // Free data with iotconnect_free_https_response
+    int status; // zero on success, like the return value of iotc_http_request()
+} IotcHttpRequest;
+
+// Performs the requests concurrently, with up to max_concurrent of them in flight at a time (8 if zero).
+// Returns once all of them have completed.
+void iotc_http_request_many(IotcHttpContext *ctx, IotcHttpRequest *requests, size_t num_requests,
+                            unsigned int max_concurrent);
+
 // Helper to deal with http chunked transfers which are always returned by iotconnect services.
 // Free data with iotconnect_free_https_response
+// Uses a context of its own for each request. Use iotc_http_request() to keep connections between requests.
 int iotconnect_https_request(
         IotConnectHttpResponse* response,
         const char *url,
@@ -3,95 +3,522 @@
  * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
  */
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <curl/curl.h>
 #include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_dns_cache.h"
 #include "iotconnect.h"
 #include "iotc_http_request.h"
 
+#ifndef IOTC_HTTP_MAX_IDLE_HANDLES
+#define IOTC_HTTP_MAX_IDLE_HANDLES 4
+#endif
+
+#ifndef IOTC_HTTP_DEFAULT_CONCURRENCY
+#define IOTC_HTTP_DEFAULT_CONCURRENCY 8
+#endif
+
+// Identity responses are a few KB. Anything much larger is not a response from the IoTConnect services.
+#ifndef IOTC_HTTP_MAX_RESPONSE_SIZE
+#define IOTC_HTTP_MAX_RESPONSE_SIZE (256 * 1024)
+#endif
+
+// Used if the server does not send Content-Length
+#define HTTP_INITIAL_BUFFER_SIZE 4096
+
+struct IotcHttpContext {
+    CURLSH *share; // connection, TLS session and DNS caches shared by all handles of the context
+    IotcMutex share_locks[CURL_LOCK_DATA_LAST];
+    IotcMutex pool_lock;
+    CURL *idle_handles[IOTC_HTTP_MAX_IDLE_HANDLES];
+    size_t num_idle_handles;
+};
+
+// curl_global_init() is not thread safe, and it is costly, so it is done once for all contexts
+static IotcOnce http_global_once = IOTC_ONCE_INIT;
+static IotcMutex http_global_lock;
+static int http_global_refcount = 0; // protected by http_global_lock
+
+// Follows the structure of the JSON object in the response as it arrives, so that the response does not need
+// to be searched for it afterwards. Strings are tracked so that braces inside them are not counted.
+typedef struct {
+    long start; // offset of the opening brace, or -1 if not found yet
+    int depth;
+    bool is_in_string;
+    bool is_escaped;
+    bool is_complete;
+} JsonScan;
+
 struct MemoryStruct {
+    CURL *curl;
     char *memory;
     size_t size;
+    size_t capacity; // including the NUL terminator
+    JsonScan json;
 };
 
-static size_t write_memory_cb(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct MemoryStruct *mem = (struct MemoryStruct *) userp;
+static void json_scan(JsonScan *j, const char *data, size_t len, size_t offset) {
+    for (size_t i = 0; i < len && !j->is_complete; i++) {
+        const char c = data[i];
+        if (j->start < 0) {
+            if ('{' == c) {
+                j->start = (long) (offset + i);
+                j->depth = 1;
+            }
+        } else if (j->is_in_string) {
+            if (j->is_escaped) {
+                j->is_escaped = false;
+            } else if ('\\' == c) {
+                j->is_escaped = true;
+            } else if ('"' == c) {
+                j->is_in_string = false;
+            }
+        } else if ('"' == c) {
+            j->is_in_string = true;
+        } else if ('{' == c || '[' == c) {
+            j->depth++;
+        } else if (('}' == c || ']' == c) && 0 == --j->depth) {
+            j->is_complete = true;
+        }
+    }
+}
 
-    char *ptr = realloc(mem->memory, mem->size + realsize + 1);
+// Makes room for a response of the given size. Grows the buffer by doubling it.
+static bool response_reserve(struct MemoryStruct *mem, size_t needed) {
+    if (needed < mem->capacity) {
+        return true;
+    }
+    if (needed > IOTC_HTTP_MAX_RESPONSE_SIZE) {
+        IOTC_ERROR("HTTP response is larger than %d bytes!", IOTC_HTTP_MAX_RESPONSE_SIZE);
+        return false;
+    }
+    size_t capacity = mem->capacity ? mem->capacity : HTTP_INITIAL_BUFFER_SIZE;
+    while (capacity <= needed) {
+        capacity *= 2;
+    }
+    if (capacity > IOTC_HTTP_MAX_RESPONSE_SIZE + 1) {
+        capacity = IOTC_HTTP_MAX_RESPONSE_SIZE + 1;
+    }
+    char *ptr = realloc(mem->memory, capacity);
     if (!ptr) {
         /* out of memory! */
         IOTC_ERROR("not enough memory (realloc returned NULL)");
-        return 0;
+        return false;
     }
-
     mem->memory = ptr;
+    mem->capacity = capacity;
+    return true;
+}
+
+static size_t write_memory_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct MemoryStruct *mem = (struct MemoryStruct *) userp;
+
+    if (!mem->memory) {
+        // headers have been received by now, so the whole response can be allocated at once if its size is known
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t content_length = -1;
+        curl_easy_getinfo(mem->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+#else
+        double content_length = -1;
+        curl_easy_getinfo(mem->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+#endif
+        if (content_length > 0 && content_length <= IOTC_HTTP_MAX_RESPONSE_SIZE
+            && !response_reserve(mem, (size_t) content_length)) {
+            return 0;
+        }
+    }
+    if (!response_reserve(mem, mem->size + realsize)) {
+        return 0; // called function will print the error
+    }
+
     memcpy(&(mem->memory[mem->size]), contents, realsize);
+    json_scan(&mem->json, (const char *) contents, realsize, mem->size);
     mem->size += realsize;
     mem->memory[mem->size] = 0;
 
     return realsize;
 }
 
-int iotconnect_https_request(
+static void http_create_global_lock(void) {
+    iotc_platform_mutex_init(&http_global_lock);
+}
+
+static bool http_global_acquire(void) {
+    bool ret = true;
+    iotc_platform_once(&http_global_once, http_create_global_lock);
+    iotc_platform_mutex_lock(&http_global_lock);
+    /* In windows, this will init the winsock stuff */
+    if (0 == http_global_refcount && CURLE_OK != curl_global_init(CURL_GLOBAL_ALL)) {
+        IOTC_ERROR("Unable to initialize curl!");
+        ret = false;
+    } else {
+        http_global_refcount++;
+    }
+    iotc_platform_mutex_unlock(&http_global_lock);
+    return ret;
+}
+
+static void http_global_release(void) {
+    iotc_platform_mutex_lock(&http_global_lock);
+    if (http_global_refcount > 0 && 0 == --http_global_refcount) {
+        curl_global_cleanup();
+    }
+    iotc_platform_mutex_unlock(&http_global_lock);
+}
+
+static void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void) handle;
+    (void) access; // the same lock is used for shared and single access
+    IotcHttpContext *ctx = (IotcHttpContext *) userptr;
+    iotc_platform_mutex_lock(&ctx->share_locks[data]);
+}
+
+static void share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr) {
+    (void) handle;
+    IotcHttpContext *ctx = (IotcHttpContext *) userptr;
+    iotc_platform_mutex_unlock(&ctx->share_locks[data]);
+}
+
+IotcHttpContext *iotc_http_context_create(void) {
+    if (!http_global_acquire()) {
+        return NULL; // called function will print the error
+    }
+    IotcHttpContext *ctx = calloc(1, sizeof(IotcHttpContext));
+    if (!ctx) {
+        IOTC_ERROR("Out of memory while creating the HTTP context!");
+        http_global_release();
+        return NULL;
+    }
+    ctx->share = curl_share_init();
+    if (!ctx->share) {
+        IOTC_ERROR("Unable to create the curl share!");
+        free(ctx);
+        http_global_release();
+        return NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        iotc_platform_mutex_init(&ctx->share_locks[i]);
+    }
+    iotc_platform_mutex_init(&ctx->pool_lock);
+    curl_share_setopt(ctx->share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+    curl_share_setopt(ctx->share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    curl_share_setopt(ctx->share, CURLSHOPT_USERDATA, ctx);
+    curl_share_setopt(ctx->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(ctx->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // connection sharing requires curl 7.57.0. Otherwise each pooled handle keeps its own connections.
+    curl_share_setopt(ctx->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    return ctx;
+}
+
+// Returns an idle handle from the pool, or a new one
+CURL *iotc_http_acquire_handle(IotcHttpContext *ctx) {
+    CURL *curl = NULL;
+    iotc_platform_mutex_lock(&ctx->pool_lock);
+    if (ctx->num_idle_handles > 0) {
+        curl = ctx->idle_handles[--ctx->num_idle_handles];
+    }
+    iotc_platform_mutex_unlock(&ctx->pool_lock);
+    if (!curl) {
+        curl = curl_easy_init();
+        if (!curl) {
+            IOTC_ERROR("Unable to create a curl handle!");
+            return NULL;
+        }
+        // the share stays attached to the handle when it is reset
+        curl_easy_setopt(curl, CURLOPT_SHARE, ctx->share);
+    }
+    return curl;
+}
+
+// Returns the handle to the pool, keeping its connections alive
+void iotc_http_release_handle(IotcHttpContext *ctx, CURL *curl) {
+    curl_easy_reset(curl);
+    iotc_platform_mutex_lock(&ctx->pool_lock);
+    if (ctx->num_idle_handles < IOTC_HTTP_MAX_IDLE_HANDLES) {
+        ctx->idle_handles[ctx->num_idle_handles++] = curl;
+        curl = NULL;
+    }
+    iotc_platform_mutex_unlock(&ctx->pool_lock);
+    if (curl) {
+        curl_easy_cleanup(curl);
+    }
+}
+
+void iotc_http_context_destroy(IotcHttpContext *ctx) {
+    if (!ctx) {
+        return;
+    }
+    // handles have to be cleaned up before the share that they use
+    for (size_t i = 0; i < ctx->num_idle_handles; i++) {
+        curl_easy_cleanup(ctx->idle_handles[i]);
+    }
+    curl_share_cleanup(ctx->share);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        iotc_platform_mutex_destroy(&ctx->share_locks[i]);
+    }
+    iotc_platform_mutex_destroy(&ctx->pool_lock);
+    free(ctx);
+    http_global_release();
+}
+
+static void http_response_init(IotConnectHttpResponse *response) {
+    response->data = NULL;
+    response->size = 0;
+    response->json_start = -1;
+    response->is_json_complete = false;
+}
+
+// State of one request while it is being performed
+typedef struct {
+    CURL *curl;
+    struct curl_slist *header_slist;
+    struct curl_slist *resolve_slist; // addresses from the DNS cache
+    char *dns_host; // set if the addresses came from the DNS cache
+    char *dns_port;
+    struct MemoryStruct chunk;
+} HttpTransfer;
+
+static void http_transfer_reset_chunk(HttpTransfer *t) {
+    free(t->chunk.memory);
+    memset(&t->chunk, 0, sizeof(t->chunk)); /* allocated once the response starts to arrive */
+    t->chunk.curl = t->curl;
+    t->chunk.json.start = -1;
+}
+
+// Gives curl the cached addresses of the host, instead of letting it resolve the host.
+// Parsing the URL requires curl 7.62.0. With older versions, curl always resolves the host itself.
+static void http_transfer_use_dns_cache(HttpTransfer *t, const char *url) {
+#if LIBCURL_VERSION_NUM >= 0x073e00
+    CURLU *u = curl_url();
+    if (!u || curl_url_set(u, CURLUPART_URL, url, 0)
+        || curl_url_get(u, CURLUPART_HOST, &t->dns_host, 0)
+        || curl_url_get(u, CURLUPART_PORT, &t->dns_port, CURLU_DEFAULT_PORT)) {
+        curl_url_cleanup(u);
+        return;
+    }
+    curl_url_cleanup(u);
+    IotcDnsAddress addresses[IOTC_DNS_MAX_ADDRESSES];
+    const size_t n = iotc_dns_cache_lookup(t->dns_host, t->dns_port, addresses, IOTC_DNS_MAX_ADDRESSES);
+    // HOST:PORT:ADDRESS[,ADDRESS]...
+    char entry[256 + 16 + IOTC_DNS_MAX_ADDRESSES * IOTC_DNS_ADDRESS_STRLEN];
+    int len = snprintf(entry, sizeof(entry), "%s:%s:", t->dns_host, t->dns_port);
+    for (size_t i = 0; i < n && len > 0 && (size_t) len < sizeof(entry); i++) {
+        char address[IOTC_DNS_ADDRESS_STRLEN];
+        if (iotc_dns_address_to_string(&addresses[i], address, sizeof(address))) {
+            len += snprintf(&entry[len], sizeof(entry) - (size_t) len, "%s%s", i > 0 ? "," : "", address);
+        }
+    }
+    if (n > 0 && len > 0 && (size_t) len < sizeof(entry) && ':' != entry[len - 1]) {
+        t->resolve_slist = curl_slist_append(NULL, entry);
+        curl_easy_setopt(t->curl, CURLOPT_RESOLVE, t->resolve_slist);
+    }
+#else
+    (void) t;
+    (void) url;
+#endif
+    if (!t->resolve_slist) {
+        curl_free(t->dns_host);
+        curl_free(t->dns_port);
+        t->dns_host = NULL;
+        t->dns_port = NULL;
+    }
+}
+
+// If none of the cached addresses could be connected to, drops them from both caches and prepares the
+// transfer to be performed again with curl resolving the host. The handle must not be in a multi handle.
+static bool http_transfer_fall_back_to_dns(HttpTransfer *t, CURLcode res) {
+    if (CURLE_COULDNT_CONNECT != res || !t->dns_host) {
+        return false;
+    }
+    IOTC_WARN("Unable to connect to the cached addresses of %s. Resolving it again.", t->dns_host);
+    iotc_dns_cache_invalidate(t->dns_host, t->dns_port);
+    // the cached addresses were added to the DNS cache of the share, and this removes them
+    char entry[256 + 16 + 2];
+    snprintf(entry, sizeof(entry), "-%s:%s", t->dns_host, t->dns_port);
+    curl_slist_free_all(t->resolve_slist);
+    t->resolve_slist = curl_slist_append(NULL, entry);
+    curl_easy_setopt(t->curl, CURLOPT_RESOLVE, t->resolve_slist);
+    curl_free(t->dns_host);
+    curl_free(t->dns_port);
+    t->dns_host = NULL;
+    t->dns_port = NULL;
+    http_transfer_reset_chunk(t);
+    return true;
+}
+
+static bool http_transfer_start(IotcHttpContext *ctx, HttpTransfer *t, const char *url, const char *send_str) {
+    /* get a curl handle */
+    t->curl = iotc_http_acquire_handle(ctx);
+    if (!t->curl) {
+        return false; // called function will print the error
+    }
+    t->chunk.memory = NULL;
+    http_transfer_reset_chunk(t);
+    t->resolve_slist = NULL;
+    t->dns_host = NULL;
+    t->dns_port = NULL;
+    http_transfer_use_dns_cache(t, url);
+
+    t->header_slist = curl_slist_append(NULL, "Content-Type: application/json");
+    curl_easy_setopt(t->curl, CURLOPT_FAILONERROR, 400);
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, t->header_slist);
+    curl_easy_setopt(t->curl, CURLOPT_URL, url);
+    if (send_str) {
+        curl_easy_setopt(t->curl, CURLOPT_POSTFIELDS, send_str);
+    }
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_memory_cb);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, (void *) &t->chunk);
+    return true;
+}
+
+static void http_transfer_finish(IotcHttpContext *ctx, HttpTransfer *t, CURLcode res,
+                                 IotConnectHttpResponse *response) {
+    /* Check for errors */
+    if (res != CURLE_OK) {
+        IOTC_ERROR("iotconnect_https_request() failed with error: \"%s\"", curl_easy_strerror(res));
+        free(t->chunk.memory);
+        t->chunk.memory = NULL;
+    } else if (t->chunk.size == 0) {
+        IOTC_ERROR("iotconnect_https_request(): No data returned");
+        free(t->chunk.memory);
+        t->chunk.memory = NULL;
+    }
+    response->data = t->chunk.memory;
+    response->size = t->chunk.memory ? t->chunk.size : 0;
+    response->json_start = t->chunk.memory ? t->chunk.json.start : -1;
+    response->is_json_complete = t->chunk.memory && t->chunk.json.is_complete;
+    /* always cleanup */
+    iotc_http_release_handle(ctx, t->curl);
+    curl_slist_free_all(t->header_slist);
+    curl_slist_free_all(t->resolve_slist);
+    curl_free(t->dns_host);
+    curl_free(t->dns_port);
+    t->curl = NULL;
+}
+
+int iotc_http_request(
+        IotcHttpContext *ctx,
         IotConnectHttpResponse *response,
         const char *url,
         const char *send_str
 ) {
-    CURL *curl;
     CURLcode res = (!CURLE_OK); /* FIXME there's probably a better value to initialize this too */
 
     if (NULL == response) {
         IOTC_ERROR("iotconnect_https_request() requires a valid IotConnectHttpResponse pointer.");
         return res;
     }
-    response->data = NULL;
+    http_response_init(response);
 
-    /* In windows, this will init the winsock stuff */
-    curl_global_init(CURL_GLOBAL_ALL);
+    HttpTransfer t;
+    if (http_transfer_start(ctx, &t, url, send_str)) {
+        /* Perform the request, res will get the return code */
+        res = curl_easy_perform(t.curl);
+        if (http_transfer_fall_back_to_dns(&t, res)) {
+            res = curl_easy_perform(t.curl);
+        }
+        http_transfer_finish(ctx, &t, res, response);
+    }
+    return (int) res;
+}
 
-    /* get a curl handle */
-    curl = curl_easy_init();
-    if (curl) {
-        struct MemoryStruct chunk;
-        chunk.memory = malloc(1);  /* will be grown as needed by the realloc above */
-        chunk.size = 0;    /* no data at this point */
-
-        struct curl_slist *header_slist = NULL;
-        header_slist = curl_slist_append(header_slist, "Content-Type: application/json");
-        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 400);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_slist);
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        if (send_str) {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, send_str);
+void iotc_http_request_many(IotcHttpContext *ctx, IotcHttpRequest *requests, size_t num_requests,
+                            unsigned int max_concurrent) {
+    for (size_t i = 0; i < num_requests; i++) {
+        http_response_init(&requests[i].response);
+        requests[i].status = (int) (!CURLE_OK);
+    }
+    if (0 == num_requests) {
+        return;
+    }
+    if (0 == max_concurrent) {
+        max_concurrent = IOTC_HTTP_DEFAULT_CONCURRENCY;
+    }
+    CURLM *multi = curl_multi_init();
+    HttpTransfer *transfers = calloc(num_requests, sizeof(HttpTransfer));
+    if (!multi || !transfers) {
+        IOTC_ERROR("Unable to set up concurrent HTTP requests!");
+        if (multi) curl_multi_cleanup(multi);
+        free(transfers);
+        return;
+    }
+
+    size_t next = 0;
+    unsigned int num_running = 0;
+    do {
+        while (next < num_requests && num_running < max_concurrent) {
+            IotcHttpRequest *r = &requests[next];
+            HttpTransfer *t = &transfers[next];
+            if (http_transfer_start(ctx, t, r->url, r->send_str)) {
+                curl_easy_setopt(t->curl, CURLOPT_PRIVATE, (void *) r);
+                curl_multi_add_handle(multi, t->curl);
+                num_running++;
+            }
+            next++;
         }
-        response->data = malloc(1); // start with 1 byte and regrow into write_memory_cb
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_cb);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &chunk);
 
-        /* Perform the request, res will get the return code */
-        res = curl_easy_perform(curl);
-        /* Check for errors */
-        if (res != CURLE_OK) {
-            IOTC_ERROR("iotconnect_https_request() failed with error: \"%s\"", curl_easy_strerror(res));
-            free(chunk.memory);
-            chunk.memory = NULL;
-        } else if (chunk.size == 0) {
-            IOTC_ERROR("iotconnect_https_request(): No data returned");
-            free(chunk.memory);
-            chunk.memory = NULL;
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (CURLMSG_DONE != msg->msg) {
+                continue;
+            }
+            IotcHttpRequest *r = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &r);
+            HttpTransfer *t = &transfers[r - requests];
+            const CURLcode result = msg->data.result; // msg is not valid after removing the handle
+            curl_multi_remove_handle(multi, t->curl);
+            if (http_transfer_fall_back_to_dns(t, result)) {
+                curl_multi_add_handle(multi, t->curl);
+                continue;
+            }
+            r->status = (int) result;
+            http_transfer_finish(ctx, t, result, &r->response);
+            num_running--;
         }
-        response->data = chunk.memory;
-        /* always cleanup */
-        curl_easy_cleanup(curl);
+
+        if (num_running > 0) {
+            int numfds = 0;
+            curl_multi_wait(multi, NULL, 0, 100, &numfds);
+            if (0 == numfds) {
+                iotc_platform_sleep_ms(1); // nothing to wait on yet, as with name resolution on older curl
+            }
+        }
+    } while (num_running > 0 || next < num_requests);
+
+    curl_multi_cleanup(multi);
+    free(transfers);
+}
+
+int iotconnect_https_request(
+        IotConnectHttpResponse *response,
+        const char *url,
+        const char *send_str
+) {
+    IotcHttpContext *ctx = iotc_http_context_create();
+    if (!ctx) {
+        if (response) {
+            http_response_init(response);
+        }
+        return (int) (!CURLE_OK); // called function will print the error
     }
-    curl_global_cleanup();
-    return (int) res;
+    int res = iotc_http_request(ctx, response, url, send_str);
+    iotc_http_context_destroy(ctx);
+    return res;
 }
 
 
 void iotconnect_free_https_response(IotConnectHttpResponse *response) {
     free(response->data);
     response->data = NULL;
+    response->size = 0;
 }
@@ -0,0 +1,427 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_http_request.h"
+#include "iotc_ota_download.h"
+
+// curl receives into a buffer of this size and passes it straight on, so this is all the memory needed for data
+#ifndef IOTC_OTA_BUFFER_SIZE
+#define IOTC_OTA_BUFFER_SIZE (16 * 1024)
+#endif
+
+#define OTA_DEFAULT_MAX_RETRIES 5
+#define OTA_DEFAULT_RETRY_DELAY_MS 1000
+#define OTA_MAX_RETRY_DELAY_MS 60000
+#define OTA_DEFAULT_STALL_TIMEOUT_S 30
+
+// Next to a partial file, records the URL and the ETag or Last-Modified of the image that it belongs to
+#define OTA_VALIDATOR_SUFFIX ".resume"
+#define OTA_VALIDATOR_MAX_LEN 128
+
+typedef struct {
+    const IotcOtaDownloadConfig *config;
+    CURL *curl;
+    FILE *file;
+    char *validator_path; // NULL unless resuming a file
+    char validator[OTA_VALIDATOR_MAX_LEN]; // strong ETag or Last-Modified of the image. Empty if not known.
+    IotcSha256 sha;
+    uint64_t offset; // bytes of the image received so far
+    uint64_t total; // zero if not known
+    // from the headers of the current response
+    char response_etag[OTA_VALIDATOR_MAX_LEN];
+    char response_last_modified[OTA_VALIDATOR_MAX_LEN];
+    uint64_t range_total; // the image size in Content-Range, zero if not known
+    bool is_first_chunk; // of the current request
+    bool is_aborted; // by a write error or the sink, so the transfer can't be retried
+} OtaDownload;
+
+void iotc_ota_download_init_config(IotcOtaDownloadConfig *config) {
+    memset(config, 0, sizeof(IotcOtaDownloadConfig));
+    config->max_retries = OTA_DEFAULT_MAX_RETRIES;
+    config->retry_delay_ms = OTA_DEFAULT_RETRY_DELAY_MS;
+    config->stall_timeout_s = OTA_DEFAULT_STALL_TIMEOUT_S;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_sha256(const char *hex, unsigned char digest[IOTC_SHA256_SIZE]) {
+    if (strlen(hex) != IOTC_SHA256_SIZE * 2) {
+        return false;
+    }
+    for (int i = 0; i < IOTC_SHA256_SIZE; i++) {
+        const int hi = hex_value(hex[i * 2]);
+        const int lo = hex_value(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        digest[i] = (unsigned char) (hi << 4 | lo);
+    }
+    return true;
+}
+
+// Returns the value if the header line is the named header, or NULL. The value ends at the line end.
+static const char *get_header_value(const char *line, size_t len, const char *name) {
+    const size_t name_len = strlen(name);
+    if (len <= name_len || line[name_len] != ':') {
+        return NULL;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        if (tolower((unsigned char) line[i]) != tolower((unsigned char) name[i])) {
+            return NULL;
+        }
+    }
+    const char *value = &line[name_len + 1];
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    return value;
+}
+
+// Copies the header value without the line end. Values that don't fit are dropped, as a prefix is not useful.
+static void copy_header_value(char *dst, size_t size, const char *value, const char *line_end) {
+    size_t len = (size_t) (line_end - value);
+    while (len > 0 && (value[len - 1] == '\r' || value[len - 1] == '\n' || value[len - 1] == ' ')) {
+        len--;
+    }
+    if (len >= size) {
+        len = 0;
+    }
+    memcpy(dst, value, len);
+    dst[len] = 0;
+}
+
+static size_t ota_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+    const size_t len = size * nitems;
+    const char *line_end = buffer + len;
+    OtaDownload *d = (OtaDownload *) userp;
+    const char *value;
+    if (len > 5 && 0 == memcmp(buffer, "HTTP/", 5)) {
+        // a new response, after a redirect for example
+        d->response_etag[0] = 0;
+        d->response_last_modified[0] = 0;
+        d->range_total = 0;
+    } else if ((value = get_header_value(buffer, len, "ETag"))) {
+        // weak tags can't be used for ranges
+        if (*value == '"') {
+            copy_header_value(d->response_etag, sizeof(d->response_etag), value, line_end);
+        }
+    } else if ((value = get_header_value(buffer, len, "Last-Modified"))) {
+        copy_header_value(d->response_last_modified, sizeof(d->response_last_modified), value, line_end);
+    } else if ((value = get_header_value(buffer, len, "Content-Range"))) {
+        // "bytes 100-199/1000" or "bytes */1000"
+        const char *slash = memchr(value, '/', (size_t) (line_end - value));
+        if (slash && slash + 1 < line_end && isdigit((unsigned char) slash[1])) {
+            d->range_total = strtoull(slash + 1, NULL, 10);
+        }
+    }
+    return len;
+}
+
+// Returns true if the validator file is for this URL, and loads the validator from it
+static bool ota_load_validator(OtaDownload *d) {
+    const char *url = d->config->url;
+    const size_t url_len = strlen(url);
+    const size_t max_len = url_len + 1 + sizeof(d->validator);
+    char *data = malloc(max_len + 1);
+    if (!data) {
+        IOTC_ERROR("OTA: Out of memory while reading %s!", d->validator_path);
+        return false;
+    }
+    size_t len = 0;
+    FILE *f = fopen(d->validator_path, "rb");
+    if (f) {
+        len = fread(data, 1, max_len, f);
+        fclose(f);
+    }
+    data[len] = 0;
+    // "<url>\n<validator>\n", where a missing line end means that writing the file was interrupted
+    bool is_valid = len > url_len + 2 && 0 == memcmp(data, url, url_len) && data[url_len] == '\n'
+                    && data[len - 1] == '\n';
+    if (is_valid) {
+        data[len - 1] = 0;
+        const char *validator = &data[url_len + 1];
+        is_valid = !strchr(validator, '\n') && strlen(validator) < sizeof(d->validator);
+        if (is_valid) {
+            strcpy(d->validator, validator);
+        }
+    }
+    free(data);
+    return is_valid;
+}
+
+// Records the validator of a download that starts from zero, or removes the record if the server sent none.
+// Called before any data is written, so that the file is never resumed with a validator of a different image.
+static void ota_save_validator(OtaDownload *d) {
+    strcpy(d->validator, d->response_etag[0] ? d->response_etag : d->response_last_modified);
+    if (!d->validator_path) {
+        return;
+    }
+    remove(d->validator_path);
+    if (!d->validator[0]) {
+        IOTC_WARN("OTA: The server sent no ETag or Last-Modified, so the download can't be resumed later.");
+        return;
+    }
+    FILE *f = fopen(d->validator_path, "wb");
+    if (!f || fprintf(f, "%s\n%s\n", d->config->url, d->validator) < 0 || 0 != fclose(f)) {
+        IOTC_WARN("OTA: Unable to write %s. The download can't be resumed later.", d->validator_path);
+        if (f) {
+            remove(d->validator_path);
+        }
+    }
+}
+
+static size_t ota_write_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+    const size_t len = size * nmemb;
+    OtaDownload *d = (OtaDownload *) userp;
+    if (d->is_first_chunk) {
+        d->is_first_chunk = false;
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t content_length = -1;
+        curl_easy_getinfo(d->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+#else
+        double content_length = -1;
+        curl_easy_getinfo(d->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+#endif
+        if (content_length > 0) {
+            d->total = d->offset + (uint64_t) content_length; // the length of the remaining range when resuming
+        }
+        if (0 == d->offset) {
+            ota_save_validator(d);
+        }
+    }
+    if (d->file) {
+        if (fwrite(contents, 1, len, d->file) != len) {
+            IOTC_ERROR("OTA: Unable to write to %s!", d->config->file_path);
+            d->is_aborted = true;
+            return 0;
+        }
+    } else if (!d->config->sink_cb(d->config->context, d->offset, contents, len)) {
+        IOTC_WARN("OTA: Download aborted by the application.");
+        d->is_aborted = true;
+        return 0;
+    }
+    iotc_sha256_update(&d->sha, contents, len);
+    d->offset += len;
+    if (d->config->progress_cb) {
+        d->config->progress_cb(d->config->context, d->offset, d->total);
+    }
+    return len;
+}
+
+// Continues a partial file of the same image by hashing what is already there.
+// Uses a fixed buffer, like the download itself.
+static int ota_open_file(OtaDownload *d) {
+    const char *path = d->config->file_path;
+    if (d->config->resume_file) {
+        const size_t validator_path_len = strlen(path) + sizeof(OTA_VALIDATOR_SUFFIX);
+        d->validator_path = malloc(validator_path_len);
+        if (!d->validator_path) {
+            IOTC_ERROR("OTA: Out of memory while opening %s!", path);
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        snprintf(d->validator_path, validator_path_len, "%s" OTA_VALIDATOR_SUFFIX, path);
+        FILE *f = ota_load_validator(d) ? fopen(path, "rb") : NULL;
+        if (f) {
+            unsigned char buffer[1024];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+                iotc_sha256_update(&d->sha, buffer, n);
+                d->offset += n;
+            }
+            fclose(f);
+            if (d->offset > 0) {
+                IOTC_INFO("OTA: Resuming %s at %llu bytes.", path, (unsigned long long) d->offset);
+            }
+        }
+        if (0 == d->offset) {
+            // missing, empty or from a different image
+            d->validator[0] = 0;
+            remove(d->validator_path);
+        }
+    }
+    d->file = fopen(path, d->offset > 0 ? "ab" : "wb");
+    if (!d->file) {
+        IOTC_ERROR("OTA: Unable to open %s for writing!", path);
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+// The server can't resume or the image has changed, so the image is downloaded again from the start
+static int ota_restart(OtaDownload *d) {
+    iotc_sha256_init(&d->sha);
+    d->offset = 0;
+    d->total = 0;
+    d->validator[0] = 0;
+    if (d->file) {
+        d->file = freopen(d->config->file_path, "wb", d->file);
+        if (!d->file) {
+            IOTC_ERROR("OTA: Unable to open %s for writing!", d->config->file_path);
+            return IOTCL_ERR_FAILED;
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+static CURLcode ota_perform(IotcHttpContext *ctx, OtaDownload *d) {
+    d->curl = iotc_http_acquire_handle(ctx);
+    if (!d->curl) {
+        return CURLE_OUT_OF_MEMORY; // called function will print the error
+    }
+    d->is_first_chunk = true;
+    curl_easy_setopt(d->curl, CURLOPT_URL, d->config->url);
+    curl_easy_setopt(d->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(d->curl, CURLOPT_MAXREDIRS, 5L);
+    curl_easy_setopt(d->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(d->curl, CURLOPT_BUFFERSIZE, (long) IOTC_OTA_BUFFER_SIZE);
+    curl_easy_setopt(d->curl, CURLOPT_WRITEFUNCTION, ota_write_cb);
+    curl_easy_setopt(d->curl, CURLOPT_WRITEDATA, (void *) d);
+    // anything slower than a byte per second for this long is a stall
+    curl_easy_setopt(d->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(d->curl, CURLOPT_LOW_SPEED_TIME, (long) d->config->stall_timeout_s);
+    curl_easy_setopt(d->curl, CURLOPT_HEADERFUNCTION, ota_header_cb);
+    curl_easy_setopt(d->curl, CURLOPT_HEADERDATA, (void *) d);
+    struct curl_slist *headers = NULL;
+    const uint64_t start_offset = d->offset;
+    if (start_offset > 0) {
+        curl_easy_setopt(d->curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) start_offset);
+        if (d->validator[0]) {
+            // the server sends the whole image instead of the range if the image has changed
+            char if_range[sizeof("If-Range: ") + OTA_VALIDATOR_MAX_LEN];
+            snprintf(if_range, sizeof(if_range), "If-Range: %s", d->validator);
+            headers = curl_slist_append(NULL, if_range);
+            curl_easy_setopt(d->curl, CURLOPT_HTTPHEADER, headers);
+        }
+    }
+    CURLcode res = curl_easy_perform(d->curl);
+    long http_code = 0;
+    curl_easy_getinfo(d->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    iotc_http_release_handle(ctx, d->curl);
+    curl_slist_free_all(headers);
+    d->curl = NULL;
+    if (start_offset > 0 && CURLE_HTTP_RETURNED_ERROR == res && 416 == http_code) {
+        // the range starts at the end of the image, so the partial file is complete if it is the same image
+        const char *etag = d->response_etag;
+        const bool is_same_image = d->validator[0] && (!etag[0] || 0 == strcmp(etag, d->validator));
+        if (is_same_image && d->range_total == start_offset) {
+            res = CURLE_OK;
+        } else {
+            res = CURLE_RANGE_ERROR;
+        }
+    } else if (start_offset > 0 && CURLE_OK == res && 200 == http_code) {
+        // curl ends a whole image response without writing it if its size happens to match the range start
+        res = CURLE_RANGE_ERROR;
+    } else if (CURLE_HTTP_RETURNED_ERROR == res && http_code < 500) {
+        d->is_aborted = true; // a client error will not go away by retrying
+    }
+    return res;
+}
+
+static int ota_run(IotcHttpContext *ctx, OtaDownload *d) {
+    unsigned int retry_delay_ms = d->config->retry_delay_ms;
+    unsigned int attempt = 0;
+    for (;;) {
+        const uint64_t start_offset = d->offset;
+        CURLcode res = ota_perform(ctx, d);
+        if (CURLE_OK == res) {
+            return IOTCL_SUCCESS;
+        }
+        if (d->is_aborted) {
+            IOTC_ERROR("OTA: Download failed with error: \"%s\"", curl_easy_strerror(res));
+            return IOTCL_ERR_FAILED;
+        }
+        if (CURLE_RANGE_ERROR == res) {
+            IOTC_WARN("OTA: The image has changed or the server does not support resuming. Starting over...");
+            if (ota_restart(d)) {
+                return IOTCL_ERR_FAILED; // called function will print the error
+            }
+            continue;
+        }
+        if (d->offset > start_offset) {
+            // progress was made, so the connection was lost rather than the server refusing
+            attempt = 0;
+            retry_delay_ms = d->config->retry_delay_ms;
+        }
+        if (attempt++ >= d->config->max_retries) {
+            IOTC_ERROR("OTA: Download failed with error: \"%s\"", curl_easy_strerror(res));
+            return IOTCL_ERR_FAILED;
+        }
+        IOTC_WARN("OTA: Download interrupted at %llu bytes: \"%s\". Resuming in %u ms...",
+                  (unsigned long long) d->offset, curl_easy_strerror(res), retry_delay_ms);
+        iotc_platform_sleep_ms(retry_delay_ms);
+        retry_delay_ms *= 2;
+        if (retry_delay_ms > OTA_MAX_RETRY_DELAY_MS) {
+            retry_delay_ms = OTA_MAX_RETRY_DELAY_MS;
+        }
+    }
+}
+
+int iotc_ota_download(const IotcOtaDownloadConfig *config, IotcOtaDownloadResult *result) {
+    unsigned char expected[IOTC_SHA256_SIZE];
+    if (!config->url || (!config->file_path && !config->sink_cb)) {
+        IOTC_ERROR("OTA: The download requires a URL and a file path or a sink!");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if (config->expected_sha256 && !parse_sha256(config->expected_sha256, expected)) {
+        IOTC_ERROR("OTA: Expected SHA-256 must have 64 hex characters!");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    // the context keeps the connection and TLS session between retries
+    IotcHttpContext *ctx = iotc_http_context_create();
+    if (!ctx) {
+        return IOTCL_ERR_FAILED; // called function will print the error
+    }
+
+    OtaDownload d;
+    memset(&d, 0, sizeof(d));
+    d.config = config;
+    iotc_sha256_init(&d.sha);
+    int status = config->file_path ? ota_open_file(&d) : IOTCL_SUCCESS;
+    if (!status) {
+        status = ota_run(ctx, &d);
+    }
+    if (d.file && 0 != fclose(d.file) && !status) {
+        IOTC_ERROR("OTA: Unable to write to %s!", config->file_path);
+        status = IOTCL_ERR_FAILED;
+    }
+    iotc_http_context_destroy(ctx);
+    if (status) {
+        free(d.validator_path);
+        return status;
+    }
+
+    IotcOtaDownloadResult r;
+    r.size = d.offset;
+    iotc_sha256_final(&d.sha, r.sha256);
+    if (config->expected_sha256 && 0 != memcmp(expected, r.sha256, IOTC_SHA256_SIZE)) {
+        IOTC_ERROR("OTA: SHA-256 of the downloaded image does not match!");
+        if (config->file_path) {
+            remove(config->file_path); // so that it is not resumed
+        }
+        if (d.validator_path) {
+            remove(d.validator_path);
+        }
+        free(d.validator_path);
+        return IOTCL_ERR_FAILED;
+    }
+    free(d.validator_path);
+    if (result) {
+        *result = r;
+    }
+    return IOTCL_SUCCESS;
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_C2D_DISPATCH_H
+#define IOTC_C2D_DISPATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Hands inbound messages from the MQTT receive thread to a pool of worker threads through a bounded queue,
+// so that slow command and OTA callbacks do not hold up the connection.
+typedef struct IotcDispatcher IotcDispatcher;
+
+// Invoked on a worker thread for each queued message
+typedef void (*IotcDispatchHandler)(void *context, const unsigned char *message, size_t message_len);
+
+// Invoked on the receiving thread with the NUL terminated copy of each message. Returns true if the message
+// counts towards max_per_command for the returned key, which is allocated with malloc(), or NULL.
+// NULL is a valid key, distinct from any string.
+typedef bool (*IotcDispatchKeyFunc)(void *context, const char *message, size_t message_len, char **key);
+
+// Returns NULL on error
+IotcDispatcher *iotc_dispatch_create(const IotConnectC2dDispatchConfig *config, IotcDispatchHandler handler,
+                                     IotcDispatchKeyFunc key_func, void *context);
+
+// Queues a copy of the message. Returns false if the queue is full, in which case the caller should stop
+// receiving and try again later. Workers take the oldest message whose key is under max_per_command,
+// so messages with other keys do not wait behind a busy one.
+bool iotc_dispatch_push(IotcDispatcher *d, const unsigned char *message, size_t message_len);
+
+// Waits for the running handlers to return and discards the queued messages.
+// Must not be called from a handler.
+void iotc_dispatch_destroy(IotcDispatcher *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_C2D_DISPATCH_H
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_CODEC_H
+#define IOTC_CODEC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Characters written by iotc_base64_encode(), without the terminating NUL
+#define IOTC_BASE64_ENCODED_LEN(n) (4 * (((n) + 2) / 3))
+// Upper bound of the bytes written by iotc_base64_decode()
+#define IOTC_BASE64_DECODED_MAX_LEN(n) (3 * (((n) + 3) / 4))
+// Upper bound of the characters written by iotc_uri_encode(), without the terminating NUL
+#define IOTC_URI_ENCODED_MAX_LEN(n) (3 * (n))
+
+// Standard base64 with padding. output must fit IOTC_BASE64_ENCODED_LEN(len) + 1 characters.
+// Returns the length of the NUL terminated output.
+size_t iotc_base64_encode(const unsigned char *input, size_t len, char *output);
+
+// Decodes standard base64. Trailing padding is optional.
+// Returns the decoded length, or -1 if the input is not valid base64 or the output does not fit in size.
+long iotc_base64_decode(const char *input, size_t len, unsigned char *output, size_t size);
+
+// Percent-encodes everything except unreserved characters (RFC 3986).
+// output must fit IOTC_URI_ENCODED_MAX_LEN(len) + 1 characters.
+// Returns the length of the NUL terminated output.
+size_t iotc_uri_encode(const char *input, size_t len, char *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_CODEC_H
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_COMPRESSION_H
+#define IOTC_COMPRESSION_H
+
+#include <stddef.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Compresses payloads into zlib (RFC 1950) streams with a preset dictionary.
+// The compressor is not thread safe and keeps its buffers between messages.
+typedef struct IotcCompressor IotcCompressor;
+
+// Returns NULL on error, or if the SDK was built without zlib
+IotcCompressor *iotc_compressor_create(const IotConnectCompressionConfig *config);
+
+// Compresses the payload. Returns false if compressing fails or does not save enough space,
+// in which case the payload should be sent as it is.
+// The output is valid until the next call or until the compressor is destroyed.
+bool iotc_compressor_compress(IotcCompressor *c, const void *payload, size_t payload_len,
+                              const unsigned char **out, size_t *out_len);
+
+void iotc_compressor_destroy(IotcCompressor *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_COMPRESSION_H
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_CRYPTO_H
+#define IOTC_CRYPTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "iotc_sha256.h"
+
+// HMAC-SHA256 for SAS tokens. The backend is chosen at build time with the IOTC_CRYPTO_BACKEND CMake option,
+// which defines IOTC_CRYPTO_OPENSSL or IOTC_CRYPTO_MBEDTLS. Without either, the SDK's own SHA-256 is used.
+#if defined(IOTC_CRYPTO_OPENSSL) && defined(IOTC_CRYPTO_MBEDTLS)
+#error "Only one of IOTC_CRYPTO_OPENSSL and IOTC_CRYPTO_MBEDTLS can be defined"
+#endif
+
+#if defined(IOTC_CRYPTO_MBEDTLS)
+#include "mbedtls/sha256.h"
+#endif
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+#if defined(IOTC_CRYPTO_OPENSSL)
+#define IOTC_CRYPTO_BACKEND_NAME "openssl"
+#elif defined(IOTC_CRYPTO_MBEDTLS)
+#define IOTC_CRYPTO_BACKEND_NAME "mbedtls"
+#else
+#define IOTC_CRYPTO_BACKEND_NAME "builtin"
+#endif
+
+// A key with its inner and outer pad blocks already hashed, so that each MAC costs two compressions
+// plus the message. Not thread safe.
+typedef struct {
+#if defined(IOTC_CRYPTO_OPENSSL)
+    struct evp_md_ctx_st *inner;
+    struct evp_md_ctx_st *outer;
+    struct evp_md_ctx_st *work;
+#elif defined(IOTC_CRYPTO_MBEDTLS)
+    mbedtls_sha256_context inner;
+    mbedtls_sha256_context outer;
+#else
+    IotcSha256 inner;
+    IotcSha256 outer;
+#endif
+} IotcHmacSha256;
+
+// Returns false if the backend fails to initialize. The key is not retained.
+bool iotc_hmac_sha256_init(IotcHmacSha256 *h, const void *key, size_t key_len);
+
+bool iotc_hmac_sha256_compute(IotcHmacSha256 *h, const void *data, size_t len,
+                              unsigned char mac[IOTC_SHA256_SIZE]);
+
+// Wipes the key schedule
+void iotc_hmac_sha256_deinit(IotcHmacSha256 *h);
+
+// One shot version of the above
+bool iotc_hmac_sha256(const void *key, size_t key_len, const void *data, size_t len,
+                      unsigned char mac[IOTC_SHA256_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_CRYPTO_H
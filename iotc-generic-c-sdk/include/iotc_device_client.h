@@ -7,35 +7,91 @@
 #define IOTC_DEVICE_CLIENT_H
 
 #include "iotconnect.h"
+#include "iotc_sas_token.h"
 
 #ifdef __cplusplus
 extern   "C" {
 #endif
 
 
-typedef void (*IotConnectC2dCallback)(const unsigned char* message, size_t message_len);
+// Returned by iotc_device_client_connect() if the broker rejects the client ID or the credentials.
+// The MQTT configuration from the identity response is likely stale.
+#define IOTC_DEVICE_CLIENT_ERR_REJECTED (-1000)
+
+typedef struct IotcDeviceClient IotcDeviceClient;
+
+// The context is the one set in IotConnectDeviceClientConfig
+// Returns false if the message can not be accepted right now. The device client will stop receiving
+// and offer the same message again later.
+typedef bool (*IotConnectC2dCallback)(void *context, const unsigned char* message, size_t message_len);
+typedef void (*IotcDeviceClientStatusCallback)(void *context, IotConnectMqttStatus status);
+// Reports the outcome of a message that was sent successfully, with the message_id that it was sent with
+typedef void (*IotcDeviceClientDeliveryCallback)(void *context, uint32_t message_id, bool is_delivered);
+// Reports the TLS, CONNACK and SUBACK phases while connecting
+typedef void (*IotcDeviceClientPhaseCallback)(void *context, IotConnectConnectPhase phase);
+
+// MQTT connection details of a device, obtained from the identity response
+typedef struct {
+    char *host;
+    char *client_id;
+    char *username; // can be NULL
+    char *pub_rpt; // telemetry topic
+    char *pub_ack; // command and OTA acknowledgement topic
+    char *sub_c2d; // inbound command and OTA topic
+} IotConnectMqttIdentity;
 
 typedef struct {
     int qos; // default QOS is 1
+    int max_inflight; // see IotConnectClientConfig.max_inflight
     IotConnectAuthInfo *auth; // Pointer to IoTConnect auth configuration
+    IotConnectMqttIdentity *mqtt; // Pointer to the device MQTT configuration
+    // Issues the password with symmetric key authentication. If NULL, a token is generated on each connect.
+    IotcSasToken *sas_token;
     IotConnectC2dCallback c2d_msg_cb; // callback for inbound messages
-    IotConnectMqttStatusCallback status_cb; // callback for connection and message status
+    IotcDeviceClientStatusCallback status_cb; // callback for connection status
+    IotcDeviceClientDeliveryCallback delivery_cb; // callback for message status
+    IotcDeviceClientPhaseCallback phase_cb; // callback for connect progress. Can be NULL.
+    void *context; // passed to the callbacks
 } IotConnectDeviceClientConfig;
 
-int iotc_device_client_connect(IotConnectDeviceClientConfig *c);
+IotcDeviceClient *iotc_device_client_create(void);
+
+// Connects the client. The client can be connected again after a disconnect or a connection loss.
+int iotc_device_client_connect(IotcDeviceClient *dc, IotConnectDeviceClientConfig *c);
 
-int iotc_device_client_disconnect(void);
+int iotc_device_client_disconnect(IotcDeviceClient *dc);
 
-bool iotc_device_client_is_connected(void);
+bool iotc_device_client_is_connected(IotcDeviceClient *dc);
+
+// Frees the resources of a lost connection, which can not be freed from the thread that reports the loss.
+// Call periodically. Connecting again also frees them.
+void iotc_device_client_poll(IotcDeviceClient *dc);
+
+// Returns true if the last successful connect resumed a previous TLS session instead of doing a full handshake.
+// Paho does not expose the TLS session, so the paho implementation always does a full handshake.
+bool iotc_device_client_is_tls_resumed(IotcDeviceClient *dc);
 
 // Sends the message with the underlying MQTT client (Paho) with configured default QOS and returns the error if
 // sending or confirming (acknowledging) the message fails. The error will be client-specific.
-int iotc_device_client_send_message(const char* topic, const char *message);
+// If max_inflight is configured, the function will only block if max_inflight messages are already awaiting
+// acknowledgement, and the delivery outcome will be reported asynchronously with the delivery callback.
+// If the function returns an error, the outcome is not reported with the delivery callback.
+int iotc_device_client_send_message(IotcDeviceClient *dc, const char* topic, const char *message);
 
 // Same as iotc_device_client_send_message() with with specified qos
-int iotc_device_client_send_message_qos(const char* topic, const char *message, int qos);
+int iotc_device_client_send_message_qos(IotcDeviceClient *dc, const char* topic, const char *message, int qos);
+
+// Same as iotc_device_client_send_message_qos() with a binary payload of given length.
+// The message_id is passed to the delivery callback. Messages sent with other functions are reported with zero.
+int iotc_device_client_send_message_len(IotcDeviceClient *dc, const char *topic, const void *payload,
+                                        size_t payload_len, int qos, uint32_t message_id);
+
+// Same as iotc_device_client_send_message_len() with the payload made up from multiple buffers
+int iotc_device_client_send_message_iov(IotcDeviceClient *dc, const char *topic, const IotConnectBuffer *bufs,
+                                        size_t num_bufs, int qos, uint32_t message_id);
 
-void iotc_device_client_receive(void);
+// Disconnects, if needed, and frees the client
+void iotc_device_client_destroy(IotcDeviceClient *dc);
 
 #ifdef __cplusplus
 }
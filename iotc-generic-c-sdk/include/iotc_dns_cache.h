@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_DNS_CACHE_H
+#define IOTC_DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Addresses kept for each host
+#ifndef IOTC_DNS_MAX_ADDRESSES
+#define IOTC_DNS_MAX_ADDRESSES 8
+#endif
+
+// Longest numeric address from iotc_dns_address_to_string(), with brackets for IPv6
+#define IOTC_DNS_ADDRESS_STRLEN 48
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t len;
+} IotcDnsAddress;
+
+// Process wide cache of resolved host addresses. A background thread resolves the hosts again before their
+// addresses expire, so that connecting does not wait for DNS. The system resolver does not report record
+// TTLs, so all entries use the same configured TTL.
+// Reference counted. The first caller sets the TTL. Returns zero on success.
+int iotc_dns_cache_acquire(unsigned int ttl_s);
+void iotc_dns_cache_release(void);
+
+// Copies up to max addresses of the host into addresses and returns how many there are.
+// The host is resolved and added to the cache if it is not there, or if its addresses expired.
+// Returns zero if the cache is not running or the host can't be resolved, in which case the caller should
+// resolve the host itself. Expired addresses are returned if resolving fails.
+size_t iotc_dns_cache_lookup(const char *host, const char *port, IotcDnsAddress *addresses, size_t max);
+
+// Adds the host to the cache in the background, so that the first connect does not wait for it
+void iotc_dns_cache_prefetch(const char *host, const char *port);
+
+// Removes the host after connecting to all of its cached addresses failed, so that it is resolved again
+void iotc_dns_cache_invalidate(const char *host, const char *port);
+
+// Formats the numeric address, without the port. Returns false if it doesn't fit.
+bool iotc_dns_address_to_string(const IotcDnsAddress *address, char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_DNS_CACHE_H
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_ENGINE_H
+#define IOTC_ENGINE_H
+
+#include "iotconnect.h"
+#include "iotc_device_client.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * The engine connects many devices over a small, fixed pool of worker threads, instead of having a paho client,
+ * with its own threads, for each device. Each worker waits on the sockets of its devices with epoll,
+ * so the engine is only available on Linux.
+ * Devices with the same trust store share the TLS context.
+ * Each session caches its TLS session (or TLS 1.3 ticket) and offers it on the next connect to the same host,
+ * which saves a round trip and the certificate exchange when the server accepts it.
+ *
+ * To use the engine, set IotConnectClientConfig.engine before calling iotconnect_client_create().
+ * Publishing with the engine is always pipelined. See IotConnectClientConfig.max_inflight.
+ * Callbacks are invoked from the worker threads, and must not destroy their own client.
+ */
+
+typedef struct {
+    int num_workers; // Number of worker threads. Defaults to the number of CPUs if zero.
+} IotcEngineConfig;
+
+// Returns NULL on error
+IotcEngine *iotc_engine_create(const IotcEngineConfig *c);
+
+// All clients using the engine must be destroyed first
+void iotc_engine_destroy(IotcEngine *engine);
+
+// A device connection on the engine. Same as the device client, so see iotc_device_client.h for details.
+typedef struct IotcEngineSession IotcEngineSession;
+
+IotcEngineSession *iotc_engine_session_create(IotcEngine *engine);
+
+int iotc_engine_session_connect(IotcEngineSession *s, IotConnectDeviceClientConfig *c);
+
+int iotc_engine_session_disconnect(IotcEngineSession *s);
+
+bool iotc_engine_session_is_connected(IotcEngineSession *s);
+
+bool iotc_engine_session_is_tls_resumed(IotcEngineSession *s);
+
+int iotc_engine_session_send_message_iov(IotcEngineSession *s, const char *topic, const IotConnectBuffer *bufs,
+                                         size_t num_bufs, int qos, uint32_t message_id);
+
+void iotc_engine_session_destroy(IotcEngineSession *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_ENGINE_H
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_IDENTITY_CACHE_H
+#define IOTC_IDENTITY_CACHE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Keeps the identity response of a device in a file, so that the client can connect after a restart
+// without the discovery and identity requests. The key identifies the device and environment that the
+// response belongs to. Files are replaced atomically, so a crash while saving leaves the previous entry.
+
+// Returns the cached response, which must be freed with free(), or NULL if there is no entry for this key.
+// *age_s receives the seconds since the entry was saved, by the wall clock. Negative if the clock went back.
+char *iotc_identity_cache_load(const char *path, const char *key, int64_t *age_s);
+
+int iotc_identity_cache_save(const char *path, const char *key, const char *response);
+
+void iotc_identity_cache_remove(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_IDENTITY_CACHE_H
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_LINK_ESTIMATOR_H
+#define IOTC_LINK_ESTIMATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Keeps rolling estimates of the link from the outcome of acknowledged messages, and derives the telemetry
+// batch limits and QOS from them. Not thread safe. Callers should provide their own locking.
+typedef struct {
+    IotConnectAdaptiveConfig config;
+    IotConnectLinkEstimate estimate;
+    double min_rtt_ms; // lowest RTT seen, as the baseline for detecting congestion
+    uint64_t window_start_us; // throughput is measured over windows of at least a second
+    size_t window_bytes;
+    unsigned int window_samples; // since the batch limits were last adjusted
+    unsigned int window_failures;
+    unsigned int qos0_count; // telemetry messages sent with QOS 0 since the last QOS 1 probe
+} IotcLinkEstimator;
+
+// The batch config provides the starting limits
+void iotc_link_init(IotcLinkEstimator *e, const IotConnectAdaptiveConfig *config,
+                    const IotConnectBatchConfig *batch);
+
+bool iotc_link_is_enabled(const IotcLinkEstimator *e);
+
+// Updates the estimates with the outcome of an acknowledged (QOS 1) message.
+// rtt_us is the time from when the message was handed to the MQTT client until it was acknowledged.
+void iotc_link_on_delivery(IotcLinkEstimator *e, bool is_delivered, uint64_t rtt_us, size_t size);
+
+// Returns the QOS for the next telemetry message
+int iotc_link_telemetry_qos(IotcLinkEstimator *e, int default_qos);
+
+// Applies the current batch limits to the batch config
+void iotc_link_apply_batch_limits(const IotcLinkEstimator *e, IotConnectBatchConfig *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_LINK_ESTIMATOR_H
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_OFFLINE_STORE_H
+#define IOTC_OFFLINE_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// A persistent FIFO of outbound MQTT messages in a memory mapped file with a fixed size.
+// When the store is full, the oldest messages are dropped to make room for new ones.
+// The store is not thread safe. Callers should provide their own locking.
+typedef struct IotcOfflineStore IotcOfflineStore;
+
+typedef struct {
+    uint64_t seq; // unique and increasing for each stored message
+    const char *topic;
+    const char *payload; // NUL terminated
+    size_t payload_len; // not including the NUL terminator
+} IotcStoreRecord;
+
+// Opens the store file, or creates it if it does not exist. Messages from a previous run are retained
+// unless the file was created with a different capacity or if it fails validation.
+IotcOfflineStore *iotc_store_open(const char *path, size_t capacity);
+
+// Stores the message with payload made up from one or more buffers. If seq is not NULL, it receives the record's seq.
+// Records with a lower seq than the oldest record at any point were dropped to make room.
+int iotc_store_push(IotcOfflineStore *s, const char *topic, const IotConnectBuffer *bufs, size_t num_bufs,
+                    uint64_t *seq);
+
+// Gets the oldest message without removing it. Record pointers are valid until the next push or pop.
+bool iotc_store_peek(IotcOfflineStore *s, IotcStoreRecord *record);
+
+// Removes the oldest message, but only if it is still the message with the given seq.
+void iotc_store_pop(IotcOfflineStore *s, uint64_t seq);
+
+size_t iotc_store_count(IotcOfflineStore *s);
+
+void iotc_store_close(IotcOfflineStore *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_OFFLINE_STORE_H
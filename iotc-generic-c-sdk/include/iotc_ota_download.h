@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_OTA_DOWNLOAD_H
+#define IOTC_OTA_DOWNLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iotc_sha256.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Receives the image as it is downloaded, in order. offset is where data goes in the image. It starts over
+// from zero if the server does not support resuming. Returns false to abort the download.
+typedef bool (*IotcOtaSinkCallback)(void *context, uint64_t offset, const void *data, size_t len);
+
+// total is zero if the server did not report the size of the image
+typedef void (*IotcOtaProgressCallback)(void *context, uint64_t downloaded, uint64_t total);
+
+typedef struct {
+    const char *url; // from iotcl_c2d_get_ota_url()
+    // The image is written to this file, or passed to sink_cb if NULL
+    const char *file_path;
+    // If set, a partial file from a previous attempt is hashed and the download continues where it ended.
+    // The URL and the ETag or Last-Modified of the image are kept in file_path + ".resume", and the download
+    // starts over if they don't match. Otherwise, the file is overwritten.
+    bool resume_file;
+    IotcOtaSinkCallback sink_cb;
+    IotcOtaProgressCallback progress_cb; // optional
+    void *context; // passed to the callbacks
+    // SHA-256 of the image as 64 hex characters. The download fails if it doesn't match. Not checked if NULL.
+    const char *expected_sha256;
+    // Times to resume after the connection fails or stalls. Default 5.
+    unsigned int max_retries;
+    unsigned int retry_delay_ms; // Doubles after each retry. Default 1000.
+    unsigned int stall_timeout_s; // The transfer fails if no data arrives for this long. Default 30.
+} IotcOtaDownloadConfig;
+
+typedef struct {
+    uint64_t size;
+    unsigned char sha256[IOTC_SHA256_SIZE];
+} IotcOtaDownloadResult;
+
+void iotc_ota_download_init_config(IotcOtaDownloadConfig *config);
+
+// Streams the image through a fixed size buffer, so memory use does not depend on the image size.
+// Resumes with HTTP range requests after interruptions, and hashes the image on the way.
+// If the hash doesn't match expected_sha256, the file is deleted.
+int iotc_ota_download(const IotcOtaDownloadConfig *config, IotcOtaDownloadResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_OTA_DOWNLOAD_H
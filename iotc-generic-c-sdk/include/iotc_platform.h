@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_PLATFORM_H
+#define IOTC_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+typedef CRITICAL_SECTION IotcMutex;
+typedef CONDITION_VARIABLE IotcCond;
+typedef HANDLE IotcThread;
+typedef INIT_ONCE IotcOnce;
+#define IOTC_ONCE_INIT INIT_ONCE_STATIC_INIT
+#define IOTC_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t IotcMutex;
+typedef pthread_cond_t IotcCond;
+typedef pthread_t IotcThread;
+typedef pthread_once_t IotcOnce;
+#define IOTC_ONCE_INIT PTHREAD_ONCE_INIT
+#define IOTC_THREAD_LOCAL __thread
+#endif
+
+// Multiple readers or a single writer. Not recursive for writers.
+typedef struct IotcRwLock IotcRwLock;
+
+// A descriptor that becomes readable once signalled, for applications that wait with poll() or select().
+// Not available on Windows, where the descriptor is -1.
+typedef struct {
+    int read_fd;
+    int write_fd;
+} IotcWakeup;
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Milliseconds from an arbitrary point in the past. Not affected by wall clock changes.
+uint64_t iotc_platform_now_ms(void);
+
+// Same as iotc_platform_now_ms(), in microseconds
+uint64_t iotc_platform_now_us(void);
+
+void iotc_platform_sleep_ms(unsigned int ms);
+
+// Recursive mutex, so that user callbacks invoked while holding it can safely call back into the SDK.
+void iotc_platform_mutex_init(IotcMutex *m);
+void iotc_platform_mutex_lock(IotcMutex *m);
+void iotc_platform_mutex_unlock(IotcMutex *m);
+void iotc_platform_mutex_destroy(IotcMutex *m);
+
+// The mutex must be locked exactly once by the waiting thread. Spurious wakeups are possible.
+void iotc_platform_cond_init(IotcCond *c);
+void iotc_platform_cond_wait(IotcCond *c, IotcMutex *m);
+// Returns false if timeout_ms passed without a signal. Not affected by wall clock changes.
+bool iotc_platform_cond_timed_wait(IotcCond *c, IotcMutex *m, unsigned int timeout_ms);
+void iotc_platform_cond_signal(IotcCond *c);
+void iotc_platform_cond_broadcast(IotcCond *c);
+void iotc_platform_cond_destroy(IotcCond *c);
+
+// Returns zero on success
+int iotc_platform_thread_create(IotcThread *t, void (*fn)(void *arg), void *arg);
+void iotc_platform_thread_join(IotcThread *t);
+
+IotcRwLock *iotc_platform_rwlock_create(void);
+void iotc_platform_rwlock_read_lock(IotcRwLock *l);
+void iotc_platform_rwlock_write_lock(IotcRwLock *l);
+void iotc_platform_rwlock_unlock(IotcRwLock *l);
+void iotc_platform_rwlock_destroy(IotcRwLock *l);
+
+// The descriptor is -1 if it could not be created. Signalling and clearing it then does nothing.
+void iotc_platform_wakeup_init(IotcWakeup *w);
+int iotc_platform_wakeup_get_fd(IotcWakeup *w);
+void iotc_platform_wakeup_signal(IotcWakeup *w);
+void iotc_platform_wakeup_clear(IotcWakeup *w); // does not block
+void iotc_platform_wakeup_destroy(IotcWakeup *w);
+
+// Runs fn exactly once, even if called from multiple threads at the same time
+void iotc_platform_once(IotcOnce *once, void (*fn)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_PLATFORM_H
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_RATE_LIMITER_H
+#define IOTC_RATE_LIMITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Token buckets for messages and bytes. Not thread safe. Callers should provide their own locking.
+typedef struct {
+    IotConnectRateLimitConfig config; // with burst defaults applied
+    double message_tokens;
+    double byte_tokens; // can go negative after a message larger than the bucket
+    uint64_t last_refill_us;
+} IotcRateLimiter;
+
+void iotc_rate_init(IotcRateLimiter *r, const IotConnectRateLimitConfig *config);
+
+bool iotc_rate_is_enabled(const IotcRateLimiter *r);
+
+// Takes the tokens for a message of the given size if they are available.
+// A message larger than the byte bucket can be sent once the bucket is full.
+bool iotc_rate_take(IotcRateLimiter *r, size_t size);
+
+// Returns the microseconds until a message of the given size can be sent, or zero if it can be sent now
+uint64_t iotc_rate_delay_us(IotcRateLimiter *r, size_t size);
+
+// Returns how full the buckets are, from 0 (empty) to 1 (full). Always 1 for a bucket that is not limited.
+void iotc_rate_get_fill(IotcRateLimiter *r, double *message_fill, double *byte_fill);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_RATE_LIMITER_H
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_SAS_TOKEN_H
+#define IOTC_SAS_TOKEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Buffer size that fits any token from iotc_sas_token_get()
+#ifndef IOTC_SAS_TOKEN_MAX_LEN
+#define IOTC_SAS_TOKEN_MAX_LEN 1024
+#endif
+
+// Issues SAS tokens for a device. The key is decoded and the HMAC key schedule is computed once, so issuing
+// a token takes two SHA-256 compressions with the crypto backend from iotc_crypto.h. Thread safe.
+typedef struct IotcSasToken IotcSasToken;
+
+// lifetime_s is how long each token is valid. Returns NULL if the key is invalid or the token would not fit
+// in IOTC_SAS_TOKEN_MAX_LEN.
+IotcSasToken *iotc_sas_token_create(const char *host, const char *client_id, const char *b64key,
+                                    unsigned int lifetime_s);
+
+// Copies the current token into the buffer, renewing it first if less than a quarter of its lifetime remains.
+// Returns false if the buffer is too small or no token could be issued.
+bool iotc_sas_token_get(IotcSasToken *t, char *buffer, size_t size);
+
+// Renews the token if it is due, so that iotc_sas_token_get() does not have to. Call periodically.
+void iotc_sas_token_renew_due(IotcSasToken *t);
+
+void iotc_sas_token_destroy(IotcSasToken *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_SAS_TOKEN_H
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_SHA256_H
+#define IOTC_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+#define IOTC_SHA256_SIZE 32
+#define IOTC_SHA256_BLOCK_SIZE 64
+
+// Incremental SHA-256 (FIPS 180-4), for hashing data that arrives in pieces
+typedef struct {
+    uint32_t state[8];
+    uint64_t length; // bytes hashed so far
+    unsigned char block[IOTC_SHA256_BLOCK_SIZE]; // partial block
+    size_t block_len;
+} IotcSha256;
+
+void iotc_sha256_init(IotcSha256 *s);
+
+void iotc_sha256_update(IotcSha256 *s, const void *data, size_t len);
+
+void iotc_sha256_final(IotcSha256 *s, unsigned char digest[IOTC_SHA256_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_SHA256_H
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_TELEMETRY_BATCH_H
+#define IOTC_TELEMETRY_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "iotconnect.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Receives the complete multi-record telemetry JSON when the batch is flushed
+typedef void (*IotcBatchFlushCallback)(void *context, const char *json_str, size_t json_len);
+
+typedef struct {
+    IotConnectBatchConfig config;
+    IotcBatchFlushCallback flush_cb;
+    void *context; // passed to flush_cb
+    char *buffer; // envelope start, followed by comma separated records
+    size_t len;
+    size_t capacity;
+    size_t num_records; // records in the "d" array, of which a message can have many
+    uint64_t first_record_ms; // when the oldest record in the batch was added
+} IotcTelemetryBatch;
+
+void iotc_batch_init(IotcTelemetryBatch *b, const IotConnectBatchConfig *config, IotcBatchFlushCallback flush_cb,
+                     void *context);
+
+bool iotc_batch_is_enabled(IotcTelemetryBatch *b);
+
+// Adds records from a serialized single-message telemetry JSON to the batch.
+// Records without a "dt" timestamp get the timestamp (UTC), so that each keeps the time it was sent at.
+// The batch will be flushed before adding if the records would not fit into max_size,
+// after max_records records, or after adding if max_latency_ms is reached.
+int iotc_batch_add(IotcTelemetryBatch *b, const char *json_str, time_t timestamp);
+
+void iotc_batch_flush(IotcTelemetryBatch *b);
+
+// Flushes the batch if the oldest record has been waiting for more than max_latency_ms.
+void iotc_batch_poll(IotcTelemetryBatch *b);
+
+void iotc_batch_deinit(IotcTelemetryBatch *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TELEMETRY_BATCH_H
@@ -8,6 +8,7 @@
 #define IOTCONNECT_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 #include "iotcl.h"
 
@@ -46,6 +47,41 @@ typedef enum {
 
 typedef void (*IotConnectMqttStatusCallback)(IotConnectMqttStatus data);
 
+// Progress of connecting a client, in the order that the phases are reported. Phases can be skipped.
+// Discovery and identity are skipped with a fresh cached identity.
+// Paho waits for CONNACK as part of the TLS phase.
+typedef enum {
+    IOTC_CP_IDLE = 0,
+    IOTC_CP_DISCOVERY, // Discovery HTTP request
+    IOTC_CP_IDENTITY, // Identity HTTP request
+    IOTC_CP_TLS, // TCP connection and TLS handshake with the MQTT broker
+    IOTC_CP_CONNACK, // MQTT CONNECT sent, waiting for CONNACK
+    IOTC_CP_SUBACK, // Subscribing to the c2d topic, waiting for SUBACK
+    IOTC_CP_CONNECTED,
+    IOTC_CP_FAILED
+} IotConnectConnectPhase;
+
+typedef void (*IotConnectPhaseCallback)(IotConnectConnectPhase phase);
+
+// Identifies an outbound message in delivery reports. Zero is not a valid message ID.
+typedef uint32_t IotConnectMessageId;
+
+// If a send function returns success, exactly one delivery report will follow for the message ID it returned.
+typedef struct {
+    IotConnectMessageId id;
+    bool is_delivered; // Acknowledged by the broker (qos>0) or sent (qos=0). Otherwise, delivery failed.
+    uint64_t latency_us; // From when the message was queued for sending (or batched) until the outcome was known.
+    size_t size; // Payload size in bytes
+} IotConnectDeliveryReport;
+
+typedef void (*IotConnectDeliveryCallback)(const IotConnectDeliveryReport *report);
+
+// A part of a message payload, for sending data that is not in a single contiguous buffer.
+typedef struct {
+    const void *data;
+    size_t len;
+} IotConnectBuffer;
+
 typedef struct {
     IotConnectAuthType type;
     char* trust_store; // Path to a file containing the trust certificates for the remote MQTT host
@@ -58,32 +94,300 @@ typedef struct {
     } data;
 } IotConnectAuthInfo;
 
+// Telemetry batching limits. Batching is enabled if any of the limits is set.
+// When a limit is reached, all buffered telemetry is sent as a single multi-record message.
+typedef struct {
+    size_t max_records; // Send once this many records are buffered. A message can have more than one record.
+    size_t max_size; // Send before the batched message JSON would grow beyond this many bytes.
+    unsigned int max_latency_ms; // Send once the oldest buffered telemetry message is this old. Requires iotconnect_sdk_poll().
+} IotConnectBatchConfig;
+
+// Compression of batched telemetry messages, to save bandwidth on metered links.
+// Compressed messages are zlib (RFC 1950) streams with a preset dictionary, which the receiving side must be
+// set up to inflate. They can be told apart from JSON by the first byte of the zlib header (0x78),
+// and the header's dictionary ID is the Adler-32 checksum of the dictionary that was used.
+// Messages that would not get smaller are sent as JSON. Requires the SDK to be built with zlib.
+typedef struct {
+    bool enabled; // Disabled by default.
+    int level; // zlib compression level, 1-9. zlib default if zero.
+    // Sample telemetry with the field names and values that are common in this application's messages.
+    // The most common strings should be at the end. A generic telemetry envelope is used if NULL.
+    const void *dictionary;
+    size_t dictionary_len;
+    size_t min_size; // Messages smaller than this are sent uncompressed. Default 128 bytes.
+} IotConnectCompressionConfig;
+
+// Token bucket limits for outbound messages, to stay within the broker's per-connection quotas.
+// Messages that would exceed the rate wait in a queue and are sent as soon as the buckets allow it.
+// Requires iotconnect_sdk_poll(). Disabled if both rates are zero.
+typedef struct {
+    unsigned int messages_per_s; // Not limited if zero.
+    unsigned int bytes_per_s; // Payload bytes. Not limited if zero.
+    unsigned int burst_messages; // Bucket size. One second worth of messages_per_s if zero.
+    size_t burst_bytes; // Bucket size. One second worth of bytes_per_s if zero.
+    size_t max_queued_bytes; // For each lane. Sending blocks while the lane's queue is this full. Default 64 KiB.
+} IotConnectRateLimitConfig;
+
+// See iotconnect_client_get_rate_limit_status()
+typedef struct {
+    double message_fill; // How full the message bucket is, from 0 to 1. Always 1 if not limited.
+    double byte_fill; // Same for the byte bucket
+    size_t queued_messages; // Waiting for the buckets to refill
+    size_t queued_bytes;
+} IotConnectRateLimitStatus;
+
+typedef enum {
+    IOTC_LS_STRICT = 0, // Waiting control messages are always sent before telemetry.
+    IOTC_LS_WEIGHTED // One telemetry message is let through after every control_weight control messages.
+} IotConnectLaneScheduling;
+
+// Outbound messages go through two lanes. The control lane has command and OTA acknowledgements and other
+// messages from iotc-c-lib. The telemetry lane has telemetry and raw messages.
+// While connected, control messages do not wait behind the offline store backlog, and they are scheduled
+// ahead of telemetry in the rate limiter queue.
+typedef struct {
+    IotConnectLaneScheduling scheduling; // Strict by default.
+    unsigned int control_weight; // For weighted scheduling. Default 4.
+} IotConnectLaneConfig;
+
+// Adapts the telemetry batch limits, and optionally the QOS of the telemetry lane, to the link estimate.
+// The batch size grows while messages are acknowledged promptly, and is halved on failed deliveries or when
+// the round trip time grows well above its lowest value. The flush latency moves the other way.
+// Adaptive batching enables batching and starts from the batch config. Requires a QOS of 1.
+typedef struct {
+    bool enabled; // Disabled by default.
+    size_t min_batch_records; // Default 1
+    size_t max_batch_records; // Default 100
+    unsigned int min_batch_latency_ms; // Default 100
+    unsigned int max_batch_latency_ms; // Default 10000
+    // If set, telemetry and raw messages are sent with QOS 0 while the round trip time is above this value
+    // and the loss rate is below qos0_max_loss_pct. One in ten of them is still sent with QOS 1 to keep
+    // the estimate up to date. Control messages always use the configured QOS. Disabled if zero.
+    unsigned int qos0_min_rtt_ms;
+    unsigned int qos0_max_loss_pct; // Default 5
+} IotConnectAdaptiveConfig;
+
+// See iotconnect_client_get_link_estimate(). The estimate is made from the acknowledgements of QOS 1 messages.
+typedef struct {
+    double rtt_ms; // Smoothed time from publishing a message to its acknowledgement
+    double rtt_var_ms; // Mean deviation of rtt_ms
+    double loss; // Smoothed rate of failed deliveries, from 0 to 1
+    double throughput_bps; // Acknowledged payload bytes per second
+    size_t batch_records; // Current batch limits with adaptive batching
+    unsigned int batch_latency_ms;
+    int telemetry_qos; // QOS currently used for telemetry, or -1 if no telemetry was sent yet
+    unsigned int num_samples; // Acknowledgements that the estimate is based on
+} IotConnectLinkEstimate;
+
+// Automatic reconnect after the connection is lost unexpectedly. Requires iotconnect_sdk_poll().
+// The delay doubles after each failed attempt, and a random jitter is applied.
+typedef struct {
+    unsigned int min_delay_ms; // Delay before the first attempt. Default 1 second. Disabled if zero.
+    // The delay will not grow beyond this value. Default 2 minutes. Not capped if zero.
+    unsigned int max_delay_ms;
+} IotConnectReconnectConfig;
+
+// Command and OTA callbacks run on a pool of worker threads, so that a slow callback does not hold up
+// the MQTT connection. When the queue is full, inbound messages wait at the MQTT client until there is room.
+typedef struct {
+    int num_workers; // Worker threads for each client. Default 1. If zero, callbacks run on the MQTT receive thread.
+    size_t queue_size; // Maximum number of received messages waiting for a worker. Default 16.
+    // Maximum number of callbacks that can run at the same time for the same command name.
+    // OTA updates count as one command. Default 1. Not limited if zero.
+    int max_per_command;
+} IotConnectC2dDispatchConfig;
+
+// Multiplexes the connections of many clients. See iotc_engine.h.
+typedef struct IotcEngine IotcEngine;
+
 typedef struct {
     IotConnectConnectionType connection_type;
     char *env;    // Settings -> Key Vault -> CPID.
     char *cpid;   // Settings -> Key Vault -> Environment.
     char *duid;   // Name of the device.
     int qos; // QOS for outbound messages. Default 1.
+    // Maximum number of unacknowledged QOS 1 messages that can be in flight at the same time.
+    // If zero (default), each publish blocks until the message is acknowledged by the broker.
+    // If set, publishing returns as soon as the message is sent and status_cb is invoked
+    // with IOTC_CS_MQTT_DELIVERED or IOTC_CS_MQTT_SEND_FAILED for each message once the outcome is known.
+    int max_inflight;
+    IotConnectBatchConfig batch; // Telemetry batching with iotconnect_sdk_send_telemetry(). Disabled by default.
+    IotConnectCompressionConfig compression; // Applies to batched telemetry.
+    // Path to a file where outbound messages will be stored while the client is not connected.
+    // Stored messages are sent in their original order once the client connects again. Disabled if NULL.
+    char *offline_store_path;
+    size_t offline_store_size; // Maximum bytes of messages to keep. The oldest messages are dropped when full.
+    // Path to a file where the identity response will be kept, so that the client can connect after a restart
+    // without the discovery and identity requests. If connecting with a cached identity fails, the identity
+    // is requested again and the connect is retried once. Disabled if NULL.
+    char *identity_cache_path;
+    // Seconds until a cached identity is requested again. Default 24 hours.
+    // An expired identity is still used if the requests fail.
+    unsigned int identity_cache_ttl_s;
+    // Seconds to keep the resolved addresses of the discovery, identity and broker hosts. Hosts in use are
+    // resolved again in the background before they expire. If connecting to the cached addresses fails,
+    // the host is resolved again. The cache is shared by all clients and the first client sets the TTL.
+    // Paho resolves the broker itself, so the cache only applies to the broker when connecting with the engine.
+    // Zero disables the cache. Default 5 minutes.
+    unsigned int dns_cache_ttl_s;
+    // Seconds that each SAS token is valid with symmetric key authentication. Tokens are renewed by
+    // iotconnect_sdk_poll() once less than a quarter of this remains, and reused by connects until then.
+    // Default 60 seconds.
+    unsigned int sas_token_lifetime_s;
+    IotConnectReconnectConfig reconnect;
+    IotConnectRateLimitConfig rate_limit; // Disabled by default.
+    IotConnectLaneConfig lanes;
+    IotConnectAdaptiveConfig adaptive; // Disabled by default.
+    IotConnectC2dDispatchConfig c2d;
+    // If set, the client will connect with the engine instead of using its own paho client. See iotc_engine.h.
+    // Only the engine resumes TLS sessions when reconnecting. Paho does a full handshake on every connect.
+    IotcEngine *engine;
     IotConnectAuthInfo auth_info;
     IotclOtaCallback ota_cb; // callback for OTA events.
     IotclCommandCallback cmd_cb; // callback for command events.
     IotConnectMqttStatusCallback status_cb; // callback for connection status
+    // callback for connect progress, including reconnects. Invoked on the thread that is connecting,
+    // so it must not connect, disconnect or destroy the client.
+    IotConnectPhaseCallback phase_cb;
+    IotConnectDeliveryCallback delivery_cb; // callback for the outcome of each sent message
+    void *user_data; // Application data for this client. See iotconnect_client_get_user_data().
     bool verbose; // If true, we will output extra info and sent and received MQTT json data to standard out
 } IotConnectClientConfig;
 
 
+// Each client represents one device. A process can have multiple clients.
+typedef struct IotConnectClient IotConnectClient;
+
 void iotconnect_sdk_init_config(IotConnectClientConfig * c);
 
+// Call iotconnect_sdk_init_config first and configure the client before calling iotconnect_client_create().
+// Runs the discovery and identity requests for the device and returns the client in *client.
+// NOTE: the client does not need to keep references to the struct or any values inside it
+int iotconnect_client_create(IotConnectClientConfig *c, IotConnectClient **client);
+
+// Creates clients for many devices at once, as iotconnect_client_create() would for each config.
+// Discovery runs once for each environment and CPID, and the identity requests of the devices run
+// concurrently, with up to max_concurrent requests in flight at a time (8 if zero).
+// clients receives a client for each config, or NULL if that client could not be created.
+// Returns the error of the first client that failed, or zero if all were created.
+int iotconnect_client_create_many(IotConnectClientConfig *configs, size_t num_configs, IotConnectClient **clients,
+                                  unsigned int max_concurrent);
+
+int iotconnect_client_connect(IotConnectClient *client);
+
+// A create or connect that runs on a background thread, so that the application's main loop does not block
+// on the HTTP requests and the MQTT handshakes.
+typedef struct IotConnectConnectOp IotConnectConnectOp;
+
+// Same as iotconnect_client_create() followed by iotconnect_client_connect(), without blocking.
+// Call iotconnect_connect_op_step() until it returns IOTC_CP_CONNECTED or IOTC_CP_FAILED,
+// and then iotconnect_connect_op_finish() to get the client.
+int iotconnect_client_start(IotConnectClientConfig *c, IotConnectConnectOp **op);
+
+// Same as iotconnect_client_connect(), without blocking. Until the op is finished, the client can only be used
+// for sending and polling. Messages sent before the connection is up go to the offline store, if one is
+// configured, and otherwise fail with an error.
+int iotconnect_client_start_connect(IotConnectClient *client, IotConnectConnectOp **op);
+
+// Returns the current phase of the op. Never blocks.
+IotConnectConnectPhase iotconnect_connect_op_step(IotConnectConnectOp *op);
+
+// Returns a descriptor that becomes readable when the phase changes, so that the application can wait for it
+// with poll() or select() along with its own descriptors. iotconnect_connect_op_step() clears it.
+// Returns -1 on Windows.
+int iotconnect_connect_op_get_fd(IotConnectConnectOp *op);
+
+// Waits for the op to complete, if needed, and frees it. Returns the status that the blocking call would have
+// returned. If client is not NULL, it receives the client,
+// or NULL if creating or connecting a new client failed.
+// A new client is destroyed if it fails to connect, like iotconnect_sdk_connect() does.
+int iotconnect_connect_op_finish(IotConnectConnectOp *op, IotConnectClient **client);
+
+bool iotconnect_client_is_connected(IotConnectClient *client);
+
+// Reports the current state of the rate limiter. See IotConnectRateLimitConfig.
+void iotconnect_client_get_rate_limit_status(IotConnectClient *client, IotConnectRateLimitStatus *status);
+
+// Reports the current link estimate and the limits derived from it. See IotConnectAdaptiveConfig.
+void iotconnect_client_get_link_estimate(IotConnectClient *client, IotConnectLinkEstimate *estimate);
+
+// Returns true if the last connect or reconnect resumed the TLS session of a previous connection,
+// saving a round trip and the certificate exchange. Only the engine (see iotc_engine.h) caches TLS sessions.
+bool iotconnect_client_is_tls_resumed(IotConnectClient *client);
+
+void iotconnect_client_disconnect(IotConnectClient *client);
+
+// See iotconnect_sdk_send_telemetry(). If id is not NULL, it receives the message ID for delivery reports.
+// Batched telemetry messages get the ID of the batch that they will be sent in.
+int iotconnect_client_send_telemetry(IotConnectClient *client, IotclMessageHandle message, IotConnectMessageId *id);
+
+void iotconnect_client_flush_telemetry(IotConnectClient *client);
+
+// See iotconnect_sdk_send_raw(). If id is not NULL, it receives the message ID for delivery reports.
+int iotconnect_client_send_raw(IotConnectClient *client, const char *topic, const void *payload, size_t payload_len,
+                               IotConnectMessageId *id);
+
+int iotconnect_client_send_raw_iov(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs,
+                                   size_t num_bufs, IotConnectMessageId *id);
+
+// See iotconnect_sdk_poll(). Needs to be called for each client.
+void iotconnect_client_poll(IotConnectClient *client);
+
+void *iotconnect_client_get_user_data(IotConnectClient *client);
+
+// Returns the client whose status_cb, delivery_cb, cmd_cb or ota_cb is being invoked, or NULL if called from elsewhere.
+// Command and OTA acknowledgements sent with iotc-c-lib from these callbacks will be sent by this client.
+IotConnectClient *iotconnect_client_get_current(void);
+
+// Disconnects, if needed, and frees all resources of the client. Waits for running command and OTA callbacks
+// to return, so it must not be called from them.
+void iotconnect_client_destroy(IotConnectClient *client);
+
+// The iotconnect_sdk_* functions below operate on a single client created by iotconnect_sdk_init().
+
 // call iotconnect_sdk_init_config first and configure the SDK before calling iotconnect_sdk_init()
 // NOTE: the client does not need to keep references to the struct or any values inside it
 int iotconnect_sdk_init(IotConnectClientConfig * c);
 
 int iotconnect_sdk_connect(void);
 
+// Same as iotconnect_sdk_init() followed by iotconnect_sdk_connect(), without blocking.
+// See iotconnect_client_start().
+// Call iotconnect_sdk_step() from the main loop until it returns IOTC_CP_CONNECTED or IOTC_CP_FAILED.
+// The other iotconnect_sdk_* functions do nothing until then. iotconnect_sdk_deinit() waits for the connect.
+int iotconnect_sdk_start(IotConnectClientConfig *c);
+
+// Returns the current phase of iotconnect_sdk_start(). Never blocks. Once the connect completes, returns
+// IOTC_CP_CONNECTED while connected and IOTC_CP_IDLE otherwise.
+IotConnectConnectPhase iotconnect_sdk_step(void);
+
+// See iotconnect_connect_op_get_fd(). Returns -1 if no connect is in progress.
+int iotconnect_sdk_get_connect_fd(void);
+
 bool iotconnect_sdk_is_connected(void);
 
 void iotconnect_sdk_disconnect(void);
 
+// Sends the telemetry message, or adds it to the current batch if batching is configured.
+// Each batched message keeps its own timestamp. Messages without one get the time of this call.
+// The message can be destroyed after this call.
+int iotconnect_sdk_send_telemetry(IotclMessageHandle message);
+
+// Sends any batched telemetry immediately.
+void iotconnect_sdk_flush_telemetry(void);
+
+// Publishes a payload of given length as is. The payload does not need to be NUL terminated or be a JSON.
+// Like all other messages, it will go into the offline store, if configured, while not connected.
+int iotconnect_sdk_send_raw(const char *topic, const void *payload, size_t payload_len);
+
+// Same as iotconnect_sdk_send_raw() with the payload made up from multiple buffers
+int iotconnect_sdk_send_raw_iov(const char *topic, const IotConnectBuffer *bufs, size_t num_bufs);
+
+// Call periodically (every 100ms or so) from the application's main loop to handle time based work,
+// like sending telemetry batches that reached max_latency_ms, sending rate limited messages,
+// or reconnecting after a connection loss.
+void iotconnect_sdk_poll(void);
+
 void iotconnect_sdk_deinit(void);
 
 #ifdef __cplusplus
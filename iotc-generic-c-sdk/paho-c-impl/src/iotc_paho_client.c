@@ -5,38 +5,189 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "MQTTClient.h"
 #include "iotc_log.h"
 #include "iotc_algorithms.h"
+#include "iotc_platform.h"
 #include "iotconnect.h"
 #include "iotc_device_client.h"
 
 #define HOST_URL_FORMAT "ssl://%s:8883"
 
+#ifndef IOTC_GATHER_STACK_SIZE
+#define IOTC_GATHER_STACK_SIZE 512
+#endif
+
+// MQTTClient_connect() returns the CONNACK return code if the broker refuses the connection
+#define CONNACK_IDENTIFIER_REJECTED 2
+#define CONNACK_BAD_CREDENTIALS 4
+#define CONNACK_NOT_AUTHORIZED 5
+
 #ifndef MQTT_PUBLISH_TIMEOUT_MS
 #define MQTT_PUBLISH_TIMEOUT_MS     10000L
 #endif
 
-static bool is_initialized = false;
-static MQTTClient client = NULL;
-static IotConnectC2dCallback c2d_msg_cb = NULL; // callback for inbound messages
-static IotConnectMqttStatusCallback status_cb = NULL; // callback for connection status
+// A pipelined message awaiting acknowledgement
+typedef struct {
+    MQTTClient_deliveryToken token;
+    uint32_t message_id;
+    bool is_acked; // acknowledged before the publishing thread added it
+} PendingDelivery;
+
+struct IotcDeviceClient {
+    // Held for reading while the paho handle is in use and for writing while it is created or destroyed.
+    // Paho can not destroy the handle from its own callbacks, so a lost connection is only marked as such
+    // and the handle is destroyed by iotc_device_client_poll() or the next connect.
+    IotcRwLock *client_lock;
+    MQTTClient client;
+    int max_inflight; // zero means that each publish waits for acknowledgement
+    IotConnectC2dCallback c2d_msg_cb; // callback for inbound messages
+    IotcDeviceClientStatusCallback status_cb; // callback for connection status
+    IotcDeviceClientDeliveryCallback delivery_cb; // callback for message status
+    void *context; // for the callbacks
+
+    // Protects the connection flags and the pending deliveries, which are also accessed from the paho thread.
+    // Paho can report delivery before MQTTClient_publishMessage() returns the token, in which case
+    // the token is added as acknowledged and the publishing thread will report it.
+    // Paho forgets its own pending tokens once the connection is lost, so the list is kept here.
+    // Each publishing thread reserves a slot before publishing, so that adding its token can't fail
+    // once the message has been handed to paho. An acknowledged entry takes the slot of its publisher.
+    IotcMutex lock;
+    bool is_connected;
+    bool is_lost; // the connection was lost and the handle is waiting to be destroyed
+    PendingDelivery *pending;
+    size_t num_pending;
+    size_t num_reserved;
+    size_t pending_capacity;
+    unsigned int generation; // changes when pending deliveries are failed, as tokens are reused afterwards
+};
+
+// Destroys the paho handle. The client lock must be held for writing.
+// The callbacks are kept, as deliveries of the last connection may still be reported.
+static void paho_destroy(IotcDeviceClient *dc) {
+    if (dc->client) {
+        MQTTClient_destroy(&dc->client);
+        dc->client = NULL;
+    }
+    dc->max_inflight = 0;
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->is_connected = false;
+    dc->is_lost = false;
+    iotc_platform_mutex_unlock(&dc->lock);
+}
 
-static void paho_deinit(void) {
-    if (client) {
-        MQTTClient_destroy(&client);
-        client = NULL;
+static void paho_deinit(IotcDeviceClient *dc) {
+    iotc_platform_rwlock_write_lock(dc->client_lock);
+    paho_destroy(dc);
+    iotc_platform_rwlock_unlock(dc->client_lock);
+}
+
+// Removes the pending delivery with the token, if there is one. The lock must be held.
+static bool pending_take(IotcDeviceClient *dc, MQTTClient_deliveryToken token, uint32_t *message_id) {
+    for (size_t i = 0; i < dc->num_pending; i++) {
+        if (dc->pending[i].token == token) {
+            *message_id = dc->pending[i].message_id;
+            dc->pending[i] = dc->pending[--dc->num_pending];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Makes sure that the token of the next message can be added. The lock must be held.
+static bool pending_reserve(IotcDeviceClient *dc) {
+    if (dc->num_pending + dc->num_reserved >= dc->pending_capacity) {
+        size_t new_capacity = dc->pending_capacity ? dc->pending_capacity * 2 : (size_t) dc->max_inflight + 1;
+        PendingDelivery *ptr = realloc(dc->pending, new_capacity * sizeof(PendingDelivery));
+        if (!ptr) {
+            IOTC_ERROR("Out of memory while tracking message delivery!");
+            return false;
+        }
+        dc->pending = ptr;
+        dc->pending_capacity = new_capacity;
+    }
+    dc->num_reserved++;
+    return true;
+}
+
+// Uses a slot reserved by the publishing thread of the message. The lock must be held.
+static void pending_add(IotcDeviceClient *dc, MQTTClient_deliveryToken token, uint32_t message_id,
+                        bool is_acked) {
+    dc->pending[dc->num_pending].token = token;
+    dc->pending[dc->num_pending].message_id = message_id;
+    dc->pending[dc->num_pending].is_acked = is_acked;
+    dc->num_pending++;
+}
+
+static void report_delivery(IotcDeviceClient *dc, uint32_t message_id, bool is_delivered) {
+    if (dc->delivery_cb) {
+        dc->delivery_cb(dc->context, message_id, is_delivered);
+    }
+}
+
+// Only registered with paho when publishing in pipelined (max_inflight) mode.
+// Called from the paho background thread when a QOS 1 message is acknowledged.
+static void on_delivery_complete(void *context, MQTTClient_deliveryToken token) {
+    IotcDeviceClient *dc = (IotcDeviceClient *) context;
+    uint32_t message_id;
+
+    iotc_platform_mutex_lock(&dc->lock);
+    if (!pending_take(dc, token, &message_id)) {
+        pending_add(dc, token, 0, true); // the publishing thread will report it
+        iotc_platform_mutex_unlock(&dc->lock);
+        return;
+    }
+    iotc_platform_mutex_unlock(&dc->lock);
+    report_delivery(dc, message_id, true);
+}
+
+// Messages still pending at this point will never be acknowledged, so let the user know.
+// Acknowledged entries stay until their publishing thread takes them.
+static void report_pending_deliveries_failed(IotcDeviceClient *dc) {
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->generation++;
+    size_t i = 0;
+    while (i < dc->num_pending) {
+        if (dc->pending[i].is_acked) {
+            i++;
+            continue;
+        }
+        const uint32_t message_id = dc->pending[i].message_id;
+        dc->pending[i] = dc->pending[--dc->num_pending];
+        iotc_platform_mutex_unlock(&dc->lock);
+        report_delivery(dc, message_id, false);
+        iotc_platform_mutex_lock(&dc->lock);
+        i = 0; // the list may have changed while unlocked
+    }
+    iotc_platform_mutex_unlock(&dc->lock);
+}
+
+// If max_inflight messages are already awaiting acknowledgement, block until the oldest one completes.
+static int wait_for_inflight_slot(IotcDeviceClient *dc) {
+    MQTTClient_deliveryToken *tokens = NULL;
+    int rc = MQTTClient_getPendingDeliveryTokens(dc->client, &tokens);
+    if (rc != MQTTCLIENT_SUCCESS || !tokens) {
+        return rc; // nothing is pending if there's no token list
+    }
+    int num_pending = 0;
+    while (tokens[num_pending] != -1) {
+        num_pending++;
     }
-    c2d_msg_cb = NULL;
-    status_cb = NULL;
+    if (num_pending >= dc->max_inflight) {
+        // pending tokens are ordered from the oldest to the newest
+        rc = MQTTClient_waitForCompletion(dc->client, tokens[0], MQTT_PUBLISH_TIMEOUT_MS);
+    }
+    MQTTClient_free(tokens);
+    return rc;
 }
 
 static int on_c2d_message(void *context, char *topicName, int topicLen, MQTTClient_message *message) {
-    (void) context;
+    IotcDeviceClient *dc = (IotcDeviceClient *) context;
     (void) topicLen;
 
-    if (c2d_msg_cb) {
-        c2d_msg_cb(message->payload, (size_t) message->payloadlen);
+    if (dc->c2d_msg_cb && !dc->c2d_msg_cb(dc->context, message->payload, (size_t) message->payloadlen)) {
+        return 0; // paho keeps the message and will deliver it again
     }
     MQTTClient_freeMessage(&message);
     MQTTClient_free(topicName);
@@ -44,96 +195,231 @@ static int on_c2d_message(void *context, char *topicName, int topicLen, MQTTClie
 }
 
 static void on_connection_lost(void *context, char *cause) {
-    (void) context;
+    IotcDeviceClient *dc = (IotcDeviceClient *) context;
 
     IOTC_INFO("MQTT Connection lost. Cause: %s", cause);
 
-    if (status_cb) {
-        status_cb(IOTC_CS_MQTT_DISCONNECTED);
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->is_connected = false;
+    iotc_platform_mutex_unlock(&dc->lock);
+    report_pending_deliveries_failed(dc);
+    if (dc->status_cb) {
+        dc->status_cb(dc->context, IOTC_CS_MQTT_DISCONNECTED);
     }
-    paho_deinit();
+    // other threads may still be using the handle, so leave it to iotc_device_client_poll()
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->is_lost = true;
+    iotc_platform_mutex_unlock(&dc->lock);
 }
 
-int iotc_device_client_disconnect(void) {
-    int rc;
-    is_initialized = false;
-    if ((rc = MQTTClient_disconnect(client, 10000)) != MQTTCLIENT_SUCCESS) {
+IotcDeviceClient *iotc_device_client_create(void) {
+    IotcDeviceClient *dc = calloc(1, sizeof(IotcDeviceClient));
+    if (!dc) {
+        IOTC_ERROR("Out of memory while creating the device client!");
+        return NULL;
+    }
+    dc->client_lock = iotc_platform_rwlock_create();
+    if (!dc->client_lock) {
+        IOTC_ERROR("Unable to create the device client lock!");
+        free(dc);
+        return NULL;
+    }
+    iotc_platform_mutex_init(&dc->lock);
+    return dc;
+}
+
+int iotc_device_client_disconnect(IotcDeviceClient *dc) {
+    int rc = MQTTCLIENT_DISCONNECTED;
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->is_connected = false;
+    iotc_platform_mutex_unlock(&dc->lock);
+    // paho waits for its thread, whose callbacks may be sending, so only hold the lock for reading
+    iotc_platform_rwlock_read_lock(dc->client_lock);
+    if (dc->client && (rc = MQTTClient_disconnect(dc->client, 10000)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to disconnect, return code %d", rc);
     }
-    paho_deinit();
+    iotc_platform_rwlock_unlock(dc->client_lock);
+    report_pending_deliveries_failed(dc);
+    paho_deinit(dc);
     return rc;
 }
 
-bool iotc_device_client_is_connected(void) {
-    if (!is_initialized) {
-        return false;
+bool iotc_device_client_is_connected(IotcDeviceClient *dc) {
+    iotc_platform_mutex_lock(&dc->lock);
+    const bool is_connected = dc->is_connected;
+    iotc_platform_mutex_unlock(&dc->lock);
+    return is_connected;
+}
+
+void iotc_device_client_poll(IotcDeviceClient *dc) {
+    iotc_platform_mutex_lock(&dc->lock);
+    const bool is_lost = dc->is_lost;
+    iotc_platform_mutex_unlock(&dc->lock);
+    if (!is_lost) {
+        return; // avoid taking the write lock on every poll
     }
-    return MQTTClient_isConnected(client);
+    iotc_platform_rwlock_write_lock(dc->client_lock);
+    iotc_platform_mutex_lock(&dc->lock);
+    const bool is_still_lost = dc->is_lost; // unless a connect replaced the handle in the meantime
+    iotc_platform_mutex_unlock(&dc->lock);
+    if (is_still_lost) {
+        paho_destroy(dc);
+    }
+    iotc_platform_rwlock_unlock(dc->client_lock);
 }
 
-int iotc_device_client_send_message_qos(const char* topic, const char *message, int qos) {
-    MQTTClient_message pubmsg = MQTTClient_message_initializer;
+bool iotc_device_client_is_tls_resumed(IotcDeviceClient *dc) {
+    (void) dc;
+    return false; // paho creates a new TLS context for each connection and does not allow setting the session
+}
+
+// What the publishing thread reports once it releases the client lock
+typedef enum {
+    OUTCOME_NONE, // failed to send, or the paho thread will report it
+    OUTCOME_DELIVERED,
+    OUTCOME_FAILED, // sent, but it will never be acknowledged
+    OUTCOME_NOT_CONFIRMED // sent, but waiting for the acknowledgement failed
+} PublishOutcome;
+
+// Publishes while the client lock is held for reading
+static int publish_locked(IotcDeviceClient *dc, const char *topic, MQTTClient_message *pubmsg,
+                          uint32_t message_id, PublishOutcome *outcome) {
     MQTTClient_deliveryToken token;
     int rc;
-    pubmsg.payload = (void *) message;
-    pubmsg.payloadlen = (int) strlen(message);
-    pubmsg.qos = qos;
-    pubmsg.retained = 0;
-    if ((rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
+
+    iotc_platform_mutex_lock(&dc->lock);
+    const bool is_connected = dc->is_connected && dc->client;
+    const unsigned int generation = dc->generation;
+    iotc_platform_mutex_unlock(&dc->lock);
+    if (!is_connected) {
+        IOTC_ERROR("Unable to publish the message while disconnected");
+        return MQTTCLIENT_DISCONNECTED;
+    }
+
+    const bool is_pipelined = dc->max_inflight > 0 && pubmsg->qos > 0;
+    if (is_pipelined) {
+        if ((rc = wait_for_inflight_slot(dc)) != MQTTCLIENT_SUCCESS) {
+            IOTC_ERROR("Timed out while waiting for pending messages to be acknowledged, return code %d", rc);
+            return rc;
+        }
+        iotc_platform_mutex_lock(&dc->lock);
+        const bool is_reserved = pending_reserve(dc);
+        iotc_platform_mutex_unlock(&dc->lock);
+        if (!is_reserved) {
+            return MQTTCLIENT_FAILURE; // called function will print the error
+        }
+    }
+
+    if ((rc = MQTTClient_publishMessage(dc->client, topic, pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to publish message, return code %d", rc);
+        if (is_pipelined) {
+            iotc_platform_mutex_lock(&dc->lock);
+            dc->num_reserved--;
+            iotc_platform_mutex_unlock(&dc->lock);
+        }
         return rc;
     }
 
-    rc = MQTTClient_waitForCompletion(client, token, MQTT_PUBLISH_TIMEOUT_MS);
-    if (status_cb) {
-        if (0 == rc) {
-            status_cb(IOTC_CS_MQTT_DELIVERED);
+    if (is_pipelined) {
+        // on_delivery_complete will report QOS 1 delivery, unless it happened already
+        uint32_t ignored;
+        iotc_platform_mutex_lock(&dc->lock);
+        dc->num_reserved--;
+        if (pending_take(dc, token, &ignored)) {
+            *outcome = OUTCOME_DELIVERED;
+        } else if (generation != dc->generation) {
+            // the connection was lost while publishing, and the token may be reused by the next connection
+            *outcome = OUTCOME_FAILED;
         } else {
-            status_cb(IOTC_CS_MQTT_SEND_FAILED);
+            pending_add(dc, token, message_id, false);
         }
+        iotc_platform_mutex_unlock(&dc->lock);
+        return rc;
     }
+    if (dc->max_inflight > 0) {
+        // QOS 0 messages are done once they are sent
+        *outcome = OUTCOME_DELIVERED;
+        return rc;
+    }
+
+    rc = MQTTClient_waitForCompletion(dc->client, token, MQTT_PUBLISH_TIMEOUT_MS);
+    *outcome = 0 == rc ? OUTCOME_DELIVERED : OUTCOME_NOT_CONFIRMED;
     //IOTC_INFO("Message with delivery token %d delivered", token);
     return rc;
 }
 
-int iotc_device_client_send_message(const char* topic, const char *message) {
-    return iotc_device_client_send_message_qos(topic, message, 1);
-}
-
-int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
-    char * password = NULL;
+int iotc_device_client_send_message_len(IotcDeviceClient *dc, const char *topic, const void *payload,
+                                        size_t payload_len, int qos, uint32_t message_id) {
+    MQTTClient_message pubmsg = MQTTClient_message_initializer;
     int rc;
-
-    IotclMqttConfig *mc = iotcl_mqtt_get_config();
-    if (!mc) {
-        return IOTCL_ERR_CONFIG_MISSING; // caled function will print the error
+    if (payload_len > INT_MAX) {
+        IOTC_ERROR("Message of size %lu is too large to publish!", (unsigned long) payload_len);
+        return MQTTCLIENT_FAILURE;
     }
+    pubmsg.payload = (void *) payload;
+    pubmsg.payloadlen = (int) payload_len;
+    pubmsg.qos = qos;
+    pubmsg.retained = 0;
 
-
-    paho_deinit(); // reset all locals
-
-    char *paho_host_url = malloc((size_t) snprintf(NULL, 0, HOST_URL_FORMAT, mc->host) + 1);
-    if (NULL == paho_host_url) {
-        IOTC_ERROR("ERROR: Unable to allocate memory for paho host URL!");
-        return -1;
+    // outcomes are reported after the client lock is released, as the callbacks may send or disconnect
+    PublishOutcome outcome = OUTCOME_NONE;
+    iotc_platform_rwlock_read_lock(dc->client_lock);
+    rc = publish_locked(dc, topic, &pubmsg, message_id, &outcome);
+    iotc_platform_rwlock_unlock(dc->client_lock);
+    if (OUTCOME_DELIVERED == outcome || OUTCOME_FAILED == outcome) {
+        report_delivery(dc, message_id, OUTCOME_DELIVERED == outcome);
+    } else if (OUTCOME_NOT_CONFIRMED == outcome && dc->status_cb) {
+        // the caller gets the error, so only the status is reported
+        dc->status_cb(dc->context, IOTC_CS_MQTT_SEND_FAILED);
     }
-    sprintf(paho_host_url, HOST_URL_FORMAT, mc->host);
+    return rc;
+}
 
-    if ((rc = MQTTClient_create(&client, paho_host_url, mc->client_id,
-                                MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
-        IOTC_ERROR("Failed to create client, return code %d", rc);
-        free(paho_host_url);
-        return rc;
+int iotc_device_client_send_message_iov(IotcDeviceClient *dc, const char *topic, const IotConnectBuffer *bufs,
+                                        size_t num_bufs, int qos, uint32_t message_id) {
+    if (1 == num_bufs) {
+        return iotc_device_client_send_message_len(dc, topic, bufs[0].data, bufs[0].len, qos, message_id);
     }
-    free(paho_host_url);
 
-    if ((rc = MQTTClient_setCallbacks(client, NULL, on_connection_lost, on_c2d_message, NULL)) != MQTTCLIENT_SUCCESS) {
-        IOTC_ERROR("Failed to set callbacks, return code %d", rc);
-        paho_deinit();
-        return rc;
+    // paho needs a contiguous payload, so gather the buffers. Avoid the allocation for small payloads.
+    unsigned char small_payload[IOTC_GATHER_STACK_SIZE];
+    size_t payload_len = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        payload_len += bufs[i].len;
+    }
+    unsigned char *payload = payload_len <= sizeof(small_payload) ? small_payload : malloc(payload_len);
+    if (!payload) {
+        IOTC_ERROR("Out of memory while gathering the message payload!");
+        return MQTTCLIENT_FAILURE;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        memcpy(&payload[offset], bufs[i].data, bufs[i].len);
+        offset += bufs[i].len;
+    }
+    int rc = iotc_device_client_send_message_len(dc, topic, payload, payload_len, qos, message_id);
+    if (payload != small_payload) {
+        free(payload);
     }
+    return rc;
+}
+
+int iotc_device_client_send_message_qos(IotcDeviceClient *dc, const char* topic, const char *message, int qos) {
+    return iotc_device_client_send_message_len(dc, topic, message, strlen(message), qos, 0);
+}
+
+int iotc_device_client_send_message(IotcDeviceClient *dc, const char* topic, const char *message) {
+    return iotc_device_client_send_message_qos(dc, topic, message, 1);
+}
+
+// Connects and subscribes while the client lock is held for reading
+static int paho_connect(IotcDeviceClient *dc, IotConnectDeviceClientConfig *c) {
+    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+    MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
+    char token[IOTC_SAS_TOKEN_MAX_LEN];
+    char *password = NULL; // allocated if there is no token manager
+    IotConnectMqttIdentity *mc = c->mqtt;
+    int rc;
 
     ssl_opts.verify = 1;
     ssl_opts.trustStore = c->auth->trust_store;
@@ -141,7 +427,13 @@ int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
         ssl_opts.keyStore = c->auth->data.cert_info.device_cert;
         ssl_opts.privateKey = c->auth->data.cert_info.device_key;
     } else if (c->auth->type  == IOTC_AT_SYMMETRIC_KEY) {
-        if (c->auth->data.symmetric_key && strlen(c->auth->data.symmetric_key) > 0) {
+        if (c->sas_token) {
+            if (!iotc_sas_token_get(c->sas_token, token, sizeof(token))) {
+                IOTC_ERROR("Unable to get SAS token!");
+                return IOTCL_ERR_FAILED;
+            }
+            conn_opts.password = token;
+        } else if (c->auth->data.symmetric_key && strlen(c->auth->data.symmetric_key) > 0) {
             // for paho we need to pass the generated sas token
             char *sas_token = gen_sas_token(mc->host,
                                             mc->client_id,
@@ -161,32 +453,114 @@ int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
         }
     }
     conn_opts.ssl = &ssl_opts;
+    if (c->max_inflight > 0) {
+        // allow paho to have more than one outstanding publish
+        conn_opts.reliable = 0;
+        conn_opts.maxInflightMessages = c->max_inflight;
+    }
 
-    status_cb = c->status_cb;
-    conn_opts.username = iotcl_mqtt_get_config()->username;
-    conn_opts.password = password;
-    if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
+    conn_opts.username = mc->username;
+    if (password) {
+        conn_opts.password = password;
+    }
+    if (c->phase_cb) {
+        // paho does not report when the handshake is done and CONNECT is sent
+        c->phase_cb(c->context, IOTC_CP_TLS);
+    }
+    if ((rc = MQTTClient_connect(dc->client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to connect, return code %d", rc);
-        paho_deinit();
         free(password);
+        if (rc == CONNACK_IDENTIFIER_REJECTED || rc == CONNACK_BAD_CREDENTIALS || rc == CONNACK_NOT_AUTHORIZED) {
+            return IOTC_DEVICE_CLIENT_ERR_REJECTED;
+        }
         return rc;
     }
     free(password);
 
-    is_initialized = true; // even if we fail below, we are ok
+    iotc_platform_mutex_lock(&dc->lock);
+    dc->is_connected = true; // even if we fail below, we are ok
+    iotc_platform_mutex_unlock(&dc->lock);
 
-    if ((rc = MQTTClient_subscribe(client, mc->sub_c2d, 1)) != MQTTCLIENT_SUCCESS) {
+    if (c->phase_cb) {
+        c->phase_cb(c->context, IOTC_CP_SUBACK);
+    }
+    if ((rc = MQTTClient_subscribe(dc->client, mc->sub_c2d, 1)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to subscribe to c2d topic, return code %d", rc);
-        rc = IOTCL_ERR_FAILED;
     }
-    c2d_msg_cb = c->c2d_msg_cb;
+    dc->c2d_msg_cb = c->c2d_msg_cb;
+    return IOTCL_SUCCESS;
+}
+
+int iotc_device_client_connect(IotcDeviceClient *dc, IotConnectDeviceClientConfig *c) {
+    int rc;
+
+    IotConnectMqttIdentity *mc = c->mqtt;
+    if (!mc || !mc->host || !mc->client_id) {
+        IOTC_ERROR("Device MQTT configuration is missing!");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+
+    char *paho_host_url = malloc((size_t) snprintf(NULL, 0, HOST_URL_FORMAT, mc->host) + 1);
+    if (NULL == paho_host_url) {
+        IOTC_ERROR("ERROR: Unable to allocate memory for paho host URL!");
+        return -1;
+    }
+    sprintf(paho_host_url, HOST_URL_FORMAT, mc->host);
+
+    // other threads may be sending, so the handle is only replaced while holding the lock for writing
+    iotc_platform_rwlock_write_lock(dc->client_lock);
+    paho_destroy(dc); // reset all locals
+    dc->c2d_msg_cb = NULL;
+    if ((rc = MQTTClient_create(&dc->client, paho_host_url, mc->client_id,
+                                MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to create client, return code %d", rc);
+        dc->client = NULL;
+    } else if ((rc = MQTTClient_setCallbacks(dc->client, dc, on_connection_lost, on_c2d_message,
+                                             c->max_inflight > 0 ? on_delivery_complete : NULL))
+               != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to set callbacks, return code %d", rc);
+        paho_destroy(dc);
+    } else {
+        dc->status_cb = c->status_cb;
+        dc->delivery_cb = c->delivery_cb;
+        dc->context = c->context;
+        dc->max_inflight = c->max_inflight;
+    }
+    iotc_platform_rwlock_unlock(dc->client_lock);
+    free(paho_host_url);
+    if (rc != MQTTCLIENT_SUCCESS) {
+        return rc;
+    }
+
+    // paho may call back and the callbacks may send while connecting, so only hold the lock for reading
+    iotc_platform_rwlock_read_lock(dc->client_lock);
+    rc = paho_connect(dc, c);
+    iotc_platform_rwlock_unlock(dc->client_lock);
+    if (rc != IOTCL_SUCCESS) {
+        paho_deinit(dc);
+        return rc;
+    }
 
-    if (status_cb) {
-        status_cb(IOTC_CS_MQTT_CONNECTED);
+    if (dc->status_cb) {
+        dc->status_cb(dc->context, IOTC_CS_MQTT_CONNECTED);
     }
 
     return IOTCL_SUCCESS;
 }
 
+void iotc_device_client_destroy(IotcDeviceClient *dc) {
+    if (!dc) {
+        return;
+    }
+    if (iotc_device_client_is_connected(dc)) {
+        iotc_device_client_disconnect(dc);
+    }
+    paho_deinit(dc);
+    free(dc->pending);
+    iotc_platform_mutex_destroy(&dc->lock);
+    iotc_platform_rwlock_destroy(dc->client_lock);
+    free(dc);
+}
+
 
 
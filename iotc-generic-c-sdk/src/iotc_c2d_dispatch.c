@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_c2d_dispatch.h"
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    bool is_limited; // counts towards max_per_key
+    char *key; // NULL for the NULL key
+} DispatchMessage;
+
+// Number of running handlers for a key. Only keys with running handlers are kept.
+typedef struct {
+    char *key; // NULL for the NULL key
+    int num_running;
+} DispatchKey;
+
+struct IotcDispatcher {
+    IotcDispatchHandler handler;
+    IotcDispatchKeyFunc key_func;
+    void *context;
+    int max_per_key;
+    IotcThread *threads;
+    int num_threads;
+
+    IotcMutex lock; // protects the fields below
+    IotcCond queue_cond; // signalled when a message is queued, when a handler returns or when stopping
+    bool is_stopping;
+    bool is_full_reported;
+    DispatchMessage *queue; // ring buffer
+    size_t queue_size;
+    size_t head;
+    size_t count;
+    DispatchKey *keys;
+    size_t num_keys;
+    size_t keys_capacity;
+};
+
+// The dispatcher lock must be held
+static DispatchKey *dispatch_find_key(IotcDispatcher *d, const char *key) {
+    for (size_t i = 0; i < d->num_keys; i++) {
+        DispatchKey *k = &d->keys[i];
+        if (!key || !k->key) {
+            if (!key && !k->key) {
+                return k;
+            }
+        } else if (0 == strcmp(k->key, key)) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+// Returns the position of the oldest message that can run now, or count if there is none.
+// The dispatcher lock must be held.
+static size_t dispatch_find_runnable(IotcDispatcher *d) {
+    for (size_t i = 0; i < d->count; i++) {
+        const DispatchMessage *m = &d->queue[(d->head + i) % d->queue_size];
+        if (!m->is_limited || d->max_per_key <= 0) {
+            return i;
+        }
+        const DispatchKey *k = dispatch_find_key(d, m->key);
+        if (!k || k->num_running < d->max_per_key) {
+            return i;
+        }
+    }
+    return d->count;
+}
+
+// Removes the message at the position, keeping the order of the rest. The dispatcher lock must be held.
+static DispatchMessage dispatch_take(IotcDispatcher *d, size_t position) {
+    DispatchMessage m = d->queue[(d->head + position) % d->queue_size];
+    for (size_t i = position; i > 0; i--) {
+        d->queue[(d->head + i) % d->queue_size] = d->queue[(d->head + i - 1) % d->queue_size];
+    }
+    d->head = (d->head + 1) % d->queue_size;
+    d->count--;
+    return m;
+}
+
+// Counts a running handler for the key. Returns false if it could not be counted, in which case
+// the message runs without the limit rather than being dropped. The dispatcher lock must be held.
+static bool dispatch_count_key(IotcDispatcher *d, const char *key) {
+    DispatchKey *k = dispatch_find_key(d, key);
+    if (!k) {
+        if (d->num_keys == d->keys_capacity) {
+            size_t new_capacity = d->keys_capacity ? d->keys_capacity * 2 : 8;
+            DispatchKey *ptr = realloc(d->keys, new_capacity * sizeof(DispatchKey));
+            if (!ptr) {
+                return false;
+            }
+            d->keys = ptr;
+            d->keys_capacity = new_capacity;
+        }
+        k = &d->keys[d->num_keys];
+        k->key = NULL;
+        if (key) {
+            k->key = malloc(strlen(key) + 1);
+            if (!k->key) {
+                return false;
+            }
+            strcpy(k->key, key);
+        }
+        k->num_running = 0;
+        d->num_keys++;
+    }
+    k->num_running++;
+    return true;
+}
+
+// The dispatcher lock must be held
+static void dispatch_uncount_key(IotcDispatcher *d, const char *key) {
+    DispatchKey *k = dispatch_find_key(d, key);
+    if (k && 0 == --k->num_running) {
+        free(k->key);
+        *k = d->keys[--d->num_keys];
+    }
+}
+
+static void dispatch_worker(void *arg) {
+    IotcDispatcher *d = (IotcDispatcher *) arg;
+    iotc_platform_mutex_lock(&d->lock);
+    for (;;) {
+        size_t position = d->count;
+        while (!d->is_stopping && (position = dispatch_find_runnable(d)) == d->count) {
+            iotc_platform_cond_wait(&d->queue_cond, &d->lock);
+        }
+        if (d->is_stopping) {
+            break;
+        }
+        DispatchMessage m = dispatch_take(d, position);
+        const bool is_counted = m.is_limited && d->max_per_key > 0 && dispatch_count_key(d, m.key);
+        iotc_platform_mutex_unlock(&d->lock);
+
+        d->handler(d->context, m.data, m.len);
+        free(m.data);
+
+        iotc_platform_mutex_lock(&d->lock);
+        if (is_counted) {
+            dispatch_uncount_key(d, m.key);
+            iotc_platform_cond_broadcast(&d->queue_cond); // messages with this key may be able to run now
+        }
+        free(m.key);
+    }
+    iotc_platform_mutex_unlock(&d->lock);
+}
+
+IotcDispatcher *iotc_dispatch_create(const IotConnectC2dDispatchConfig *config, IotcDispatchHandler handler,
+                                     IotcDispatchKeyFunc key_func, void *context) {
+    if (config->num_workers <= 0 || 0 == config->queue_size) {
+        IOTC_ERROR("C2D dispatch requires at least one worker and a queue size!");
+        return NULL;
+    }
+    IotcDispatcher *d = calloc(1, sizeof(IotcDispatcher));
+    if (!d) {
+        IOTC_ERROR("Out of memory while creating the C2D dispatcher!");
+        return NULL;
+    }
+    d->handler = handler;
+    d->key_func = key_func;
+    d->context = context;
+    d->max_per_key = config->max_per_command;
+    d->queue_size = config->queue_size;
+    d->queue = malloc(d->queue_size * sizeof(DispatchMessage));
+    d->threads = malloc((size_t) config->num_workers * sizeof(IotcThread));
+    if (!d->queue || !d->threads) {
+        IOTC_ERROR("Out of memory while creating the C2D dispatcher!");
+        free(d->queue);
+        free(d->threads);
+        free(d);
+        return NULL;
+    }
+    iotc_platform_mutex_init(&d->lock);
+    iotc_platform_cond_init(&d->queue_cond);
+    for (int i = 0; i < config->num_workers; i++) {
+        if (iotc_platform_thread_create(&d->threads[i], dispatch_worker, d)) {
+            IOTC_ERROR("Unable to start C2D dispatch worker %d!", i);
+            iotc_dispatch_destroy(d);
+            return NULL;
+        }
+        d->num_threads++;
+    }
+    return d;
+}
+
+bool iotc_dispatch_push(IotcDispatcher *d, const unsigned char *message, size_t message_len) {
+    iotc_platform_mutex_lock(&d->lock);
+    if (d->count == d->queue_size) {
+        if (!d->is_full_reported) {
+            d->is_full_reported = true;
+            IOTC_WARN("C2D queue is full. Inbound messages will wait until a worker is available.");
+        }
+        iotc_platform_mutex_unlock(&d->lock);
+        return false;
+    }
+    iotc_platform_mutex_unlock(&d->lock);
+
+    // copy outside of the lock. Only the receive thread pushes, so the slot will still be there.
+    unsigned char *data = malloc(message_len + 1);
+    if (!data) {
+        IOTC_ERROR("Out of memory while queueing a C2D message!");
+        return false; // the caller will try again later
+    }
+    memcpy(data, message, message_len);
+    data[message_len] = 0;
+    char *key = NULL;
+    const bool is_limited = d->key_func && d->key_func(d->context, (const char *) data, message_len, &key);
+
+    iotc_platform_mutex_lock(&d->lock);
+    DispatchMessage *m = &d->queue[(d->head + d->count) % d->queue_size];
+    m->data = data;
+    m->len = message_len;
+    m->is_limited = is_limited;
+    m->key = key;
+    d->count++;
+    d->is_full_reported = false;
+    iotc_platform_cond_signal(&d->queue_cond);
+    iotc_platform_mutex_unlock(&d->lock);
+    return true;
+}
+
+void iotc_dispatch_destroy(IotcDispatcher *d) {
+    if (!d) {
+        return;
+    }
+    iotc_platform_mutex_lock(&d->lock);
+    d->is_stopping = true;
+    iotc_platform_cond_broadcast(&d->queue_cond);
+    iotc_platform_mutex_unlock(&d->lock);
+    for (int i = 0; i < d->num_threads; i++) {
+        iotc_platform_thread_join(&d->threads[i]);
+    }
+
+    if (d->count > 0) {
+        IOTC_WARN("Discarding %lu queued C2D messages", (unsigned long) d->count);
+    }
+    while (d->count > 0) {
+        free(d->queue[d->head].data);
+        free(d->queue[d->head].key);
+        d->head = (d->head + 1) % d->queue_size;
+        d->count--;
+    }
+    for (size_t i = 0; i < d->num_keys; i++) {
+        free(d->keys[i].key);
+    }
+    free(d->keys);
+    free(d->queue);
+    free(d->threads);
+    iotc_platform_cond_destroy(&d->queue_cond);
+    iotc_platform_mutex_destroy(&d->lock);
+    free(d);
+}
@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "iotc_platform.h"
+#include "iotc_codec.h"
+
+// The vector kernels need GCC or Clang for the target attribute and runtime CPU detection
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(IOTC_CODEC_SCALAR_ONLY)
+#define CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+// Input chars that the scalar URI encoder handles between attempts of the vector kernel
+#define URI_SCALAR_RUN 16
+
+static const char b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0xFF for characters outside the alphabet
+static const unsigned char b64_values[256] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+        0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+        0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static const unsigned char uri_unreserved[256] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+        // no unreserved characters above 0x7F
+};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// Vector kernels process whole blocks from the start of the input and return how many input characters they
+// consumed. The scalar code finishes the rest.
+typedef struct {
+    size_t (*b64_encode)(const unsigned char *input, size_t len, char *output);
+    // stops before a block with invalid characters, so that the scalar code reports it
+    size_t (*b64_decode)(const unsigned char *input, size_t len, unsigned char *output, size_t size);
+    // copies blocks that need no escaping
+    size_t (*uri_copy)(const unsigned char *input, size_t len, char *output);
+} CodecKernels;
+
+static size_t b64_encode_none(const unsigned char *input, size_t len, char *output) {
+    (void) input;
+    (void) len;
+    (void) output;
+    return 0;
+}
+
+static size_t b64_decode_none(const unsigned char *input, size_t len, unsigned char *output, size_t size) {
+    (void) input;
+    (void) len;
+    (void) output;
+    (void) size;
+    return 0;
+}
+
+static size_t uri_copy_none(const unsigned char *input, size_t len, char *output) {
+    (void) input;
+    (void) len;
+    (void) output;
+    return 0;
+}
+
+#if CODEC_X86
+
+// Base64 kernels after Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and Decoding using AVX2
+// Instructions" (2018), limited to SSSE3 and AVX2 so that they run on most x86 CPUs.
+
+__attribute__((target("ssse3")))
+static __m128i b64_enc_reshuffle_ssse3(__m128i in) {
+    // bytes 0..11 to 32-bit words of [b1 b0 b2 b1], then each word to four 6-bit indices
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static __m128i b64_enc_translate_ssse3(__m128i indices) {
+    // 0..25 map to 13, 26..51 to 0, 52..61 to 1..10, 62 to 11 and 63 to 12, which selects the offset
+    __m128i r = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A',
+                                          0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, r), indices);
+}
+
+// 12 input bytes to 16 characters. Reads 16 bytes.
+__attribute__((target("ssse3")))
+static size_t b64_encode_ssse3(const unsigned char *input, size_t len, char *output) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        const __m128i in = _mm_loadu_si128((const __m128i *) &input[i]);
+        const __m128i out = b64_enc_translate_ssse3(b64_enc_reshuffle_ssse3(in));
+        _mm_storeu_si128((__m128i *) &output[i / 3 * 4], out);
+    }
+    return i;
+}
+
+// Returns the 6-bit values, or sets *is_valid to false
+__attribute__((target("ssse3")))
+static __m128i b64_dec_lookup_ssse3(__m128i in, int *is_valid) {
+    const __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    const __m128i lo = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    // valid high nibbles for each low nibble, as bits
+    const __m128i valid_lut = _mm_setr_epi8((char) 0xa8, (char) 0xf8, (char) 0xf8, (char) 0xf8, (char) 0xf8,
+                                            (char) 0xf8, (char) 0xf8, (char) 0xf8, (char) 0xf8, (char) 0xf8,
+                                            (char) 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m128i bit_lut = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i valid = _mm_and_si128(_mm_shuffle_epi8(valid_lut, lo), _mm_shuffle_epi8(bit_lut, hi));
+    *is_valid = 0 == _mm_movemask_epi8(_mm_cmpeq_epi8(valid, _mm_setzero_si128()));
+    // offsets by high nibble. '/' shares it with '+', so it gets its own.
+    const __m128i shift_lut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i is_slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    const __m128i shift = _mm_or_si128(_mm_andnot_si128(is_slash, _mm_shuffle_epi8(shift_lut, hi)),
+                                       _mm_and_si128(is_slash, _mm_set1_epi8(16)));
+    return _mm_add_epi8(in, shift);
+}
+
+__attribute__((target("ssse3")))
+static __m128i b64_dec_pack_ssse3(__m128i values) {
+    // [a b c d] 6-bit values to 24 bits in each 32-bit word, then the three bytes of each word in order
+    const __m128i ab_cd = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i abcd = _mm_madd_epi16(ab_cd, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(abcd, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// 16 characters to 12 bytes. Writes 16 bytes.
+__attribute__((target("ssse3")))
+static size_t b64_decode_ssse3(const unsigned char *input, size_t len, unsigned char *output, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= len && i / 4 * 3 + 16 <= size; i += 16) {
+        int is_valid;
+        const __m128i values = b64_dec_lookup_ssse3(_mm_loadu_si128((const __m128i *) &input[i]), &is_valid);
+        if (!is_valid) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) &output[i / 4 * 3], b64_dec_pack_ssse3(values));
+    }
+    return i;
+}
+
+// All ones in each lane that holds an unreserved character
+__attribute__((target("ssse3")))
+static __m128i uri_unreserved_ssse3(__m128i in) {
+    const __m128i folded = _mm_or_si128(in, _mm_set1_epi8(0x20)); // letters to lower case
+    const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    const __m128i other = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('-')),
+                                                    _mm_cmpeq_epi8(in, _mm_set1_epi8('_'))),
+                                       _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('.')),
+                                                    _mm_cmpeq_epi8(in, _mm_set1_epi8('~'))));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), other);
+}
+
+__attribute__((target("ssse3")))
+static size_t uri_copy_ssse3(const unsigned char *input, size_t len, char *output) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i *) &input[i]);
+        if (0xFFFF != _mm_movemask_epi8(uri_unreserved_ssse3(in))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) &output[i], in);
+    }
+    return i;
+}
+
+// The AVX2 kernels do the same in both 128-bit lanes, with the same constants
+
+__attribute__((target("avx2")))
+static __m256i codec_broadcast(__m128i v) {
+    return _mm256_broadcastsi128_si256(v);
+}
+
+// 24 input bytes to 32 characters. Reads 28 bytes.
+__attribute__((target("avx2")))
+static size_t b64_encode_avx2(const unsigned char *input, size_t len, char *output) {
+    const __m256i shuffle = codec_broadcast(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i offsets = codec_broadcast(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                          '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+    size_t i = 0;
+    for (; i + 28 <= len; i += 24) {
+        const __m128i lo = _mm_loadu_si128((const __m128i *) &input[i]);
+        const __m128i hi = _mm_loadu_si128((const __m128i *) &input[i + 12]);
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+        __m256i r = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i out = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, r), indices);
+        _mm256_storeu_si256((__m256i *) &output[i / 3 * 4], out);
+    }
+    return i;
+}
+
+// 32 characters to 24 bytes. Writes 32 bytes.
+__attribute__((target("avx2")))
+static size_t b64_decode_avx2(const unsigned char *input, size_t len, unsigned char *output, size_t size) {
+    const __m256i valid_lut = codec_broadcast(_mm_setr_epi8((char) 0xa8, (char) 0xf8, (char) 0xf8, (char) 0xf8,
+                                                            (char) 0xf8, (char) 0xf8, (char) 0xf8, (char) 0xf8,
+                                                            (char) 0xf8, (char) 0xf8, (char) 0xf0, 0x54,
+                                                            0x50, 0x50, 0x50, 0x54));
+    const __m256i bit_lut = codec_broadcast(_mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+                                                          0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i shift_lut = codec_broadcast(_mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+                                                            0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i pack = codec_broadcast(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    size_t i = 0;
+    for (; i + 32 <= len && i / 4 * 3 + 32 <= size; i += 32) {
+        const __m256i in = _mm256_loadu_si256((const __m256i *) &input[i]);
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+        const __m256i lo = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+        const __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(valid_lut, lo),
+                                               _mm256_shuffle_epi8(bit_lut, hi));
+        if (0 != _mm256_movemask_epi8(_mm256_cmpeq_epi8(valid, _mm256_setzero_si256()))) {
+            break;
+        }
+        const __m256i is_slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        const __m256i shift = _mm256_blendv_epi8(_mm256_shuffle_epi8(shift_lut, hi), _mm256_set1_epi8(16),
+                                                 is_slash);
+        const __m256i values = _mm256_add_epi8(in, shift);
+        const __m256i ab_cd = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i abcd = _mm256_madd_epi16(ab_cd, _mm256_set1_epi32(0x00011000));
+        __m256i out = _mm256_shuffle_epi8(abcd, pack);
+        // 12 bytes at the start of each lane to 24 contiguous bytes
+        out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *) &output[i / 4 * 3], out);
+    }
+    return i;
+}
+
+#endif // CODEC_X86
+
+static CodecKernels codec_kernels = {b64_encode_none, b64_decode_none, uri_copy_none};
+static IotcOnce codec_once = IOTC_ONCE_INIT;
+
+static void codec_select_kernels(void) {
+#if CODEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        codec_kernels.b64_encode = b64_encode_avx2;
+        codec_kernels.b64_decode = b64_decode_avx2;
+        // URIs here are short, so 16 character blocks find more runs to copy than 32 character ones would
+        codec_kernels.uri_copy = uri_copy_ssse3;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        codec_kernels.b64_encode = b64_encode_ssse3;
+        codec_kernels.b64_decode = b64_decode_ssse3;
+        codec_kernels.uri_copy = uri_copy_ssse3;
+    }
+#endif
+}
+
+size_t iotc_base64_encode(const unsigned char *input, size_t len, char *output) {
+    iotc_platform_once(&codec_once, codec_select_kernels);
+    size_t i = codec_kernels.b64_encode(input, len, output);
+    char *out = &output[i / 3 * 4];
+    for (; i + 3 <= len; i += 3) {
+        const uint32_t v = (uint32_t) input[i] << 16 | (uint32_t) input[i + 1] << 8 | input[i + 2];
+        out[0] = b64_alphabet[v >> 18];
+        out[1] = b64_alphabet[(v >> 12) & 0x3F];
+        out[2] = b64_alphabet[(v >> 6) & 0x3F];
+        out[3] = b64_alphabet[v & 0x3F];
+        out += 4;
+    }
+    if (i < len) {
+        const int has_second = i + 1 < len;
+        const uint32_t v = (uint32_t) input[i] << 16 | (has_second ? (uint32_t) input[i + 1] << 8 : 0);
+        out[0] = b64_alphabet[v >> 18];
+        out[1] = b64_alphabet[(v >> 12) & 0x3F];
+        out[2] = has_second ? b64_alphabet[(v >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    *out = 0;
+    return (size_t) (out - output);
+}
+
+long iotc_base64_decode(const char *input, size_t len, unsigned char *output, size_t size) {
+    const unsigned char *in = (const unsigned char *) input;
+    size_t padding = 0;
+    while (len > 0 && padding < 2 && '=' == input[len - 1]) {
+        len--;
+        padding++;
+    }
+    const size_t tail = len % 4;
+    if (1 == tail || (padding > 0 && 0 != (len + padding) % 4)) {
+        return -1;
+    }
+    const size_t out_len = len / 4 * 3 + (tail > 0 ? tail - 1 : 0);
+    if (out_len > size) {
+        return -1;
+    }
+    iotc_platform_once(&codec_once, codec_select_kernels);
+    const size_t full = len - tail;
+    size_t i = codec_kernels.b64_decode(in, full, output, size);
+    unsigned char *out = &output[i / 4 * 3];
+    unsigned char invalid = 0; // any value with the top bit set
+    for (; i < full; i += 4) {
+        const unsigned char a = b64_values[in[i]];
+        const unsigned char b = b64_values[in[i + 1]];
+        const unsigned char c = b64_values[in[i + 2]];
+        const unsigned char d = b64_values[in[i + 3]];
+        invalid |= a | b | c | d;
+        const uint32_t v = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6 | d;
+        out[0] = (unsigned char) (v >> 16);
+        out[1] = (unsigned char) (v >> 8);
+        out[2] = (unsigned char) v;
+        out += 3;
+    }
+    if (tail > 0) {
+        const unsigned char a = b64_values[in[i]];
+        const unsigned char b = b64_values[in[i + 1]];
+        const unsigned char c = 3 == tail ? b64_values[in[i + 2]] : 0;
+        invalid |= a | b | c;
+        const uint32_t v = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6;
+        out[0] = (unsigned char) (v >> 16);
+        if (3 == tail) {
+            out[1] = (unsigned char) (v >> 8);
+        }
+    }
+    return (invalid & 0x80) ? -1 : (long) out_len;
+}
+
+size_t iotc_uri_encode(const char *input, size_t len, char *output) {
+    const unsigned char *in = (const unsigned char *) input;
+    iotc_platform_once(&codec_once, codec_select_kernels);
+    size_t i = 0;
+    char *out = output;
+    while (i < len) {
+        const size_t copied = codec_kernels.uri_copy(&in[i], len - i, out);
+        i += copied;
+        out += copied;
+        const size_t end = len - i > URI_SCALAR_RUN ? i + URI_SCALAR_RUN : len;
+        for (; i < end; i++) {
+            const unsigned char c = in[i];
+            if (uri_unreserved[c]) {
+                *out++ = (char) c;
+            } else {
+                out[0] = '%';
+                out[1] = hex_digits[c >> 4];
+                out[2] = hex_digits[c & 0x0F];
+                out += 3;
+            }
+        }
+    }
+    *out = 0;
+    return (size_t) (out - output);
+}
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_compression.h"
+
+#ifdef IOTC_HAVE_ZLIB
+#include <zlib.h>
+
+// Used if no dictionary is configured. Only covers the telemetry envelope, as the field names are
+// application specific. Deflate matches strings near the end of the dictionary with shorter codes.
+static const char default_dictionary[] =
+    "{\"d\":[{\"dt\":\"2024-01-01T00:00:00.000Z\",\"d\":{\"version\":\"1.0\",\"status\":\"ok\",\"value\":0.0}}]}"
+    "},{\"dt\":\"2025-01-01T00:00:00.000Z\",\"d\":{\"";
+
+struct IotcCompressor {
+    z_stream stream;
+    const unsigned char *dictionary;
+    size_t dictionary_len;
+    size_t min_size;
+    unsigned char *out;
+    size_t out_capacity;
+};
+
+IotcCompressor *iotc_compressor_create(const IotConnectCompressionConfig *config) {
+    IotcCompressor *c = calloc(1, sizeof(IotcCompressor));
+    if (!c) {
+        IOTC_ERROR("Out of memory while creating the compressor!");
+        return NULL;
+    }
+    if (config->dictionary && config->dictionary_len > 0) {
+        c->dictionary = (const unsigned char *) config->dictionary;
+        c->dictionary_len = config->dictionary_len;
+    } else {
+        c->dictionary = (const unsigned char *) default_dictionary;
+        c->dictionary_len = sizeof(default_dictionary) - 1;
+    }
+    c->min_size = config->min_size;
+    const int level = config->level > 0 ? config->level : Z_DEFAULT_COMPRESSION;
+    // 15 window bits for the zlib format, which carries the dictionary ID. Memory level 8 is the zlib default.
+    if (Z_OK != deflateInit2(&c->stream, level, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY)) {
+        IOTC_ERROR("Unable to initialize compression!");
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+bool iotc_compressor_compress(IotcCompressor *c, const void *payload, size_t payload_len,
+                              const unsigned char **out, size_t *out_len) {
+    if (payload_len < c->min_size || payload_len > UINT32_MAX) {
+        return false;
+    }
+    // the dictionary has to be set again after each reset
+    if (Z_OK != deflateReset(&c->stream)
+        || Z_OK != deflateSetDictionary(&c->stream, c->dictionary, (uInt) c->dictionary_len)) {
+        IOTC_ERROR("Unable to reset compression!");
+        return false;
+    }
+    const size_t bound = deflateBound(&c->stream, (uLong) payload_len);
+    if (bound > c->out_capacity) {
+        unsigned char *ptr = realloc(c->out, bound);
+        if (!ptr) {
+            IOTC_ERROR("Out of memory while compressing!");
+            return false;
+        }
+        c->out = ptr;
+        c->out_capacity = bound;
+    }
+    c->stream.next_in = (Bytef *) payload;
+    c->stream.avail_in = (uInt) payload_len;
+    c->stream.next_out = c->out;
+    c->stream.avail_out = (uInt) c->out_capacity;
+    if (Z_STREAM_END != deflate(&c->stream, Z_FINISH)) {
+        IOTC_ERROR("Compression failed!");
+        return false;
+    }
+    if (c->stream.total_out >= payload_len) {
+        return false; // not worth it
+    }
+    *out = c->out;
+    *out_len = c->stream.total_out;
+    return true;
+}
+
+void iotc_compressor_destroy(IotcCompressor *c) {
+    if (!c) {
+        return;
+    }
+    deflateEnd(&c->stream);
+    free(c->out);
+    free(c);
+}
+
+#else // no zlib
+
+IotcCompressor *iotc_compressor_create(const IotConnectCompressionConfig *config) {
+    (void) config;
+    IOTC_ERROR("Compression requires the SDK to be built with zlib!");
+    return NULL;
+}
+
+bool iotc_compressor_compress(IotcCompressor *c, const void *payload, size_t payload_len,
+                              const unsigned char **out, size_t *out_len) {
+    (void) c;
+    (void) payload;
+    (void) payload_len;
+    (void) out;
+    (void) out_len;
+    return false;
+}
+
+void iotc_compressor_destroy(IotcCompressor *c) {
+    (void) c;
+}
+
+#endif
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_crypto.h"
+
+// Each backend provides the same static functions, so the HMAC code below calls them directly:
+//   crypto_sha256()    hashes a long key down to its digest
+//   crypto_load_pads() starts the inner and outer hashes with the padded key blocks
+//   crypto_compute()   finishes a copy of both for a message
+//   crypto_wipe()      releases and clears the states
+
+#if defined(IOTC_CRYPTO_OPENSSL)
+#include <openssl/evp.h>
+
+static bool crypto_sha256(const void *data, size_t len, unsigned char digest[IOTC_SHA256_SIZE]) {
+    return 1 == EVP_Digest(data, len, digest, NULL, EVP_sha256(), NULL);
+}
+
+static bool crypto_load_pads(IotcHmacSha256 *h, const unsigned char *ipad, const unsigned char *opad) {
+    h->inner = EVP_MD_CTX_new();
+    h->outer = EVP_MD_CTX_new();
+    h->work = EVP_MD_CTX_new();
+    return h->inner && h->outer && h->work
+           && 1 == EVP_DigestInit_ex(h->inner, EVP_sha256(), NULL)
+           && 1 == EVP_DigestUpdate(h->inner, ipad, IOTC_SHA256_BLOCK_SIZE)
+           && 1 == EVP_DigestInit_ex(h->outer, EVP_sha256(), NULL)
+           && 1 == EVP_DigestUpdate(h->outer, opad, IOTC_SHA256_BLOCK_SIZE);
+}
+
+static bool crypto_compute(IotcHmacSha256 *h, const void *data, size_t len,
+                           unsigned char mac[IOTC_SHA256_SIZE]) {
+    unsigned char inner_digest[IOTC_SHA256_SIZE];
+    return 1 == EVP_MD_CTX_copy_ex(h->work, h->inner)
+           && 1 == EVP_DigestUpdate(h->work, data, len)
+           && 1 == EVP_DigestFinal_ex(h->work, inner_digest, NULL)
+           && 1 == EVP_MD_CTX_copy_ex(h->work, h->outer)
+           && 1 == EVP_DigestUpdate(h->work, inner_digest, sizeof(inner_digest))
+           && 1 == EVP_DigestFinal_ex(h->work, mac, NULL);
+}
+
+static void crypto_wipe(IotcHmacSha256 *h) {
+    // EVP_MD_CTX_free() cleanses the digest state
+    EVP_MD_CTX_free(h->inner);
+    EVP_MD_CTX_free(h->outer);
+    EVP_MD_CTX_free(h->work);
+    memset(h, 0, sizeof(IotcHmacSha256));
+}
+
+#elif defined(IOTC_CRYPTO_MBEDTLS)
+#include "mbedtls/version.h"
+
+// mbedTLS 3 dropped the _ret suffix once the functions without it started returning errors
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define crypto_mbedtls_sha256 mbedtls_sha256
+#define crypto_mbedtls_starts mbedtls_sha256_starts
+#define crypto_mbedtls_update mbedtls_sha256_update
+#define crypto_mbedtls_finish mbedtls_sha256_finish
+#else
+#define crypto_mbedtls_sha256 mbedtls_sha256_ret
+#define crypto_mbedtls_starts mbedtls_sha256_starts_ret
+#define crypto_mbedtls_update mbedtls_sha256_update_ret
+#define crypto_mbedtls_finish mbedtls_sha256_finish_ret
+#endif
+
+static bool crypto_sha256(const void *data, size_t len, unsigned char digest[IOTC_SHA256_SIZE]) {
+    return 0 == crypto_mbedtls_sha256(data, len, digest, 0); // 0 selects SHA-256, not SHA-224
+}
+
+static bool crypto_load_pads(IotcHmacSha256 *h, const unsigned char *ipad, const unsigned char *opad) {
+    mbedtls_sha256_init(&h->inner);
+    mbedtls_sha256_init(&h->outer);
+    return 0 == crypto_mbedtls_starts(&h->inner, 0)
+           && 0 == crypto_mbedtls_update(&h->inner, ipad, IOTC_SHA256_BLOCK_SIZE)
+           && 0 == crypto_mbedtls_starts(&h->outer, 0)
+           && 0 == crypto_mbedtls_update(&h->outer, opad, IOTC_SHA256_BLOCK_SIZE);
+}
+
+static bool crypto_compute(IotcHmacSha256 *h, const void *data, size_t len,
+                           unsigned char mac[IOTC_SHA256_SIZE]) {
+    unsigned char inner_digest[IOTC_SHA256_SIZE];
+    mbedtls_sha256_context work;
+    mbedtls_sha256_init(&work);
+    mbedtls_sha256_clone(&work, &h->inner);
+    bool ok = 0 == crypto_mbedtls_update(&work, data, len)
+              && 0 == crypto_mbedtls_finish(&work, inner_digest);
+    mbedtls_sha256_clone(&work, &h->outer);
+    ok = ok && 0 == crypto_mbedtls_update(&work, inner_digest, sizeof(inner_digest))
+         && 0 == crypto_mbedtls_finish(&work, mac);
+    mbedtls_sha256_free(&work);
+    return ok;
+}
+
+static void crypto_wipe(IotcHmacSha256 *h) {
+    // mbedtls_sha256_free() zeroizes the context
+    mbedtls_sha256_free(&h->inner);
+    mbedtls_sha256_free(&h->outer);
+}
+
+#else // built-in
+
+static bool crypto_sha256(const void *data, size_t len, unsigned char digest[IOTC_SHA256_SIZE]) {
+    IotcSha256 s;
+    iotc_sha256_init(&s);
+    iotc_sha256_update(&s, data, len);
+    iotc_sha256_final(&s, digest);
+    return true;
+}
+
+static bool crypto_load_pads(IotcHmacSha256 *h, const unsigned char *ipad, const unsigned char *opad) {
+    iotc_sha256_init(&h->inner);
+    iotc_sha256_update(&h->inner, ipad, IOTC_SHA256_BLOCK_SIZE);
+    iotc_sha256_init(&h->outer);
+    iotc_sha256_update(&h->outer, opad, IOTC_SHA256_BLOCK_SIZE);
+    return true;
+}
+
+static bool crypto_compute(IotcHmacSha256 *h, const void *data, size_t len,
+                           unsigned char mac[IOTC_SHA256_SIZE]) {
+    unsigned char inner_digest[IOTC_SHA256_SIZE];
+    IotcSha256 s = h->inner;
+    iotc_sha256_update(&s, data, len);
+    iotc_sha256_final(&s, inner_digest);
+    s = h->outer;
+    iotc_sha256_update(&s, inner_digest, sizeof(inner_digest));
+    iotc_sha256_final(&s, mac);
+    return true;
+}
+
+static void crypto_wipe(IotcHmacSha256 *h) {
+    memset(h, 0, sizeof(IotcHmacSha256));
+}
+
+#endif
+
+// RFC 2104: H((K ^ opad) || H((K ^ ipad) || message)), with K hashed first if longer than a block
+bool iotc_hmac_sha256_init(IotcHmacSha256 *h, const void *key, size_t key_len) {
+    unsigned char hashed_key[IOTC_SHA256_SIZE];
+    unsigned char ipad[IOTC_SHA256_BLOCK_SIZE];
+    unsigned char opad[IOTC_SHA256_BLOCK_SIZE];
+    memset(h, 0, sizeof(IotcHmacSha256));
+    if (key_len > IOTC_SHA256_BLOCK_SIZE) {
+        if (!crypto_sha256(key, key_len, hashed_key)) {
+            IOTC_ERROR("HMAC: Failed to hash the key!");
+            return false;
+        }
+        key = hashed_key;
+        key_len = IOTC_SHA256_SIZE;
+    }
+    const unsigned char *k = key;
+    for (size_t i = 0; i < IOTC_SHA256_BLOCK_SIZE; i++) {
+        const unsigned char b = i < key_len ? k[i] : 0;
+        ipad[i] = (unsigned char) (b ^ 0x36);
+        opad[i] = (unsigned char) (b ^ 0x5C);
+    }
+    const bool ok = crypto_load_pads(h, ipad, opad);
+    memset(hashed_key, 0, sizeof(hashed_key));
+    memset(ipad, 0, sizeof(ipad));
+    memset(opad, 0, sizeof(opad));
+    if (!ok) {
+        IOTC_ERROR("HMAC: Failed to initialize the %s backend!", IOTC_CRYPTO_BACKEND_NAME);
+        crypto_wipe(h);
+    }
+    return ok;
+}
+
+bool iotc_hmac_sha256_compute(IotcHmacSha256 *h, const void *data, size_t len,
+                              unsigned char mac[IOTC_SHA256_SIZE]) {
+    if (!crypto_compute(h, data, len, mac)) {
+        IOTC_ERROR("HMAC: The %s backend failed!", IOTC_CRYPTO_BACKEND_NAME);
+        return false;
+    }
+    return true;
+}
+
+void iotc_hmac_sha256_deinit(IotcHmacSha256 *h) {
+    crypto_wipe(h);
+}
+
+bool iotc_hmac_sha256(const void *key, size_t key_len, const void *data, size_t len,
+                      unsigned char mac[IOTC_SHA256_SIZE]) {
+    IotcHmacSha256 h;
+    if (!iotc_hmac_sha256_init(&h, key, key_len)) {
+        return false;
+    }
+    const bool ok = iotc_hmac_sha256_compute(&h, data, len, mac);
+    iotc_hmac_sha256_deinit(&h);
+    return ok;
+}
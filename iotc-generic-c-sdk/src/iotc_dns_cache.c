@@ -0,0 +1,340 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L // for getaddrinfo with -std=c99
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <netdb.h>
+#endif
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_dns_cache.h"
+
+#ifndef IOTC_DNS_MAX_ENTRIES
+#define IOTC_DNS_MAX_ENTRIES 16
+#endif
+
+#define DNS_MAX_HOST_LEN 255
+#define DNS_MAX_PORT_LEN 15
+#define DNS_RETRY_MS 5000 // after failing to refresh a host
+
+typedef struct {
+    char host[DNS_MAX_HOST_LEN + 1];
+    char port[DNS_MAX_PORT_LEN + 1];
+    IotcDnsAddress addresses[IOTC_DNS_MAX_ADDRESSES];
+    size_t num_addresses; // zero until the host is resolved
+    uint64_t expires_ms;
+    uint64_t refresh_ms; // when the refresh thread will resolve the host again
+    uint64_t last_used_ms;
+} DnsEntry;
+
+static IotcOnce dns_once = IOTC_ONCE_INIT;
+// Serializes acquire and release, so that the refresh thread can be joined without holding dns_lock
+static IotcMutex dns_lifecycle_lock;
+static IotcMutex dns_lock;
+static IotcCond dns_cond; // wakes the refresh thread when a host is added or the cache stops
+// protected by dns_lock
+static int dns_refcount = 0;
+static bool dns_is_stopping = false;
+static uint64_t dns_ttl_ms = 0;
+static DnsEntry dns_entries[IOTC_DNS_MAX_ENTRIES];
+static size_t dns_num_entries = 0;
+// protected by dns_lifecycle_lock
+static IotcThread dns_thread;
+
+static void dns_create_locks(void) {
+    iotc_platform_mutex_init(&dns_lifecycle_lock);
+    iotc_platform_mutex_init(&dns_lock);
+    iotc_platform_cond_init(&dns_cond);
+}
+
+static size_t dns_resolve(const char *host, const char *port, IotcDnsAddress *addresses, size_t max) {
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result)) {
+        return 0;
+    }
+    size_t n = 0;
+    for (struct addrinfo *a = result; a && n < max; a = a->ai_next) {
+        if (a->ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+        }
+        memset(&addresses[n], 0, sizeof(IotcDnsAddress));
+        memcpy(&addresses[n].addr, a->ai_addr, a->ai_addrlen);
+        addresses[n].len = (socklen_t) a->ai_addrlen;
+        n++;
+    }
+    freeaddrinfo(result);
+    return n;
+}
+
+static DnsEntry *dns_find(const char *host, const char *port) {
+    for (size_t i = 0; i < dns_num_entries; i++) {
+        if (0 == strcmp(dns_entries[i].host, host) && 0 == strcmp(dns_entries[i].port, port)) {
+            return &dns_entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void dns_remove(size_t index) {
+    dns_entries[index] = dns_entries[--dns_num_entries];
+}
+
+// Replaces the least recently used entry if the cache is full
+static DnsEntry *dns_add(const char *host, const char *port, uint64_t now) {
+    if (dns_num_entries == IOTC_DNS_MAX_ENTRIES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < dns_num_entries; i++) {
+            if (dns_entries[i].last_used_ms < dns_entries[oldest].last_used_ms) {
+                oldest = i;
+            }
+        }
+        dns_remove(oldest);
+    }
+    DnsEntry *e = &dns_entries[dns_num_entries++];
+    memset(e, 0, sizeof(DnsEntry));
+    strcpy(e->host, host);
+    strcpy(e->port, port);
+    e->last_used_ms = now;
+    iotc_platform_cond_signal(&dns_cond); // due for refresh earlier than anything the thread waits for
+    return e;
+}
+
+// Refreshes ahead of expiry by a fifth of the TTL
+static void dns_store(DnsEntry *e, const IotcDnsAddress *addresses, size_t n, uint64_t now) {
+    memcpy(e->addresses, addresses, n * sizeof(IotcDnsAddress));
+    e->num_addresses = n;
+    e->expires_ms = now + dns_ttl_ms;
+    e->refresh_ms = e->expires_ms - dns_ttl_ms / 5;
+}
+
+static size_t dns_copy(const DnsEntry *e, IotcDnsAddress *addresses, size_t max) {
+    const size_t n = e->num_addresses < max ? e->num_addresses : max;
+    memcpy(addresses, e->addresses, n * sizeof(IotcDnsAddress));
+    return n;
+}
+
+// Resolves the hosts that are due, one at a time, without holding the lock while resolving
+static void dns_refresh_due(void) {
+    for (;;) {
+        char host[DNS_MAX_HOST_LEN + 1];
+        char port[DNS_MAX_PORT_LEN + 1];
+        bool is_found = false;
+        const uint64_t now = iotc_platform_now_ms();
+        iotc_platform_mutex_lock(&dns_lock);
+        size_t i = 0;
+        while (i < dns_num_entries && !is_found) {
+            DnsEntry *e = &dns_entries[i];
+            if (e->refresh_ms > now) {
+                i++;
+            } else if (e->last_used_ms + dns_ttl_ms < now) {
+                // not used for a TTL, so it is no longer kept fresh, and dropped once it expires
+                if (now >= e->expires_ms) {
+                    dns_remove(i);
+                } else {
+                    e->refresh_ms = e->expires_ms;
+                    i++;
+                }
+            } else {
+                strcpy(host, e->host);
+                strcpy(port, e->port);
+                e->refresh_ms = now + DNS_RETRY_MS; // until it is resolved
+                is_found = true;
+            }
+        }
+        iotc_platform_mutex_unlock(&dns_lock);
+        if (!is_found) {
+            return;
+        }
+
+        IotcDnsAddress addresses[IOTC_DNS_MAX_ADDRESSES];
+        const size_t n = dns_resolve(host, port, addresses, IOTC_DNS_MAX_ADDRESSES);
+        if (0 == n) {
+            IOTC_WARN("DNS: Unable to resolve %s. Retrying in %d ms.", host, DNS_RETRY_MS);
+            continue;
+        }
+        iotc_platform_mutex_lock(&dns_lock);
+        DnsEntry *e = dns_find(host, port); // unless it was replaced in the meantime
+        if (e) {
+            dns_store(e, addresses, n, iotc_platform_now_ms());
+        }
+        iotc_platform_mutex_unlock(&dns_lock);
+    }
+}
+
+// Returns when the refresh thread has to run next, or UINT64_MAX if there are no hosts. The lock must be held.
+static uint64_t dns_next_refresh_ms(void) {
+    uint64_t next_ms = UINT64_MAX;
+    for (size_t i = 0; i < dns_num_entries; i++) {
+        if (dns_entries[i].refresh_ms < next_ms) {
+            next_ms = dns_entries[i].refresh_ms;
+        }
+    }
+    return next_ms;
+}
+
+// Sleeps until the next host is due, so that an idle device is not woken up in between
+static void dns_refresh_thread(void *arg) {
+    (void) arg;
+    iotc_platform_mutex_lock(&dns_lock);
+    while (!dns_is_stopping) {
+        const uint64_t next_ms = dns_next_refresh_ms();
+        const uint64_t now = iotc_platform_now_ms();
+        if (next_ms > now) {
+            if (UINT64_MAX == next_ms) {
+                iotc_platform_cond_wait(&dns_cond, &dns_lock);
+            } else {
+                const uint64_t wait_ms = next_ms - now;
+                iotc_platform_cond_timed_wait(&dns_cond, &dns_lock,
+                                              wait_ms < UINT_MAX ? (unsigned int) wait_ms : UINT_MAX);
+            }
+            continue; // woken up early, or stopping
+        }
+        iotc_platform_mutex_unlock(&dns_lock);
+        dns_refresh_due();
+        iotc_platform_mutex_lock(&dns_lock);
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+}
+
+int iotc_dns_cache_acquire(unsigned int ttl_s) {
+    int status = IOTCL_SUCCESS;
+    iotc_platform_once(&dns_once, dns_create_locks);
+    iotc_platform_mutex_lock(&dns_lifecycle_lock);
+    iotc_platform_mutex_lock(&dns_lock);
+    const bool is_running = dns_refcount > 0;
+    if (is_running) {
+        dns_refcount++;
+    } else {
+        dns_ttl_ms = (uint64_t) (ttl_s > 0 ? ttl_s : 1) * 1000;
+        dns_is_stopping = false;
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+    if (!is_running) {
+        if (iotc_platform_thread_create(&dns_thread, dns_refresh_thread, NULL)) {
+            IOTC_ERROR("Unable to start the DNS refresh thread!");
+            status = IOTCL_ERR_FAILED;
+        } else {
+            iotc_platform_mutex_lock(&dns_lock);
+            dns_refcount = 1;
+            iotc_platform_mutex_unlock(&dns_lock);
+        }
+    }
+    iotc_platform_mutex_unlock(&dns_lifecycle_lock);
+    return status;
+}
+
+void iotc_dns_cache_release(void) {
+    iotc_platform_mutex_lock(&dns_lifecycle_lock);
+    iotc_platform_mutex_lock(&dns_lock);
+    const bool is_last = dns_refcount > 0 && 0 == --dns_refcount;
+    if (is_last) {
+        dns_is_stopping = true;
+        iotc_platform_cond_signal(&dns_cond);
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+    if (is_last) {
+        iotc_platform_thread_join(&dns_thread);
+        iotc_platform_mutex_lock(&dns_lock);
+        dns_num_entries = 0;
+        iotc_platform_mutex_unlock(&dns_lock);
+    }
+    iotc_platform_mutex_unlock(&dns_lifecycle_lock);
+}
+
+static bool dns_is_valid_key(const char *host, const char *port) {
+    return host && port && strlen(host) <= DNS_MAX_HOST_LEN && strlen(port) <= DNS_MAX_PORT_LEN;
+}
+
+size_t iotc_dns_cache_lookup(const char *host, const char *port, IotcDnsAddress *addresses, size_t max) {
+    size_t n = 0;
+    if (!dns_is_valid_key(host, port) || 0 == max) {
+        return 0;
+    }
+    iotc_platform_once(&dns_once, dns_create_locks);
+    const uint64_t now = iotc_platform_now_ms();
+    iotc_platform_mutex_lock(&dns_lock);
+    if (0 == dns_refcount) {
+        iotc_platform_mutex_unlock(&dns_lock);
+        return 0;
+    }
+    DnsEntry *e = dns_find(host, port);
+    if (e) {
+        e->last_used_ms = now;
+        if (e->num_addresses > 0 && now < e->expires_ms) {
+            n = dns_copy(e, addresses, max);
+            iotc_platform_mutex_unlock(&dns_lock);
+            return n;
+        }
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+
+    IotcDnsAddress resolved[IOTC_DNS_MAX_ADDRESSES];
+    const size_t num_resolved = dns_resolve(host, port, resolved, IOTC_DNS_MAX_ADDRESSES);
+    iotc_platform_mutex_lock(&dns_lock);
+    if (dns_refcount > 0) {
+        e = dns_find(host, port);
+        if (num_resolved > 0) {
+            if (!e) {
+                e = dns_add(host, port, now);
+            }
+            dns_store(e, resolved, num_resolved, iotc_platform_now_ms());
+        } else if (e && e->num_addresses > 0) {
+            IOTC_WARN("DNS: Unable to resolve %s. Using expired addresses.", host);
+            n = dns_copy(e, addresses, max);
+        }
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+    if (num_resolved > 0) {
+        n = num_resolved < max ? num_resolved : max;
+        memcpy(addresses, resolved, n * sizeof(IotcDnsAddress));
+    }
+    return n;
+}
+
+void iotc_dns_cache_prefetch(const char *host, const char *port) {
+    if (!dns_is_valid_key(host, port)) {
+        return;
+    }
+    iotc_platform_once(&dns_once, dns_create_locks);
+    iotc_platform_mutex_lock(&dns_lock);
+    if (dns_refcount > 0 && !dns_find(host, port)) {
+        dns_add(host, port, iotc_platform_now_ms()); // due for refresh right away
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+}
+
+void iotc_dns_cache_invalidate(const char *host, const char *port) {
+    if (!dns_is_valid_key(host, port)) {
+        return;
+    }
+    iotc_platform_once(&dns_once, dns_create_locks);
+    iotc_platform_mutex_lock(&dns_lock);
+    DnsEntry *e = dns_find(host, port);
+    if (e) {
+        dns_remove((size_t) (e - dns_entries));
+    }
+    iotc_platform_mutex_unlock(&dns_lock);
+}
+
+bool iotc_dns_address_to_string(const IotcDnsAddress *address, char *buffer, size_t size) {
+    char host[IOTC_DNS_ADDRESS_STRLEN];
+    if (getnameinfo((const struct sockaddr *) &address->addr, address->len, host, sizeof(host), NULL, 0,
+                    NI_NUMERICHOST)) {
+        return false;
+    }
+    const int len = snprintf(buffer, size, AF_INET6 == address->addr.ss_family ? "[%s]" : "%s", host);
+    return len > 0 && (size_t) len < size;
+}
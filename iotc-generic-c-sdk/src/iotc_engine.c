@@ -0,0 +1,1466 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for SOCK_NONBLOCK and friends with -std=c99
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_engine.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include "iotcl_util.h"
+#include "iotc_algorithms.h"
+#include "iotc_dns_cache.h"
+#include "iotc_platform.h"
+
+#define MQTT_PORT "8883"
+
+#ifndef IOTC_ENGINE_KEEPALIVE_S
+#define IOTC_ENGINE_KEEPALIVE_S 60
+#endif
+
+#ifndef IOTC_ENGINE_CONNECT_TIMEOUT_MS
+#define IOTC_ENGINE_CONNECT_TIMEOUT_MS 30000
+#endif
+
+#ifndef MQTT_PUBLISH_TIMEOUT_MS
+#define MQTT_PUBLISH_TIMEOUT_MS     10000L
+#endif
+
+// Used if max_inflight is not configured
+#ifndef IOTC_ENGINE_DEFAULT_INFLIGHT
+#define IOTC_ENGINE_DEFAULT_INFLIGHT 10
+#endif
+
+// Inbound packets larger than this will drop the connection
+#ifndef IOTC_ENGINE_MAX_PACKET_SIZE
+#define IOTC_ENGINE_MAX_PACKET_SIZE (256 * 1024)
+#endif
+
+// Publishing fails if this many bytes are already waiting to be written to the socket
+#ifndef IOTC_ENGINE_MAX_OUTPUT_SIZE
+#define IOTC_ENGINE_MAX_OUTPUT_SIZE (1024 * 1024)
+#endif
+
+#define ENGINE_MAX_EVENTS 64
+#define ENGINE_TICK_MS 1000
+#define ENGINE_INPUT_RETRY_MS 50 // how often to offer inbound messages again after they were declined
+
+// MQTT 3.1.1 control packet types (with fixed header flags, where those are fixed)
+#define MQTT_CONNECT        0x10
+#define MQTT_CONNACK        0x20
+#define MQTT_PUBLISH        0x30
+#define MQTT_PUBACK         0x40
+#define MQTT_SUBSCRIBE      0x82
+#define MQTT_SUBACK         0x90
+#define MQTT_PINGREQ        0xC0
+#define MQTT_PINGRESP       0xD0
+#define MQTT_DISCONNECT     0xE0
+
+// CONNACK return codes that mean that the device identity is likely stale
+#define CONNACK_IDENTIFIER_REJECTED 2
+#define CONNACK_BAD_CREDENTIALS 4
+#define CONNACK_NOT_AUTHORIZED 5
+
+typedef enum {
+    SESSION_IDLE = 0,
+    SESSION_TCP_CONNECTING,
+    SESSION_TLS_HANDSHAKE,
+    SESSION_MQTT_CONNECTING, // CONNECT sent, waiting for CONNACK
+    SESSION_SUBSCRIBING, // SUBSCRIBE sent, waiting for SUBACK
+    SESSION_CONNECTED,
+} SessionState;
+
+typedef struct EngineWorker EngineWorker;
+
+// A QOS 1 message awaiting acknowledgement
+typedef struct {
+    uint16_t packet_id;
+    uint32_t message_id;
+} EngineInflight;
+
+// Devices with the same trust store share the TLS context
+typedef struct EngineTlsContext {
+    char *trust_store;
+    SSL_CTX *ctx;
+    struct EngineTlsContext *next;
+} EngineTlsContext;
+
+struct EngineWorker {
+    IotcEngine *engine;
+    pthread_t thread;
+    int epoll_fd;
+    int event_fd; // wakes the worker when there's work in the pending list
+    pthread_mutex_t lock; // protects the fields below
+    bool is_stopping;
+    int num_input_blocked; // worker only. Sessions with a declined inbound message.
+    IotcEngineSession *sessions; // all sessions on this worker
+    IotcEngineSession *pending; // sessions with output, or a close or destroy request
+};
+
+struct IotcEngine {
+    EngineWorker *workers;
+    int num_workers;
+    unsigned int next_worker;
+    pthread_mutex_t lock; // protects next_worker and tls_contexts
+    EngineTlsContext *tls_contexts;
+};
+
+struct IotcEngineSession {
+    IotcEngine *engine;
+    EngineWorker *worker;
+
+    // Protects the fields below. The worker only holds it briefly and never while invoking callbacks.
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled on state changes and acknowledgements
+    SessionState state;
+    int connect_result;
+    bool is_connect_waiting; // a connect call has not returned yet, so it reports a lost connection itself
+    bool is_tls_resumed; // whether the last connect resumed a cached TLS session
+    bool is_address_cached; // whether the last connect used an address from the DNS cache
+    bool is_tcp_failed; // whether the last connect failed before the TCP connection was established
+    uint64_t connect_started_ms;
+    bool is_disconnect_requested;
+    bool is_destroy_requested;
+    int close_status; // if set, the worker will drop the connection with this status
+    bool is_unlinked; // the worker will no longer touch this session
+    unsigned char *out; // encoded packets waiting to be written to the socket
+    size_t out_len;
+    size_t out_capacity;
+    int max_inflight;
+    int num_inflight;
+    EngineInflight *inflight; // max_inflight entries
+    uint16_t next_packet_id;
+    uint64_t last_sent_ms;
+    uint64_t ping_sent_ms; // zero if there's no ping outstanding
+
+    // Set at connect time, before the worker gets the session
+    IotConnectC2dCallback c2d_msg_cb;
+    IotcDeviceClientStatusCallback status_cb;
+    IotcDeviceClientDeliveryCallback delivery_cb;
+    void *context;
+    char *sub_c2d;
+
+    // Only used by the worker, or by connect while the session is idle
+    int fd;
+    SSL *ssl;
+    SSL_SESSION *tls_session; // cached for resumption on the next connect to the same host
+    char *tls_session_host;
+    bool is_polling_input;
+    bool is_polling_output;
+    bool is_input_blocked; // the c2d callback declined the first message in the input
+    unsigned char *in;
+    size_t in_len;
+    size_t in_capacity;
+
+    // Protected by the worker lock
+    bool is_pending;
+    IotcEngineSession *next;
+    IotcEngineSession *prev;
+    IotcEngineSession *next_pending;
+};
+
+static int engine_reserve(unsigned char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return IOTCL_SUCCESS;
+    }
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    unsigned char *ptr = realloc(*buffer, new_capacity);
+    if (!ptr) {
+        IOTC_ERROR("Out of memory in the engine!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    *buffer = ptr;
+    *capacity = new_capacity;
+    return IOTCL_SUCCESS;
+}
+
+// Appends the fixed header of a packet to the session output. The caller must hold the session lock,
+// reserve the space for the rest of the packet and append it.
+static unsigned char *out_begin_packet(IotcEngineSession *s, unsigned char type, size_t remaining_len) {
+    unsigned char header[5];
+    size_t header_len = 0;
+    const size_t packet_len = remaining_len;
+    header[header_len++] = type;
+    do {
+        unsigned char b = (unsigned char) (remaining_len % 128);
+        remaining_len /= 128;
+        header[header_len++] = remaining_len > 0 ? (unsigned char) (b | 0x80) : b;
+    } while (remaining_len > 0 && header_len < sizeof(header));
+
+    // reserve the whole packet, so the caller can simply append
+    if (engine_reserve(&s->out, &s->out_capacity, s->out_len + header_len + packet_len)) {
+        return NULL;
+    }
+    memcpy(&s->out[s->out_len], header, header_len);
+    s->out_len += header_len;
+    return &s->out[s->out_len];
+}
+
+static void out_append(IotcEngineSession *s, const void *data, size_t len) {
+    memcpy(&s->out[s->out_len], data, len);
+    s->out_len += len;
+}
+
+static void out_append_u16(IotcEngineSession *s, uint16_t value) {
+    unsigned char b[2] = {(unsigned char) (value >> 8), (unsigned char) value};
+    out_append(s, b, sizeof(b));
+}
+
+static void out_append_string(IotcEngineSession *s, const char *str, size_t len) {
+    out_append_u16(s, (uint16_t) len);
+    out_append(s, str, len);
+}
+
+static uint16_t session_next_packet_id(IotcEngineSession *s) {
+    if (0 == ++s->next_packet_id) {
+        s->next_packet_id = 1; // zero is not a valid packet identifier
+    }
+    return s->next_packet_id;
+}
+
+static int out_connect(IotcEngineSession *s, const char *client_id, const char *username, const char *password) {
+    const size_t client_id_len = strlen(client_id);
+    const size_t username_len = username ? strlen(username) : 0;
+    const size_t password_len = password ? strlen(password) : 0;
+    if (client_id_len > UINT16_MAX || username_len > UINT16_MAX || password_len > UINT16_MAX) {
+        IOTC_ERROR("MQTT connection values are too long!");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    unsigned char flags = 0x02; // clean session
+    size_t len = 10 + 2 + client_id_len;
+    if (username) {
+        flags |= 0x80;
+        len += 2 + username_len;
+        if (password) {
+            flags |= 0x40; // MQTT 3.1.1 does not allow a password without a username
+            len += 2 + password_len;
+        }
+    }
+    if (!out_begin_packet(s, MQTT_CONNECT, len)) {
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    out_append_string(s, "MQTT", 4);
+    const unsigned char level_and_flags[2] = {4, flags}; // protocol level 4 is MQTT 3.1.1
+    out_append(s, level_and_flags, sizeof(level_and_flags));
+    out_append_u16(s, IOTC_ENGINE_KEEPALIVE_S);
+    out_append_string(s, client_id, client_id_len);
+    if (username) {
+        out_append_string(s, username, username_len);
+        if (password) {
+            out_append_string(s, password, password_len);
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int out_subscribe(IotcEngineSession *s, const char *topic) {
+    const size_t topic_len = strlen(topic);
+    if (!out_begin_packet(s, MQTT_SUBSCRIBE, 2 + 2 + topic_len + 1)) {
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    out_append_u16(s, session_next_packet_id(s));
+    out_append_string(s, topic, topic_len);
+    const unsigned char qos = 1;
+    out_append(s, &qos, 1);
+    return IOTCL_SUCCESS;
+}
+
+static int out_simple(IotcEngineSession *s, unsigned char type) {
+    return out_begin_packet(s, type, 0) ? IOTCL_SUCCESS : IOTCL_ERR_OUT_OF_MEMORY;
+}
+
+static int out_puback(IotcEngineSession *s, uint16_t packet_id) {
+    if (!out_begin_packet(s, MQTT_PUBACK, 2)) {
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    out_append_u16(s, packet_id);
+    return IOTCL_SUCCESS;
+}
+
+static void worker_wake(EngineWorker *w) {
+    uint64_t one = 1;
+    if (write(w->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        IOTC_ERROR("Unable to wake the engine worker! Error %d", errno);
+    }
+}
+
+// Lets the worker know that there's output or a request for this session
+static void session_make_pending(IotcEngineSession *s) {
+    EngineWorker *w = s->worker;
+    pthread_mutex_lock(&w->lock);
+    if (!s->is_pending) {
+        s->is_pending = true;
+        s->next_pending = w->pending;
+        w->pending = s;
+    }
+    pthread_mutex_unlock(&w->lock);
+    worker_wake(w);
+}
+
+// Worker only. Input is not polled while it is blocked.
+static void session_update_polling(IotcEngineSession *s, bool want_output) {
+    const bool want_input = !s->is_input_blocked;
+    if (want_output == s->is_polling_output && want_input == s->is_polling_input) {
+        return;
+    }
+    struct epoll_event ev = {0};
+    ev.events = (want_input ? EPOLLIN : 0) | (want_output ? EPOLLOUT : 0);
+    ev.data.ptr = s;
+    if (0 == epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_MOD, s->fd, &ev)) {
+        s->is_polling_input = want_input;
+        s->is_polling_output = want_output;
+    }
+}
+
+// Worker or idle session only
+static void session_drop_tls_session(IotcEngineSession *s) {
+    if (s->tls_session) {
+        SSL_SESSION_free(s->tls_session);
+        s->tls_session = NULL;
+    }
+    if (s->tls_session_host) {
+        iotcl_free(s->tls_session_host);
+        s->tls_session_host = NULL;
+    }
+}
+
+// Worker only. Called by OpenSSL when the server issues a session or, with TLS 1.3, a ticket after the handshake.
+static int on_new_tls_session(SSL *ssl, SSL_SESSION *session) {
+    IotcEngineSession *s = (IotcEngineSession *) SSL_get_app_data(ssl);
+    if (!s || !s->tls_session_host || !SSL_SESSION_is_resumable(session)) {
+        return 0; // not keeping it
+    }
+    if (s->tls_session) {
+        SSL_SESSION_free(s->tls_session);
+    }
+    s->tls_session = session;
+    return 1; // we own the reference now
+}
+
+// Worker only. Ends the connection and reports the outcome once the session lock is released.
+static void session_close(IotcEngineSession *s, int result) {
+    pthread_mutex_lock(&s->lock);
+    const SessionState state = s->state;
+    const bool is_requested = s->is_disconnect_requested;
+    const int num_failed = s->num_inflight;
+    EngineInflight *failed = s->inflight; // the next connect will allocate a new one
+    if (SESSION_IDLE == state) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    s->state = SESSION_IDLE;
+    // also after SUBACK, as the connect call may not have returned yet
+    s->connect_result = result ? result : IOTCL_ERR_FAILED;
+    if (state != SESSION_CONNECTED) {
+        s->is_tcp_failed = SESSION_TCP_CONNECTING == state;
+    }
+    const bool is_reported = !s->is_connect_waiting;
+    s->is_disconnect_requested = false;
+    s->close_status = 0;
+    s->num_inflight = 0;
+    s->inflight = NULL;
+    s->out_len = 0;
+    s->ping_sent_ms = 0;
+    IotcDeviceClientStatusCallback status_cb = s->status_cb;
+    IotcDeviceClientDeliveryCallback delivery_cb = s->delivery_cb;
+    void *context = s->context;
+
+    epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    if (s->ssl) {
+        if (SESSION_CONNECTED == state || SESSION_SUBSCRIBING == state || SESSION_MQTT_CONNECTING == state) {
+            SSL_shutdown(s->ssl); // best effort close_notify
+            // otherwise OpenSSL would mark the cached session as not resumable after a connection loss
+            SSL_set_shutdown(s->ssl, SSL_get_shutdown(s->ssl) | SSL_SENT_SHUTDOWN);
+        } else if (SESSION_TLS_HANDSHAKE == state) {
+            session_drop_tls_session(s); // in case the server rejected it
+        }
+        SSL_free(s->ssl);
+        s->ssl = NULL;
+    }
+    ERR_clear_error();
+    close(s->fd);
+    s->fd = -1;
+    s->in_len = 0;
+    s->is_polling_input = false;
+    s->is_polling_output = false;
+    if (s->is_input_blocked) {
+        s->is_input_blocked = false;
+        s->worker->num_input_blocked--;
+    }
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    if (SESSION_CONNECTED != state) {
+        free(failed);
+        return; // the connect call will report the outcome
+    }
+    if (!is_requested) {
+        IOTC_INFO("MQTT Connection lost. Cause: %d", result);
+    }
+    if (delivery_cb) {
+        for (int i = 0; i < num_failed; i++) {
+            delivery_cb(context, failed[i].message_id, false);
+        }
+    }
+    free(failed);
+    if (status_cb && !is_requested && is_reported) {
+        status_cb(context, IOTC_CS_MQTT_DISCONNECTED);
+    }
+}
+
+// Worker only. Writes as much of the pending output as the socket will take.
+static int session_flush(IotcEngineSession *s) {
+    int status = IOTCL_SUCCESS;
+    pthread_mutex_lock(&s->lock);
+    size_t written = 0;
+    while (written < s->out_len) {
+        size_t chunk = s->out_len - written;
+        int rc = SSL_write(s->ssl, &s->out[written], chunk > INT_MAX ? INT_MAX : (int) chunk);
+        if (rc > 0) {
+            written += (size_t) rc;
+            continue;
+        }
+        int err = SSL_get_error(s->ssl, rc);
+        if (err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ) {
+            IOTC_ERROR("Engine TLS write failed with error %d", err);
+            status = IOTCL_ERR_FAILED;
+        }
+        break;
+    }
+    if (written > 0) {
+        memmove(s->out, &s->out[written], s->out_len - written);
+        s->out_len -= written;
+        s->last_sent_ms = iotc_platform_now_ms();
+    }
+    const bool has_output = s->out_len > 0;
+    pthread_mutex_unlock(&s->lock);
+    if (!status) {
+        session_update_polling(s, has_output);
+    }
+    return status;
+}
+
+static int session_on_connack(IotcEngineSession *s, const unsigned char *data, size_t len) {
+    if (len < 2) {
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    const int rc = data[1];
+    if (0 != rc) {
+        IOTC_ERROR("Failed to connect, return code %d", rc);
+        if (rc == CONNACK_IDENTIFIER_REJECTED || rc == CONNACK_BAD_CREDENTIALS || rc == CONNACK_NOT_AUTHORIZED) {
+            return IOTC_DEVICE_CLIENT_ERR_REJECTED;
+        }
+        return rc;
+    }
+    pthread_mutex_lock(&s->lock);
+    int status = out_subscribe(s, s->sub_c2d);
+    s->state = SESSION_SUBSCRIBING;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return status;
+}
+
+static void session_on_suback(IotcEngineSession *s, const unsigned char *data, size_t len) {
+    if (len < 3 || data[2] == 0x80) {
+        IOTC_ERROR("Failed to subscribe to c2d topic");
+    }
+    pthread_mutex_lock(&s->lock);
+    s->state = SESSION_CONNECTED;
+    s->connect_result = IOTCL_SUCCESS;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int session_on_publish(IotcEngineSession *s, unsigned char flags, const unsigned char *data, size_t len) {
+    const int qos = (flags >> 1) & 0x03;
+    if (len < 2) {
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    size_t offset = 2 + (((size_t) data[0] << 8) | data[1]); // skip the topic, as there's only one subscription
+    uint16_t packet_id = 0;
+    if (qos > 0) {
+        if (offset + 2 > len) {
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+        packet_id = (uint16_t) ((data[offset] << 8) | data[offset + 1]);
+        offset += 2;
+    }
+    if (offset > len) {
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    if (s->c2d_msg_cb && !s->c2d_msg_cb(s->context, &data[offset], len - offset)) {
+        // keep the packet in the input and stop reading until it is accepted
+        s->is_input_blocked = true;
+        s->worker->num_input_blocked++;
+        return IOTCL_SUCCESS;
+    }
+    if (qos > 0) {
+        pthread_mutex_lock(&s->lock);
+        int status = out_puback(s, packet_id);
+        pthread_mutex_unlock(&s->lock);
+        return status;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static void session_on_puback(IotcEngineSession *s, const unsigned char *data, size_t len) {
+    if (len < 2) {
+        return;
+    }
+    const uint16_t packet_id = (uint16_t) ((data[0] << 8) | data[1]);
+    bool is_found = false;
+    uint32_t message_id = 0;
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < s->num_inflight; i++) {
+        if (s->inflight[i].packet_id == packet_id) {
+            message_id = s->inflight[i].message_id;
+            s->inflight[i] = s->inflight[--s->num_inflight];
+            is_found = true;
+            break;
+        }
+    }
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    if (is_found && s->delivery_cb) {
+        s->delivery_cb(s->context, message_id, true);
+    }
+}
+
+// Worker only. Handles all complete packets in the input buffer.
+static int session_process_input(IotcEngineSession *s) {
+    size_t offset = 0;
+    int status = IOTCL_SUCCESS;
+    while (!status) {
+        const unsigned char *p = &s->in[offset];
+        const size_t available = s->in_len - offset;
+        size_t remaining_len = 0;
+        size_t multiplier = 1;
+        size_t header_len = 1;
+        bool is_complete = false;
+        while (header_len < available && header_len <= 4) {
+            unsigned char b = p[header_len++];
+            remaining_len += (size_t) (b & 0x7F) * multiplier;
+            multiplier *= 128;
+            if (!(b & 0x80)) {
+                is_complete = true;
+                break;
+            }
+        }
+        if (!is_complete) {
+            if (header_len > 4) {
+                status = IOTCL_ERR_PARSING_ERROR;
+            }
+            break;
+        }
+        if (remaining_len > IOTC_ENGINE_MAX_PACKET_SIZE) {
+            IOTC_ERROR("Inbound MQTT packet of size %lu is too large!", (unsigned long) remaining_len);
+            status = IOTCL_ERR_PARSING_ERROR;
+            break;
+        }
+        if (header_len + remaining_len > available) {
+            break; // need more data
+        }
+        const unsigned char *data = &p[header_len];
+        switch (p[0] & 0xF0) {
+            case MQTT_CONNACK:
+                status = session_on_connack(s, data, remaining_len);
+                break;
+            case MQTT_SUBACK:
+                session_on_suback(s, data, remaining_len);
+                break;
+            case MQTT_PUBLISH:
+                status = session_on_publish(s, (unsigned char) (p[0] & 0x0F), data, remaining_len);
+                break;
+            case MQTT_PUBACK:
+                session_on_puback(s, data, remaining_len);
+                break;
+            case MQTT_PINGRESP:
+                pthread_mutex_lock(&s->lock);
+                s->ping_sent_ms = 0;
+                pthread_mutex_unlock(&s->lock);
+                break;
+            default:
+                break; // nothing else is expected from the broker with QOS 1 or less
+        }
+        if (s->is_input_blocked) {
+            break;
+        }
+        offset += header_len + remaining_len;
+    }
+    if (offset > 0) {
+        memmove(s->in, &s->in[offset], s->in_len - offset);
+        s->in_len -= offset;
+    }
+    return status;
+}
+
+// Worker only
+static int session_read(IotcEngineSession *s) {
+    for (;;) {
+        if (engine_reserve(&s->in, &s->in_capacity, s->in_len + 4096)) {
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        const size_t space = s->in_capacity - s->in_len;
+        int rc = SSL_read(s->ssl, &s->in[s->in_len], space > INT_MAX ? INT_MAX : (int) space);
+        if (rc <= 0) {
+            int err = SSL_get_error(s->ssl, rc);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                return IOTCL_SUCCESS;
+            }
+            return err == SSL_ERROR_ZERO_RETURN ? IOTCL_ERR_FAILED : -err;
+        }
+        s->in_len += (size_t) rc;
+        int status = session_process_input(s);
+        if (status) {
+            return status;
+        }
+        if (s->is_input_blocked) {
+            session_update_polling(s, s->is_polling_output);
+            return IOTCL_SUCCESS;
+        }
+    }
+}
+
+// Worker only. Offers the declined inbound message again and continues reading if it is accepted.
+static int session_retry_input(IotcEngineSession *s) {
+    s->is_input_blocked = false;
+    s->worker->num_input_blocked--;
+    int status = session_process_input(s);
+    if (status || s->is_input_blocked) {
+        return status;
+    }
+    session_update_polling(s, s->is_polling_output);
+    return session_read(s); // there may be more data buffered by OpenSSL, which epoll would not report
+}
+
+// Worker only
+static int session_handshake(IotcEngineSession *s) {
+    int rc = SSL_connect(s->ssl);
+    if (rc == 1) {
+        pthread_mutex_lock(&s->lock);
+        s->is_tls_resumed = SSL_session_reused(s->ssl);
+        s->state = SESSION_MQTT_CONNECTING; // the CONNECT packet is already in the output
+        pthread_cond_broadcast(&s->cond); // for phase reporting
+        pthread_mutex_unlock(&s->lock);
+        return session_flush(s);
+    }
+    int err = SSL_get_error(s->ssl, rc);
+    if (err == SSL_ERROR_WANT_READ) {
+        session_update_polling(s, false);
+        return IOTCL_SUCCESS;
+    }
+    if (err == SSL_ERROR_WANT_WRITE) {
+        session_update_polling(s, true);
+        return IOTCL_SUCCESS;
+    }
+    long verify_result = SSL_get_verify_result(s->ssl);
+    if (verify_result != X509_V_OK) {
+        IOTC_ERROR("Server certificate verification failed: %s", X509_verify_cert_error_string(verify_result));
+    } else {
+        IOTC_ERROR("TLS handshake failed with error %d", err);
+    }
+    return IOTCL_ERR_FAILED;
+}
+
+// Worker only
+static void session_on_io(IotcEngineSession *s, uint32_t events) {
+    int status = IOTCL_SUCCESS;
+    pthread_mutex_lock(&s->lock);
+    const SessionState state = s->state;
+    pthread_mutex_unlock(&s->lock);
+
+    switch (state) {
+        case SESSION_IDLE:
+            return; // closed earlier in this round of events
+        case SESSION_TCP_CONNECTING: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+                IOTC_ERROR("Failed to connect to the MQTT host, error %d", err);
+                status = IOTCL_ERR_FAILED;
+                break;
+            }
+            pthread_mutex_lock(&s->lock);
+            s->state = SESSION_TLS_HANDSHAKE;
+            pthread_mutex_unlock(&s->lock);
+            status = session_handshake(s);
+            break;
+        }
+        case SESSION_TLS_HANDSHAKE:
+            status = session_handshake(s);
+            break;
+        default:
+            if (s->is_input_blocked) {
+                if (events & (EPOLLERR | EPOLLHUP)) {
+                    status = IOTCL_ERR_FAILED; // the connection is gone, so the declined message is lost anyway
+                }
+            } else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                status = session_read(s);
+            }
+            if (!status) {
+                status = session_flush(s);
+            }
+            break;
+    }
+    if (status) {
+        session_close(s, status);
+    }
+}
+
+// Worker only. Handles a request or output from another thread.
+static void session_on_pending(IotcEngineSession *s) {
+    pthread_mutex_lock(&s->lock);
+    const SessionState state = s->state;
+    const bool is_disconnect_requested = s->is_disconnect_requested;
+    const bool is_destroy_requested = s->is_destroy_requested;
+    const int close_status = s->close_status;
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->is_input_blocked && !close_status && !is_destroy_requested) {
+        int status = session_retry_input(s);
+        if (status) {
+            session_close(s, status);
+        }
+    }
+    if (close_status) {
+        session_close(s, close_status);
+    } else if (state >= SESSION_MQTT_CONNECTING) {
+        int status = session_flush(s);
+        if (status || is_disconnect_requested) {
+            session_close(s, status);
+        }
+    } else if (state != SESSION_IDLE && is_disconnect_requested) {
+        session_close(s, IOTCL_ERR_FAILED);
+    }
+
+    if (is_destroy_requested) {
+        session_close(s, IOTCL_ERR_FAILED);
+        EngineWorker *w = s->worker;
+        pthread_mutex_lock(&w->lock);
+        if (s->prev) {
+            s->prev->next = s->next;
+        } else {
+            w->sessions = s->next;
+        }
+        if (s->next) {
+            s->next->prev = s->prev;
+        }
+        pthread_mutex_unlock(&w->lock);
+        pthread_mutex_lock(&s->lock);
+        s->is_unlinked = true;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock); // the session may be freed from this point on
+    }
+}
+
+// Worker only. Sends keepalive pings and drops sessions that timed out.
+static void worker_tick(EngineWorker *w) {
+    pthread_mutex_lock(&w->lock);
+    for (IotcEngineSession *s = w->sessions; s; s = s->next) {
+        bool needs_attention = false;
+        pthread_mutex_lock(&s->lock);
+        // read after locking, as other threads may have started connecting or sending since the tick began
+        const uint64_t now = iotc_platform_now_ms();
+        if (s->state == SESSION_CONNECTED) {
+            if (s->ping_sent_ms && now - s->ping_sent_ms > IOTC_ENGINE_KEEPALIVE_S * 1000) {
+                IOTC_ERROR("MQTT keepalive timed out");
+                s->close_status = IOTCL_ERR_FAILED;
+                needs_attention = true;
+            } else if (!s->ping_sent_ms && now - s->last_sent_ms >= IOTC_ENGINE_KEEPALIVE_S * 1000 / 2) {
+                if (0 == out_simple(s, MQTT_PINGREQ)) {
+                    s->ping_sent_ms = now;
+                    needs_attention = true;
+                }
+            }
+        } else if (s->state != SESSION_IDLE && now - s->connect_started_ms > IOTC_ENGINE_CONNECT_TIMEOUT_MS) {
+            IOTC_ERROR("Timed out while connecting to the MQTT host");
+            s->close_status = IOTCL_ERR_FAILED;
+            needs_attention = true;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (needs_attention && !s->is_pending) {
+            s->is_pending = true;
+            s->next_pending = w->pending;
+            w->pending = s;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Worker only. Sessions with blocked input are retried from the pending list.
+static void worker_retry_blocked_input(EngineWorker *w) {
+    pthread_mutex_lock(&w->lock);
+    for (IotcEngineSession *s = w->sessions; s; s = s->next) {
+        if (s->is_input_blocked && !s->is_pending) {
+            s->is_pending = true;
+            s->next_pending = w->pending;
+            w->pending = s;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_run(void *arg) {
+    EngineWorker *w = (EngineWorker *) arg;
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+    uint64_t last_tick_ms = iotc_platform_now_ms();
+    uint64_t last_retry_ms = last_tick_ms;
+
+    for (;;) {
+        int n = epoll_wait(w->epoll_fd, events, ENGINE_MAX_EVENTS,
+                           w->num_input_blocked ? ENGINE_INPUT_RETRY_MS : ENGINE_TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            IOTC_ERROR("Engine epoll_wait failed with error %d", errno);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (NULL == events[i].data.ptr) {
+                uint64_t count;
+                if (read(w->event_fd, &count, sizeof(count)) < 0) {
+                    // nothing to do. The pending list is checked below anyway.
+                }
+                continue;
+            }
+            session_on_io((IotcEngineSession *) events[i].data.ptr, events[i].events);
+        }
+
+        // Only handle the pending list after the events, as destroyed sessions are freed after this
+        const uint64_t now = iotc_platform_now_ms();
+        if (now - last_tick_ms >= ENGINE_TICK_MS) {
+            last_tick_ms = now;
+            worker_tick(w);
+        }
+        if (w->num_input_blocked && now - last_retry_ms >= ENGINE_INPUT_RETRY_MS) {
+            last_retry_ms = now;
+            worker_retry_blocked_input(w);
+        }
+        pthread_mutex_lock(&w->lock);
+        const bool is_stopping = w->is_stopping;
+        IotcEngineSession *pending = w->pending;
+        w->pending = NULL;
+        while (pending) {
+            // the session can be made pending again as soon as is_pending is cleared, so get the next one first
+            IotcEngineSession *s = pending;
+            pending = s->next_pending;
+            s->is_pending = false;
+            pthread_mutex_unlock(&w->lock);
+            session_on_pending(s);
+            pthread_mutex_lock(&w->lock);
+        }
+        pthread_mutex_unlock(&w->lock);
+        if (is_stopping) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Returns the shared TLS context for the trust store, creating it if needed
+static SSL_CTX *engine_get_tls_context(IotcEngine *e, const char *trust_store) {
+    SSL_CTX *ctx = NULL;
+    pthread_mutex_lock(&e->lock);
+    for (EngineTlsContext *tc = e->tls_contexts; tc; tc = tc->next) {
+        if (0 == strcmp(tc->trust_store, trust_store)) {
+            ctx = tc->ctx;
+            goto done;
+        }
+    }
+
+    EngineTlsContext *tc = calloc(1, sizeof(EngineTlsContext));
+    if (!tc) {
+        IOTC_ERROR("Out of memory while creating the TLS context!");
+        goto done;
+    }
+    tc->trust_store = iotcl_strdup(trust_store);
+    tc->ctx = SSL_CTX_new(TLS_client_method());
+    if (!tc->trust_store || !tc->ctx) {
+        IOTC_ERROR("Unable to create the TLS context!");
+        goto fail;
+    }
+    SSL_CTX_set_min_proto_version(tc->ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(tc->ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_mode(tc->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // sessions are cached per device, because they are bound to the device certificate
+    SSL_CTX_set_session_cache_mode(tc->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tc->ctx, on_new_tls_session);
+    if (1 != SSL_CTX_load_verify_locations(tc->ctx, trust_store, NULL)) {
+        IOTC_ERROR("Unable to load the trust store %s", trust_store);
+        goto fail;
+    }
+    tc->next = e->tls_contexts;
+    e->tls_contexts = tc;
+    ctx = tc->ctx;
+    goto done;
+
+    fail:
+    ERR_clear_error();
+    if (tc->ctx) SSL_CTX_free(tc->ctx);
+    if (tc->trust_store) iotcl_free(tc->trust_store);
+    free(tc);
+
+    done:
+    pthread_mutex_unlock(&e->lock);
+    return ctx;
+}
+
+IotcEngine *iotc_engine_create(const IotcEngineConfig *c) {
+    IotcEngine *e = calloc(1, sizeof(IotcEngine));
+    if (!e) {
+        IOTC_ERROR("Out of memory while creating the engine!");
+        return NULL;
+    }
+    pthread_mutex_init(&e->lock, NULL);
+
+    // a peer closing the connection must not kill the process while writing
+    signal(SIGPIPE, SIG_IGN);
+
+    int num_workers = c ? c->num_workers : 0;
+    if (num_workers <= 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = num_cpus > 0 ? (int) num_cpus : 1;
+    }
+    e->workers = calloc((size_t) num_workers, sizeof(EngineWorker));
+    if (!e->workers) {
+        IOTC_ERROR("Out of memory while creating the engine!");
+        iotc_engine_destroy(e);
+        return NULL;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        EngineWorker *w = &e->workers[i];
+        w->engine = e;
+        pthread_mutex_init(&w->lock, NULL);
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        w->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (w->epoll_fd < 0 || w->event_fd < 0 || epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &ev)
+            || pthread_create(&w->thread, NULL, worker_run, w)) {
+            IOTC_ERROR("Unable to start engine worker %d, error %d", i, errno);
+            if (w->epoll_fd >= 0) close(w->epoll_fd);
+            if (w->event_fd >= 0) close(w->event_fd);
+            pthread_mutex_destroy(&w->lock);
+            iotc_engine_destroy(e);
+            return NULL;
+        }
+        e->num_workers++;
+    }
+    return e;
+}
+
+void iotc_engine_destroy(IotcEngine *e) {
+    if (!e) {
+        return;
+    }
+    for (int i = 0; i < e->num_workers; i++) {
+        EngineWorker *w = &e->workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->is_stopping = true;
+        pthread_mutex_unlock(&w->lock);
+        worker_wake(w);
+        pthread_join(w->thread, NULL);
+        if (w->sessions) {
+            IOTC_WARN("Destroying the engine while clients are still using it!");
+        }
+        close(w->epoll_fd);
+        close(w->event_fd);
+        pthread_mutex_destroy(&w->lock);
+    }
+    free(e->workers);
+    while (e->tls_contexts) {
+        EngineTlsContext *tc = e->tls_contexts;
+        e->tls_contexts = tc->next;
+        SSL_CTX_free(tc->ctx);
+        iotcl_free(tc->trust_store);
+        free(tc);
+    }
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+IotcEngineSession *iotc_engine_session_create(IotcEngine *e) {
+    IotcEngineSession *s = calloc(1, sizeof(IotcEngineSession));
+    if (!s) {
+        IOTC_ERROR("Out of memory while creating the engine session!");
+        return NULL;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&s->lock, NULL);
+    s->engine = e;
+    s->fd = -1;
+
+    pthread_mutex_lock(&e->lock);
+    s->worker = &e->workers[e->next_worker++ % (unsigned int) e->num_workers];
+    pthread_mutex_unlock(&e->lock);
+
+    EngineWorker *w = s->worker;
+    pthread_mutex_lock(&w->lock);
+    s->next = w->sessions;
+    if (w->sessions) {
+        w->sessions->prev = s;
+    }
+    w->sessions = s;
+    pthread_mutex_unlock(&w->lock);
+    return s;
+}
+
+// Waits on the session condition for up to timeout_ms. The session lock must be held.
+static int session_wait(IotcEngineSession *s, long timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+}
+
+static int session_start_tls(IotcEngineSession *s, IotConnectDeviceClientConfig *c) {
+    SSL_CTX *ctx = engine_get_tls_context(s->engine, c->auth->trust_store);
+    if (!ctx) {
+        return IOTCL_ERR_CONFIG_ERROR; // called function will print the error
+    }
+    s->ssl = SSL_new(ctx);
+    if (!s->ssl || 1 != SSL_set_fd(s->ssl, s->fd)) {
+        IOTC_ERROR("Unable to create the TLS connection!");
+        return IOTCL_ERR_FAILED;
+    }
+    SSL_set_app_data(s->ssl, s);
+    SSL_set_tlsext_host_name(s->ssl, c->mqtt->host);
+    SSL_set1_host(s->ssl, c->mqtt->host);
+    if (s->tls_session_host && 0 != strcmp(s->tls_session_host, c->mqtt->host)) {
+        session_drop_tls_session(s);
+    }
+    if (s->tls_session) {
+        SSL_set_session(s->ssl, s->tls_session); // the server may still choose to do a full handshake
+    } else if (!s->tls_session_host) {
+        s->tls_session_host = iotcl_strdup(c->mqtt->host); // if OOM, the session just won't be cached
+    }
+    if (c->auth->type == IOTC_AT_X509) {
+        if (1 != SSL_use_certificate_chain_file(s->ssl, c->auth->data.cert_info.device_cert)
+            || 1 != SSL_use_PrivateKey_file(s->ssl, c->auth->data.cert_info.device_key, SSL_FILETYPE_PEM)) {
+            IOTC_ERROR("Unable to load the device certificate or key!");
+            return IOTCL_ERR_CONFIG_ERROR;
+        }
+    }
+    SSL_set_connect_state(s->ssl);
+    return IOTCL_SUCCESS;
+}
+
+// Starts a non-blocking connect. Returns false if it failed right away.
+static bool session_start_connect(IotcEngineSession *s, const struct sockaddr *addr, socklen_t addr_len) {
+    s->fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->fd < 0) {
+        return false;
+    }
+    const int one = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (0 == connect(s->fd, addr, addr_len) || errno == EINPROGRESS) {
+        return true;
+    }
+    close(s->fd);
+    s->fd = -1;
+    return false;
+}
+
+// Uses the addresses from the DNS cache if it is running, and resolves the host otherwise,
+// or if none of the cached addresses could be connected to.
+static int session_open_socket(IotcEngineSession *s, const char *host) {
+    IotcDnsAddress cached[IOTC_DNS_MAX_ADDRESSES];
+    const size_t num_cached = iotc_dns_cache_lookup(host, MQTT_PORT, cached, IOTC_DNS_MAX_ADDRESSES);
+    for (size_t i = 0; i < num_cached; i++) {
+        if (session_start_connect(s, (const struct sockaddr *) &cached[i].addr, cached[i].len)) {
+            s->is_address_cached = true;
+            return IOTCL_SUCCESS;
+        }
+    }
+    if (num_cached > 0) {
+        iotc_dns_cache_invalidate(host, MQTT_PORT);
+    }
+    s->is_address_cached = false;
+
+    struct addrinfo hints = {0};
+    struct addrinfo *addresses = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, MQTT_PORT, &hints, &addresses);
+    if (rc) {
+        IOTC_ERROR("Unable to resolve %s: %s", host, gai_strerror(rc));
+        return IOTCL_ERR_FAILED;
+    }
+    int status = IOTCL_ERR_FAILED;
+    for (struct addrinfo *a = addresses; a; a = a->ai_next) {
+        if (session_start_connect(s, a->ai_addr, (socklen_t) a->ai_addrlen)) {
+            status = IOTCL_SUCCESS;
+            break;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (status) {
+        IOTC_ERROR("Unable to connect to %s", host);
+    }
+    return status;
+}
+
+static IotConnectConnectPhase session_phase(SessionState state) {
+    switch (state) {
+        case SESSION_MQTT_CONNECTING:
+            return IOTC_CP_CONNACK;
+        case SESSION_SUBSCRIBING:
+            return IOTC_CP_SUBACK;
+        default:
+            return IOTC_CP_TLS; // TCP connect included
+    }
+}
+
+int iotc_engine_session_connect(IotcEngineSession *s, IotConnectDeviceClientConfig *c) {
+    IotConnectMqttIdentity *mc = c->mqtt;
+    char token[IOTC_SAS_TOKEN_MAX_LEN];
+    char *generated_token = NULL;
+    const char *password = NULL;
+    int status;
+
+    if (!mc || !mc->host || !mc->client_id || !mc->sub_c2d) {
+        IOTC_ERROR("Device MQTT configuration is missing!");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    if (c->auth->type == IOTC_AT_SYMMETRIC_KEY) {
+        if (!c->auth->data.symmetric_key || 0 == strlen(c->auth->data.symmetric_key)) {
+            IOTC_ERROR("Error: Configuration symmetric key is missing.");
+            return IOTCL_ERR_CONFIG_MISSING;
+        }
+        if (c->sas_token) {
+            if (!iotc_sas_token_get(c->sas_token, token, sizeof(token))) {
+                IOTC_ERROR("Unable to get SAS token!");
+                return IOTCL_ERR_FAILED;
+            }
+            password = token;
+        } else {
+            generated_token = gen_sas_token(mc->host, mc->client_id, c->auth->data.symmetric_key, 60);
+            if (!generated_token) {
+                IOTC_ERROR("Unable to generate SAS token!");
+                return IOTCL_ERR_FAILED; // could be OOM or a different reason
+            }
+            password = generated_token;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (s->state != SESSION_IDLE) {
+        pthread_mutex_unlock(&s->lock);
+        free(generated_token);
+        IOTC_ERROR("The engine session is already connected!");
+        return IOTCL_ERR_FAILED;
+    }
+    char *sub_c2d = iotcl_strdup(mc->sub_c2d);
+    if (!sub_c2d) {
+        pthread_mutex_unlock(&s->lock);
+        free(generated_token);
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    if (s->sub_c2d) iotcl_free(s->sub_c2d);
+    s->sub_c2d = sub_c2d;
+    s->c2d_msg_cb = c->c2d_msg_cb;
+    s->status_cb = c->status_cb;
+    s->delivery_cb = c->delivery_cb;
+    s->context = c->context;
+    s->max_inflight = c->max_inflight > 0 ? c->max_inflight : IOTC_ENGINE_DEFAULT_INFLIGHT;
+    s->num_inflight = 0;
+    free(s->inflight);
+    s->inflight = malloc((size_t) s->max_inflight * sizeof(EngineInflight));
+    if (!s->inflight) {
+        pthread_mutex_unlock(&s->lock);
+        free(generated_token);
+        IOTC_ERROR("Out of memory while connecting!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    s->out_len = 0;
+    s->in_len = 0;
+    s->ping_sent_ms = 0;
+    s->is_disconnect_requested = false;
+    s->close_status = 0;
+    s->is_tls_resumed = false;
+    s->is_tcp_failed = false;
+
+    status = out_connect(s, mc->client_id, mc->username, password);
+    free(generated_token);
+    if (!status) {
+        status = session_open_socket(s, mc->host);
+    }
+    if (!status) {
+        status = session_start_tls(s, c);
+    }
+    if (status) {
+        if (s->ssl) {
+            SSL_free(s->ssl);
+            s->ssl = NULL;
+        }
+        ERR_clear_error();
+        if (s->fd >= 0) {
+            close(s->fd);
+            s->fd = -1;
+        }
+        pthread_mutex_unlock(&s->lock);
+        return status;
+    }
+
+    s->state = SESSION_TCP_CONNECTING;
+    s->connect_started_ms = iotc_platform_now_ms();
+    s->last_sent_ms = s->connect_started_ms;
+    s->is_polling_input = true;
+    s->is_polling_output = true;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT; // writable once the TCP connection is established
+    ev.data.ptr = s;
+    if (epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_ADD, s->fd, &ev)) {
+        IOTC_ERROR("Unable to add the connection to the engine, error %d", errno);
+        SSL_free(s->ssl);
+        s->ssl = NULL;
+        close(s->fd);
+        s->fd = -1;
+        s->state = SESSION_IDLE;
+        pthread_mutex_unlock(&s->lock);
+        return IOTCL_ERR_FAILED;
+    }
+
+    // the worker takes it from here and reports the outcome
+    IotConnectConnectPhase reported = IOTC_CP_IDLE;
+    s->is_connect_waiting = true;
+    while (s->state != SESSION_IDLE && s->state != SESSION_CONNECTED) {
+        const IotConnectConnectPhase phase = session_phase(s->state);
+        if (c->phase_cb && phase != reported) {
+            reported = phase;
+            pthread_mutex_unlock(&s->lock); // the worker can move on while the callback runs
+            c->phase_cb(c->context, phase);
+            pthread_mutex_lock(&s->lock);
+            continue;
+        }
+        session_wait(s, ENGINE_TICK_MS);
+    }
+    // the connection may also have been lost after SUBACK, in which case the session is idle again
+    if (s->state == SESSION_CONNECTED) {
+        status = IOTCL_SUCCESS;
+    } else {
+        status = s->connect_result ? s->connect_result : IOTCL_ERR_FAILED;
+    }
+    s->is_connect_waiting = false;
+    if (status && s->is_tcp_failed && s->is_address_cached) {
+        iotc_dns_cache_invalidate(mc->host, MQTT_PORT); // so that the next connect resolves the host again
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (!status && s->status_cb) {
+        s->status_cb(s->context, IOTC_CS_MQTT_CONNECTED);
+    }
+    return status;
+}
+
+int iotc_engine_session_disconnect(IotcEngineSession *s) {
+    pthread_mutex_lock(&s->lock);
+    if (s->state == SESSION_IDLE) {
+        pthread_mutex_unlock(&s->lock);
+        return IOTCL_ERR_FAILED;
+    }
+    if (s->state == SESSION_CONNECTED) {
+        out_simple(s, MQTT_DISCONNECT);
+    }
+    s->is_disconnect_requested = true;
+    pthread_mutex_unlock(&s->lock);
+
+    session_make_pending(s);
+
+    pthread_mutex_lock(&s->lock);
+    while (s->state != SESSION_IDLE) {
+        session_wait(s, ENGINE_TICK_MS);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return IOTCL_SUCCESS;
+}
+
+bool iotc_engine_session_is_tls_resumed(IotcEngineSession *s) {
+    pthread_mutex_lock(&s->lock);
+    bool ret = s->is_tls_resumed;
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+bool iotc_engine_session_is_connected(IotcEngineSession *s) {
+    pthread_mutex_lock(&s->lock);
+    bool ret = s->state == SESSION_CONNECTED;
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int iotc_engine_session_send_message_iov(IotcEngineSession *s, const char *topic, const IotConnectBuffer *bufs,
+                                         size_t num_bufs, int qos, uint32_t message_id) {
+    const size_t topic_len = strlen(topic);
+    size_t payload_len = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        payload_len += bufs[i].len;
+    }
+    if (topic_len > UINT16_MAX || payload_len > IOTC_ENGINE_MAX_OUTPUT_SIZE) {
+        IOTC_ERROR("Message of size %lu is too large to publish!", (unsigned long) payload_len);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    qos = qos > 0 ? 1 : 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (qos > 0) {
+        const uint64_t deadline = iotc_platform_now_ms() + MQTT_PUBLISH_TIMEOUT_MS;
+        while (s->state == SESSION_CONNECTED && s->num_inflight >= s->max_inflight
+               && iotc_platform_now_ms() < deadline) {
+            session_wait(s, MQTT_PUBLISH_TIMEOUT_MS);
+        }
+    }
+    int status = IOTCL_SUCCESS;
+    if (s->state != SESSION_CONNECTED) {
+        IOTC_ERROR("Failed to publish message. Not connected.");
+        status = IOTCL_ERR_FAILED;
+    } else if (qos > 0 && s->num_inflight >= s->max_inflight) {
+        IOTC_ERROR("Timed out while waiting for pending messages to be acknowledged");
+        status = IOTCL_ERR_FAILED;
+    } else if (s->out_len > IOTC_ENGINE_MAX_OUTPUT_SIZE) {
+        IOTC_ERROR("Failed to publish message. Too much data is waiting to be sent.");
+        status = IOTCL_ERR_FAILED;
+    } else if (!out_begin_packet(s, (unsigned char) (MQTT_PUBLISH | (qos << 1)),
+                                 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len)) {
+        status = IOTCL_ERR_OUT_OF_MEMORY;
+    } else {
+        out_append_string(s, topic, topic_len);
+        if (qos > 0) {
+            const uint16_t packet_id = session_next_packet_id(s);
+            out_append_u16(s, packet_id);
+            s->inflight[s->num_inflight].packet_id = packet_id;
+            s->inflight[s->num_inflight].message_id = message_id;
+            s->num_inflight++;
+        }
+        for (size_t i = 0; i < num_bufs; i++) {
+            out_append(s, bufs[i].data, bufs[i].len);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (status) {
+        return status;
+    }
+    session_make_pending(s);
+    // QOS 1 delivery will be reported once the broker acknowledges the message
+    if (qos == 0 && s->delivery_cb) {
+        s->delivery_cb(s->context, message_id, true);
+    }
+    return IOTCL_SUCCESS;
+}
+
+void iotc_engine_session_destroy(IotcEngineSession *s) {
+    if (!s) {
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->is_destroy_requested = true;
+    s->is_disconnect_requested = true; // not a connection loss
+    pthread_mutex_unlock(&s->lock);
+
+    session_make_pending(s);
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->is_unlinked) {
+        session_wait(s, ENGINE_TICK_MS);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->sub_c2d) iotcl_free(s->sub_c2d);
+    session_drop_tls_session(s);
+    free(s->inflight);
+    free(s->out);
+    free(s->in);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+#else // no epoll
+
+IotcEngine *iotc_engine_create(const IotcEngineConfig *c) {
+    (void) c;
+    IOTC_ERROR("The engine is only available on Linux!");
+    return NULL;
+}
+
+void iotc_engine_destroy(IotcEngine *engine) {
+    (void) engine;
+}
+
+IotcEngineSession *iotc_engine_session_create(IotcEngine *engine) {
+    (void) engine;
+    return NULL;
+}
+
+int iotc_engine_session_connect(IotcEngineSession *s, IotConnectDeviceClientConfig *c) {
+    (void) s;
+    (void) c;
+    return IOTCL_ERR_FAILED;
+}
+
+int iotc_engine_session_disconnect(IotcEngineSession *s) {
+    (void) s;
+    return IOTCL_ERR_FAILED;
+}
+
+bool iotc_engine_session_is_connected(IotcEngineSession *s) {
+    (void) s;
+    return false;
+}
+
+bool iotc_engine_session_is_tls_resumed(IotcEngineSession *s) {
+    (void) s;
+    return false;
+}
+
+int iotc_engine_session_send_message_iov(IotcEngineSession *s, const char *topic, const IotConnectBuffer *bufs,
+                                         size_t num_bufs, int qos, uint32_t message_id) {
+    (void) s;
+    (void) message_id;
+    (void) topic;
+    (void) bufs;
+    (void) num_bufs;
+    (void) qos;
+    return IOTCL_ERR_FAILED;
+}
+
+void iotc_engine_session_destroy(IotcEngineSession *s) {
+    (void) s;
+}
+
+#endif
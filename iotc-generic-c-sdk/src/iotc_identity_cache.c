@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_identity_cache.h"
+
+// The file has a header line with the format version and the time when it was saved,
+// followed by a line with the key and then the response as received.
+#define CACHE_MAGIC "iotc-identity-cache"
+#define CACHE_VERSION 1
+#define CACHE_MAX_SIZE (64 * 1024) // identity responses are around 2 KB
+
+static char *cache_read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL; // nothing cached yet
+    }
+    char *data = malloc(CACHE_MAX_SIZE + 1);
+    if (!data) {
+        IOTC_ERROR("Out of memory while reading the identity cache!");
+        fclose(f);
+        return NULL;
+    }
+    *len = fread(data, 1, CACHE_MAX_SIZE + 1, f);
+    fclose(f);
+    if (*len > CACHE_MAX_SIZE) {
+        IOTC_WARN("Identity cache %s is too large. Ignoring it.", path);
+        free(data);
+        return NULL;
+    }
+    data[*len] = 0;
+    return data;
+}
+
+char *iotc_identity_cache_load(const char *path, const char *key, int64_t *age_s) {
+    size_t len = 0;
+    char *data = cache_read_file(path, &len);
+    if (!data) {
+        return NULL;
+    }
+    int version = 0;
+    long long saved_at = 0;
+    char *key_start = strchr(data, '\n');
+    char *response = key_start ? strchr(key_start + 1, '\n') : NULL;
+    if (!response || 2 != sscanf(data, CACHE_MAGIC " %d %lld", &version, &saved_at) || CACHE_VERSION != version) {
+        IOTC_WARN("Identity cache %s is not valid. Ignoring it.", path);
+        free(data);
+        return NULL;
+    }
+    key_start++;
+    *response = 0;
+    response++;
+    if (0 != strcmp(key_start, key) || 0 == strlen(response)) {
+        free(data); // saved for a different device, or settings have changed
+        return NULL;
+    }
+    *age_s = (int64_t) time(NULL) - (int64_t) saved_at;
+    const size_t response_len = len - (size_t) (response - data);
+    memmove(data, response, response_len + 1);
+    return data;
+}
+
+int iotc_identity_cache_save(const char *path, const char *key, const char *response) {
+    const size_t tmp_path_len = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_path_len);
+    if (!tmp_path) {
+        IOTC_ERROR("Out of memory while saving the identity cache!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+
+    int status = IOTCL_SUCCESS;
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        IOTC_ERROR("Unable to create identity cache file %s!", tmp_path);
+        free(tmp_path);
+        return IOTCL_ERR_FAILED;
+    }
+    if (fprintf(f, CACHE_MAGIC " %d %lld\n%s\n", CACHE_VERSION, (long long) time(NULL), key) < 0
+        || fputs(response, f) < 0) {
+        status = IOTCL_ERR_FAILED;
+    }
+    if (0 != fclose(f)) {
+        status = IOTCL_ERR_FAILED;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path); // rename does not replace existing files on Windows
+#endif
+    if (!status && 0 != rename(tmp_path, path)) {
+        status = IOTCL_ERR_FAILED;
+    }
+    if (status) {
+        IOTC_ERROR("Unable to write identity cache file %s!", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return status;
+}
+
+void iotc_identity_cache_remove(const char *path) {
+    remove(path);
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <string.h>
+#include "iotc_platform.h"
+#include "iotc_link_estimator.h"
+
+#define LINK_WINDOW_US 1000000 // throughput and batch limits are updated at most this often
+#define LINK_MIN_SAMPLES 8 // before the estimates are trusted for changing QOS
+#define LINK_QOS1_PROBE_INTERVAL 10 // one in this many telemetry messages is still sent with QOS 1
+#define LINK_CONGESTION_MARGIN_MS 20.0 // RTT can grow this much above twice the baseline before it counts
+
+static size_t clamp_size(size_t value, size_t min, size_t max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+static unsigned int clamp_uint(unsigned int value, unsigned int min, unsigned int max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+void iotc_link_init(IotcLinkEstimator *e, const IotConnectAdaptiveConfig *config,
+                    const IotConnectBatchConfig *batch) {
+    memset(e, 0, sizeof(IotcLinkEstimator));
+    if (config) {
+        e->config = *config;
+    }
+    if (e->config.max_batch_records < e->config.min_batch_records) {
+        e->config.max_batch_records = e->config.min_batch_records;
+    }
+    if (e->config.max_batch_latency_ms < e->config.min_batch_latency_ms) {
+        e->config.max_batch_latency_ms = e->config.min_batch_latency_ms;
+    }
+    e->estimate.batch_records = clamp_size(batch ? batch->max_records : 0, e->config.min_batch_records,
+                                           e->config.max_batch_records);
+    e->estimate.batch_latency_ms = clamp_uint(batch ? batch->max_latency_ms : 0, e->config.min_batch_latency_ms,
+                                              e->config.max_batch_latency_ms);
+    e->estimate.telemetry_qos = -1; // not known until the first telemetry message
+    e->window_start_us = iotc_platform_now_us();
+}
+
+bool iotc_link_is_enabled(const IotcLinkEstimator *e) {
+    return e->config.enabled;
+}
+
+// Additive increase of the batch size while the link keeps up, and multiplicative decrease on loss or
+// when the RTT grows well above the baseline. The flush interval moves the other way, but not below the
+// retransmission timeout, as flushing faster than messages are acknowledged does not help.
+static void link_adjust_batch_limits(IotcLinkEstimator *e) {
+    IotConnectLinkEstimate *est = &e->estimate;
+    const bool is_congested = e->window_failures > 0
+                              || est->rtt_ms > 2 * e->min_rtt_ms + LINK_CONGESTION_MARGIN_MS;
+    unsigned int latency_ms = est->batch_latency_ms;
+    if (is_congested) {
+        est->batch_records = est->batch_records / 2;
+        latency_ms = latency_ms * 2;
+    } else {
+        est->batch_records = est->batch_records + 1;
+        latency_ms = latency_ms - latency_ms / 8;
+    }
+    const unsigned int rto_ms = (unsigned int) (est->rtt_ms + 4 * est->rtt_var_ms);
+    if (latency_ms < rto_ms) {
+        latency_ms = rto_ms;
+    }
+    est->batch_records = clamp_size(est->batch_records, e->config.min_batch_records, e->config.max_batch_records);
+    est->batch_latency_ms = clamp_uint(latency_ms, e->config.min_batch_latency_ms, e->config.max_batch_latency_ms);
+}
+
+void iotc_link_on_delivery(IotcLinkEstimator *e, bool is_delivered, uint64_t rtt_us, size_t size) {
+    IotConnectLinkEstimate *est = &e->estimate;
+    if (is_delivered) {
+        // smoothing as in RFC 6298
+        const double rtt_ms = (double) rtt_us / 1000.0;
+        if (0 == est->num_samples) {
+            est->rtt_ms = rtt_ms;
+            est->rtt_var_ms = rtt_ms / 2;
+            e->min_rtt_ms = rtt_ms;
+        } else {
+            const double delta = est->rtt_ms > rtt_ms ? est->rtt_ms - rtt_ms : rtt_ms - est->rtt_ms;
+            est->rtt_var_ms = 0.75 * est->rtt_var_ms + 0.25 * delta;
+            est->rtt_ms = 0.875 * est->rtt_ms + 0.125 * rtt_ms;
+            if (rtt_ms < e->min_rtt_ms) {
+                e->min_rtt_ms = rtt_ms;
+            }
+        }
+        e->window_bytes += size;
+    } else {
+        e->window_failures++;
+    }
+    est->loss = 0.9375 * est->loss + (is_delivered ? 0 : 0.0625);
+    est->num_samples++;
+    e->window_samples++;
+
+    const uint64_t now = iotc_platform_now_us();
+    const uint64_t elapsed_us = now - e->window_start_us;
+    if (elapsed_us < LINK_WINDOW_US) {
+        return;
+    }
+    const double throughput = (double) e->window_bytes * 1000000.0 / (double) elapsed_us;
+    if (0 == est->throughput_bps) {
+        est->throughput_bps = throughput;
+    } else {
+        est->throughput_bps = 0.75 * est->throughput_bps + 0.25 * throughput;
+    }
+    if (e->config.enabled) {
+        link_adjust_batch_limits(e);
+    }
+    e->window_start_us = now;
+    e->window_bytes = 0;
+    e->window_samples = 0;
+    e->window_failures = 0;
+}
+
+int iotc_link_telemetry_qos(IotcLinkEstimator *e, int default_qos) {
+    IotConnectLinkEstimate *est = &e->estimate;
+    est->telemetry_qos = default_qos;
+    if (!e->config.enabled || 0 == default_qos || 0 == e->config.qos0_min_rtt_ms
+        || est->num_samples < LINK_MIN_SAMPLES) {
+        return default_qos;
+    }
+    if (est->rtt_ms < e->config.qos0_min_rtt_ms || est->loss * 100 >= e->config.qos0_max_loss_pct) {
+        e->qos0_count = 0;
+        return default_qos;
+    }
+    est->telemetry_qos = 0;
+    if (++e->qos0_count >= LINK_QOS1_PROBE_INTERVAL) {
+        e->qos0_count = 0;
+        return default_qos; // keeps the estimates up to date
+    }
+    return 0;
+}
+
+void iotc_link_apply_batch_limits(const IotcLinkEstimator *e, IotConnectBatchConfig *batch) {
+    batch->max_records = e->estimate.batch_records;
+    batch->max_latency_ms = e->estimate.batch_latency_ms;
+}
@@ -0,0 +1,402 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700 // for ftruncate and msync with -std=c99
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_offline_store.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Define as 1 to wait for each write to reach the disk. This protects against power loss,
+// but it can be slow and may wear out flash storage. Process crashes are handled in either case.
+#ifndef IOTC_OFFLINE_STORE_SYNC_WRITES
+#define IOTC_OFFLINE_STORE_SYNC_WRITES 0
+#endif
+
+#define STORE_MAGIC 0x51544F49u // "IOTQ"
+#define STORE_VERSION 1
+#define STORE_WRAP_MARKER 0xFFFFFFFFu
+#define STORE_ALIGN 8
+#define STORE_ALIGNED(x) (((x) + (STORE_ALIGN - 1)) & ~((size_t) STORE_ALIGN - 1))
+
+// The header is written alternately into two slots, so that a torn header write never loses the previous state.
+#define STORE_HEADER_SLOTS 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq; // incremented with each header update. The valid slot with highest seq is current.
+    uint64_t capacity;
+    uint64_t head; // data offset of the oldest record
+    uint64_t tail; // data offset where the next record will be written
+    uint64_t count;
+    uint64_t next_record_seq;
+    uint32_t crc; // of all fields above
+    uint32_t reserved;
+} StoreHeader;
+
+typedef struct {
+    uint32_t length; // total aligned record length, or STORE_WRAP_MARKER if the next record is at offset 0
+    uint32_t crc; // of everything following this header, up to payload NUL terminator
+    uint64_t seq;
+    uint32_t topic_len; // including NUL terminator
+    uint32_t payload_len; // not including NUL terminator, which is stored as well
+} StoreRecordHeader;
+
+struct IotcOfflineStore {
+    StoreHeader state; // current header, committed to the file with store_commit_header()
+    unsigned char *map;
+    size_t map_size;
+    unsigned char *data; // start of the ring data area in the mapping
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+static uint32_t crc_table[256];
+
+static void crc32_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_compute(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void store_flush(IotcOfflineStore *s, const void *ptr, size_t len) {
+#if defined(_WIN32) || defined(_WIN64)
+    FlushViewOfFile(ptr, len);
+#if IOTC_OFFLINE_STORE_SYNC_WRITES
+    FlushFileBuffers(s->file);
+#endif
+#else
+    // msync requires a page aligned address
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t start = (size_t) ((const unsigned char *) ptr - s->map);
+    const size_t aligned_start = start - (start % page_size);
+    msync(s->map + aligned_start, len + (start - aligned_start),
+          IOTC_OFFLINE_STORE_SYNC_WRITES ? MS_SYNC : MS_ASYNC);
+#endif
+}
+
+static void store_commit_header(IotcOfflineStore *s) {
+    s->state.seq++;
+    s->state.crc = crc32_compute(&s->state, offsetof(StoreHeader, crc));
+    StoreHeader *slot = &((StoreHeader *) s->map)[s->state.seq % STORE_HEADER_SLOTS];
+    memcpy(slot, &s->state, sizeof(StoreHeader));
+    store_flush(s, slot, sizeof(StoreHeader));
+}
+
+static void store_reset(IotcOfflineStore *s, uint64_t capacity) {
+    const uint64_t seq = s->state.seq;
+    memset(&s->state, 0, sizeof(StoreHeader));
+    s->state.magic = STORE_MAGIC;
+    s->state.version = STORE_VERSION;
+    s->state.seq = seq;
+    s->state.capacity = capacity;
+    s->state.next_record_seq = 1;
+    store_commit_header(s);
+}
+
+static bool store_is_header_valid(const StoreHeader *h, uint64_t capacity) {
+    return h->magic == STORE_MAGIC
+           && h->version == STORE_VERSION
+           && h->crc == crc32_compute(h, offsetof(StoreHeader, crc))
+           && h->capacity == capacity
+           && h->head <= capacity
+           && h->tail <= capacity;
+}
+
+// Returns the oldest record, skipping the wrap marker if needed, or NULL if empty or corrupted.
+static StoreRecordHeader *store_head_record(IotcOfflineStore *s) {
+    StoreHeader *st = &s->state;
+    if (0 == st->count) {
+        return NULL;
+    }
+    if (st->capacity - st->head < sizeof(StoreRecordHeader)
+        || ((StoreRecordHeader *) &s->data[st->head])->length == STORE_WRAP_MARKER) {
+        st->head = 0;
+    }
+    StoreRecordHeader *rh = (StoreRecordHeader *) &s->data[st->head];
+    const size_t content_len = (size_t) rh->topic_len + rh->payload_len + 1;
+    if (rh->length < sizeof(StoreRecordHeader) + content_len
+        || st->head + rh->length > st->capacity
+        || 0 == rh->topic_len
+        || ((char *) &rh[1])[rh->topic_len - 1] != 0
+        || rh->crc != crc32_compute(&rh[1], content_len)) {
+        IOTC_ERROR("Offline store data is corrupted. Discarding %lu stored messages!", (unsigned long) st->count);
+        store_reset(s, st->capacity);
+        return NULL;
+    }
+    return rh;
+}
+
+static void store_drop_head(IotcOfflineStore *s) {
+    StoreHeader *st = &s->state;
+    StoreRecordHeader *rh = store_head_record(s);
+    if (!rh) {
+        return;
+    }
+    st->head += rh->length;
+    st->count--;
+    if (0 == st->count) {
+        st->head = 0;
+        st->tail = 0;
+    }
+}
+
+// Finds a contiguous free area of len bytes without dropping any messages.
+static bool store_find_space(IotcOfflineStore *s, size_t len, uint64_t *offset) {
+    StoreHeader *st = &s->state;
+    if (0 == st->count) {
+        st->head = 0;
+        st->tail = 0;
+        *offset = 0;
+        return len <= st->capacity;
+    }
+    if (st->tail > st->head) {
+        // not wrapped. Free space is after the tail and before the head
+        if (st->tail + len <= st->capacity) {
+            *offset = st->tail;
+            return true;
+        }
+        if (len <= st->head) {
+            if (st->capacity - st->tail >= sizeof(uint32_t)) {
+                // else the reader will know to wrap around because a header cannot fit
+                *((uint32_t *) &s->data[st->tail]) = STORE_WRAP_MARKER;
+            }
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+    // wrapped. Free space is between the tail and the head
+    if (st->tail + len <= st->head) {
+        *offset = st->tail;
+        return true;
+    }
+    return false;
+}
+
+int iotc_store_push(IotcOfflineStore *s, const char *topic, const IotConnectBuffer *bufs, size_t num_bufs,
+                    uint64_t *seq) {
+    StoreHeader *st = &s->state;
+    size_t payload_len = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        payload_len += bufs[i].len;
+    }
+    const size_t topic_len = strlen(topic) + 1;
+    const size_t content_len = topic_len + payload_len + 1;
+    const size_t record_len = STORE_ALIGNED(sizeof(StoreRecordHeader) + content_len);
+    if (record_len > st->capacity || payload_len >= UINT32_MAX - topic_len) {
+        IOTC_ERROR("Message of size %lu is too large for the offline store!", (unsigned long) payload_len);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+
+    unsigned long num_dropped = 0;
+    uint64_t offset = 0;
+    while (!store_find_space(s, record_len, &offset)) {
+        store_drop_head(s);
+        num_dropped++;
+    }
+    if (num_dropped > 0) {
+        // the new record goes over the dropped ones, so the header must stop pointing at them first.
+        // Otherwise a crash while writing would leave a corrupted head record, discarding everything.
+        store_commit_header(s);
+        IOTC_WARN("Offline store is full. Dropped %lu oldest messages.", num_dropped);
+    }
+
+    StoreRecordHeader *rh = (StoreRecordHeader *) &s->data[offset];
+    char *content = (char *) &rh[1];
+    memcpy(content, topic, topic_len);
+    size_t content_offset = topic_len;
+    for (size_t i = 0; i < num_bufs; i++) {
+        memcpy(&content[content_offset], bufs[i].data, bufs[i].len);
+        content_offset += bufs[i].len;
+    }
+    content[content_offset] = 0;
+    rh->length = (uint32_t) record_len;
+    rh->crc = crc32_compute(content, content_len);
+    rh->seq = st->next_record_seq;
+    rh->topic_len = (uint32_t) topic_len;
+    rh->payload_len = (uint32_t) payload_len;
+    store_flush(s, rh, record_len);
+
+    // the record becomes visible only once the header is committed
+    st->tail = offset + record_len;
+    st->count++;
+    st->next_record_seq++;
+    store_commit_header(s);
+    if (seq) {
+        *seq = rh->seq;
+    }
+    return IOTCL_SUCCESS;
+}
+
+bool iotc_store_peek(IotcOfflineStore *s, IotcStoreRecord *record) {
+    StoreRecordHeader *rh = store_head_record(s);
+    if (!rh) {
+        return false;
+    }
+    record->seq = rh->seq;
+    record->topic = (const char *) &rh[1];
+    record->payload = &record->topic[rh->topic_len];
+    record->payload_len = rh->payload_len;
+    return true;
+}
+
+void iotc_store_pop(IotcOfflineStore *s, uint64_t seq) {
+    StoreRecordHeader *rh = store_head_record(s);
+    if (!rh || rh->seq != seq) {
+        return; // already dropped to make room for newer messages
+    }
+    store_drop_head(s);
+    store_commit_header(s);
+}
+
+size_t iotc_store_count(IotcOfflineStore *s) {
+    return (size_t) s->state.count;
+}
+
+static bool store_map_file(IotcOfflineStore *s, const char *path, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER file_size;
+    s->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (s->file == INVALID_HANDLE_VALUE) {
+        IOTC_ERROR("Unable to open the offline store file %s", path);
+        return false;
+    }
+    if (!GetFileSizeEx(s->file, &file_size) || (size_t) file_size.QuadPart != size) {
+        file_size.QuadPart = (LONGLONG) size;
+        if (!SetFilePointerEx(s->file, file_size, NULL, FILE_BEGIN) || !SetEndOfFile(s->file)) {
+            IOTC_ERROR("Unable to resize the offline store file %s", path);
+            return false;
+        }
+    }
+    s->mapping = CreateFileMappingA(s->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (!s->mapping) {
+        IOTC_ERROR("Unable to map the offline store file %s", path);
+        return false;
+    }
+    s->map = (unsigned char *) MapViewOfFile(s->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!s->map) {
+        IOTC_ERROR("Unable to map the offline store file %s", path);
+        return false;
+    }
+#else
+    s->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (s->fd < 0) {
+        IOTC_ERROR("Unable to open the offline store file %s", path);
+        return false;
+    }
+    off_t file_size = lseek(s->fd, 0, SEEK_END);
+    if (file_size != (off_t) size && 0 != ftruncate(s->fd, (off_t) size)) {
+        IOTC_ERROR("Unable to resize the offline store file %s", path);
+        return false;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) {
+        IOTC_ERROR("Unable to map the offline store file %s", path);
+        return false;
+    }
+    s->map = (unsigned char *) map;
+#endif
+    s->map_size = size;
+    return true;
+}
+
+IotcOfflineStore *iotc_store_open(const char *path, size_t capacity) {
+    capacity = STORE_ALIGNED(capacity);
+    const size_t headers_size = STORE_HEADER_SLOTS * sizeof(StoreHeader);
+
+    IotcOfflineStore *s = calloc(1, sizeof(IotcOfflineStore));
+    if (!s) {
+        IOTC_ERROR("Out of memory while creating the offline store!");
+        return NULL;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    s->file = INVALID_HANDLE_VALUE;
+#else
+    s->fd = -1;
+#endif
+    crc32_init_table();
+
+    if (!store_map_file(s, path, headers_size + capacity)) {
+        iotc_store_close(s);
+        return NULL; // called function will print the error
+    }
+    s->data = s->map + headers_size;
+
+    const StoreHeader *current = NULL;
+    for (int i = 0; i < STORE_HEADER_SLOTS; i++) {
+        const StoreHeader *slot = &((const StoreHeader *) s->map)[i];
+        if (store_is_header_valid(slot, capacity) && (!current || slot->seq > current->seq)) {
+            current = slot;
+        }
+    }
+    if (current) {
+        memcpy(&s->state, current, sizeof(StoreHeader));
+        if (s->state.count > 0) {
+            IOTC_INFO("Offline store contains %lu messages from a previous session.", (unsigned long) s->state.count);
+        }
+    } else {
+        store_reset(s, capacity);
+    }
+    return s;
+}
+
+void iotc_store_close(IotcOfflineStore *s) {
+    if (!s) {
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (s->map) {
+        FlushViewOfFile(s->map, s->map_size);
+        UnmapViewOfFile(s->map);
+    }
+    if (s->mapping) {
+        CloseHandle(s->mapping);
+    }
+    if (s->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(s->file);
+    }
+#else
+    if (s->map) {
+        msync(s->map, s->map_size, MS_SYNC);
+        munmap(s->map, s->map_size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+#endif
+    free(s);
+}
@@ -0,0 +1,363 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700 // for clock_gettime and recursive mutexes with -std=c99
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "iotc_platform.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+
+uint64_t iotc_platform_now_ms(void) {
+    return (uint64_t) GetTickCount64();
+}
+
+uint64_t iotc_platform_now_us(void) {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000
+           + (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000 / (uint64_t) frequency.QuadPart;
+}
+
+void iotc_platform_sleep_ms(unsigned int ms) {
+    Sleep(ms);
+}
+
+void iotc_platform_mutex_init(IotcMutex *m) {
+    InitializeCriticalSection(m);
+}
+
+void iotc_platform_mutex_lock(IotcMutex *m) {
+    EnterCriticalSection(m);
+}
+
+void iotc_platform_mutex_unlock(IotcMutex *m) {
+    LeaveCriticalSection(m);
+}
+
+void iotc_platform_mutex_destroy(IotcMutex *m) {
+    DeleteCriticalSection(m);
+}
+
+void iotc_platform_cond_init(IotcCond *c) {
+    InitializeConditionVariable(c);
+}
+
+void iotc_platform_cond_wait(IotcCond *c, IotcMutex *m) {
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+
+bool iotc_platform_cond_timed_wait(IotcCond *c, IotcMutex *m, unsigned int timeout_ms) {
+    return SleepConditionVariableCS(c, m, timeout_ms < INFINITE ? timeout_ms : INFINITE - 1);
+}
+
+void iotc_platform_cond_signal(IotcCond *c) {
+    WakeConditionVariable(c);
+}
+
+void iotc_platform_cond_broadcast(IotcCond *c) {
+    WakeAllConditionVariable(c);
+}
+
+void iotc_platform_cond_destroy(IotcCond *c) {
+    (void) c; // nothing to free
+}
+
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+int iotc_platform_thread_create(IotcThread *t, void (*fn)(void *arg), void *arg) {
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    *t = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (!*t) {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void iotc_platform_thread_join(IotcThread *t) {
+    WaitForSingleObject(*t, INFINITE);
+    CloseHandle(*t);
+}
+
+struct IotcRwLock {
+    SRWLOCK lock;
+    bool is_exclusive;
+};
+
+IotcRwLock *iotc_platform_rwlock_create(void) {
+    IotcRwLock *l = calloc(1, sizeof(IotcRwLock));
+    if (l) {
+        InitializeSRWLock(&l->lock);
+    }
+    return l;
+}
+
+void iotc_platform_rwlock_read_lock(IotcRwLock *l) {
+    AcquireSRWLockShared(&l->lock);
+}
+
+void iotc_platform_rwlock_write_lock(IotcRwLock *l) {
+    AcquireSRWLockExclusive(&l->lock);
+    l->is_exclusive = true;
+}
+
+void iotc_platform_rwlock_unlock(IotcRwLock *l) {
+    if (l->is_exclusive) {
+        l->is_exclusive = false;
+        ReleaseSRWLockExclusive(&l->lock);
+    } else {
+        ReleaseSRWLockShared(&l->lock);
+    }
+}
+
+void iotc_platform_rwlock_destroy(IotcRwLock *l) {
+    free(l);
+}
+
+static BOOL CALLBACK once_trampoline(PINIT_ONCE once, PVOID param, PVOID *context) {
+    (void) once;
+    (void) context;
+    ((void (*)(void)) param)();
+    return TRUE;
+}
+
+void iotc_platform_once(IotcOnce *once, void (*fn)(void)) {
+    InitOnceExecuteOnce(once, once_trampoline, (PVOID) fn, NULL);
+}
+
+void iotc_platform_wakeup_init(IotcWakeup *w) {
+    w->read_fd = -1;
+    w->write_fd = -1;
+}
+
+int iotc_platform_wakeup_get_fd(IotcWakeup *w) {
+    return w->read_fd;
+}
+
+void iotc_platform_wakeup_signal(IotcWakeup *w) {
+    (void) w;
+}
+
+void iotc_platform_wakeup_clear(IotcWakeup *w) {
+    (void) w;
+}
+
+void iotc_platform_wakeup_destroy(IotcWakeup *w) {
+    (void) w;
+}
+
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t iotc_platform_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+uint64_t iotc_platform_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+void iotc_platform_sleep_ms(unsigned int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) && errno == EINTR) {
+        // continue with the remaining time
+    }
+}
+
+void iotc_platform_mutex_init(IotcMutex *m) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void iotc_platform_mutex_lock(IotcMutex *m) {
+    pthread_mutex_lock(m);
+}
+
+void iotc_platform_mutex_unlock(IotcMutex *m) {
+    pthread_mutex_unlock(m);
+}
+
+void iotc_platform_mutex_destroy(IotcMutex *m) {
+    pthread_mutex_destroy(m);
+}
+
+// Timed waits use the same clock as iotc_platform_now_ms()
+void iotc_platform_cond_init(IotcCond *c) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(c, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void iotc_platform_cond_wait(IotcCond *c, IotcMutex *m) {
+    pthread_cond_wait(c, m);
+}
+
+bool iotc_platform_cond_timed_wait(IotcCond *c, IotcMutex *m, unsigned int timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (time_t) (timeout_ms / 1000);
+    ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ETIMEDOUT != pthread_cond_timedwait(c, m, &ts);
+}
+
+void iotc_platform_cond_signal(IotcCond *c) {
+    pthread_cond_signal(c);
+}
+
+void iotc_platform_cond_broadcast(IotcCond *c) {
+    pthread_cond_broadcast(c);
+}
+
+void iotc_platform_cond_destroy(IotcCond *c) {
+    pthread_cond_destroy(c);
+}
+
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+} ThreadStart;
+
+static void *thread_trampoline(void *param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int iotc_platform_thread_create(IotcThread *t, void (*fn)(void *arg), void *arg) {
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    if (pthread_create(t, NULL, thread_trampoline, start)) {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void iotc_platform_thread_join(IotcThread *t) {
+    pthread_join(*t, NULL);
+}
+
+struct IotcRwLock {
+    pthread_rwlock_t lock;
+};
+
+IotcRwLock *iotc_platform_rwlock_create(void) {
+    IotcRwLock *l = malloc(sizeof(IotcRwLock));
+    if (l) {
+        pthread_rwlock_init(&l->lock, NULL);
+    }
+    return l;
+}
+
+void iotc_platform_rwlock_read_lock(IotcRwLock *l) {
+    pthread_rwlock_rdlock(&l->lock);
+}
+
+void iotc_platform_rwlock_write_lock(IotcRwLock *l) {
+    pthread_rwlock_wrlock(&l->lock);
+}
+
+void iotc_platform_rwlock_unlock(IotcRwLock *l) {
+    pthread_rwlock_unlock(&l->lock);
+}
+
+void iotc_platform_rwlock_destroy(IotcRwLock *l) {
+    pthread_rwlock_destroy(&l->lock);
+    free(l);
+}
+
+void iotc_platform_once(IotcOnce *once, void (*fn)(void)) {
+    pthread_once(once, fn);
+}
+
+void iotc_platform_wakeup_init(IotcWakeup *w) {
+    int fds[2];
+    w->read_fd = -1;
+    w->write_fd = -1;
+    if (pipe(fds)) {
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    w->read_fd = fds[0];
+    w->write_fd = fds[1];
+}
+
+int iotc_platform_wakeup_get_fd(IotcWakeup *w) {
+    return w->read_fd;
+}
+
+void iotc_platform_wakeup_signal(IotcWakeup *w) {
+    if (w->write_fd >= 0) {
+        const char c = 0;
+        ssize_t rc = write(w->write_fd, &c, 1); // if the pipe is full, it is readable already
+        (void) rc;
+    }
+}
+
+void iotc_platform_wakeup_clear(IotcWakeup *w) {
+    char buffer[64];
+    while (w->read_fd >= 0 && read(w->read_fd, buffer, sizeof(buffer)) > 0) {
+        // drain all signals so far
+    }
+}
+
+void iotc_platform_wakeup_destroy(IotcWakeup *w) {
+    if (w->read_fd >= 0) {
+        close(w->read_fd);
+        close(w->write_fd);
+    }
+    w->read_fd = -1;
+    w->write_fd = -1;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <string.h>
+#include "iotc_platform.h"
+#include "iotc_rate_limiter.h"
+
+void iotc_rate_init(IotcRateLimiter *r, const IotConnectRateLimitConfig *config) {
+    memset(r, 0, sizeof(IotcRateLimiter));
+    if (config) {
+        r->config = *config;
+    }
+    // one second worth of burst by default
+    if (0 == r->config.burst_messages) {
+        r->config.burst_messages = r->config.messages_per_s;
+    }
+    if (0 == r->config.burst_bytes) {
+        r->config.burst_bytes = r->config.bytes_per_s;
+    }
+    // start full, so that there's no delay after connecting
+    r->message_tokens = (double) r->config.burst_messages;
+    r->byte_tokens = (double) r->config.burst_bytes;
+    r->last_refill_us = iotc_platform_now_us();
+}
+
+bool iotc_rate_is_enabled(const IotcRateLimiter *r) {
+    return r->config.messages_per_s > 0 || r->config.bytes_per_s > 0;
+}
+
+static void rate_refill(IotcRateLimiter *r) {
+    const uint64_t now = iotc_platform_now_us();
+    const double elapsed_s = (double) (now - r->last_refill_us) / 1000000.0;
+    r->last_refill_us = now;
+    if (r->config.messages_per_s > 0) {
+        r->message_tokens += elapsed_s * r->config.messages_per_s;
+        if (r->message_tokens > r->config.burst_messages) {
+            r->message_tokens = r->config.burst_messages;
+        }
+    }
+    if (r->config.bytes_per_s > 0) {
+        r->byte_tokens += elapsed_s * (double) r->config.bytes_per_s;
+        if (r->byte_tokens > (double) r->config.burst_bytes) {
+            r->byte_tokens = (double) r->config.burst_bytes;
+        }
+    }
+}
+
+// Bytes that need to be available to send a message of this size
+static double rate_bytes_needed(const IotcRateLimiter *r, size_t size) {
+    return (double) (size < r->config.burst_bytes ? size : r->config.burst_bytes);
+}
+
+bool iotc_rate_take(IotcRateLimiter *r, size_t size) {
+    if (iotc_rate_delay_us(r, size) > 0) {
+        return false;
+    }
+    if (r->config.messages_per_s > 0) {
+        r->message_tokens -= 1.0;
+    }
+    if (r->config.bytes_per_s > 0) {
+        r->byte_tokens -= (double) size;
+    }
+    return true;
+}
+
+uint64_t iotc_rate_delay_us(IotcRateLimiter *r, size_t size) {
+    rate_refill(r);
+    double delay_s = 0;
+    if (r->config.messages_per_s > 0 && r->message_tokens < 1.0) {
+        delay_s = (1.0 - r->message_tokens) / r->config.messages_per_s;
+    }
+    if (r->config.bytes_per_s > 0) {
+        const double needed = rate_bytes_needed(r, size);
+        if (r->byte_tokens < needed) {
+            const double bytes_delay_s = (needed - r->byte_tokens) / (double) r->config.bytes_per_s;
+            if (bytes_delay_s > delay_s) {
+                delay_s = bytes_delay_s;
+            }
+        }
+    }
+    if (delay_s <= 0) {
+        return 0;
+    }
+    const uint64_t delay_us = (uint64_t) (delay_s * 1000000.0);
+    return delay_us > 0 ? delay_us : 1;
+}
+
+void iotc_rate_get_fill(IotcRateLimiter *r, double *message_fill, double *byte_fill) {
+    rate_refill(r);
+    *message_fill = 1.0;
+    *byte_fill = 1.0;
+    if (r->config.messages_per_s > 0 && r->config.burst_messages > 0) {
+        *message_fill = r->message_tokens / r->config.burst_messages;
+    }
+    if (r->config.bytes_per_s > 0 && r->config.burst_bytes > 0) {
+        *byte_fill = r->byte_tokens > 0 ? r->byte_tokens / (double) r->config.burst_bytes : 0;
+    }
+}
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_codec.h"
+#include "iotc_crypto.h"
+#include "iotc_sas_token.h"
+
+// SharedAccessSignature sr={URL-encoded-resourceURI}&sig={signature-string}&se={expiry}
+// URL-encoded-resourceURI: myHub.azure-devices.net/devices/mydevice
+// signature-string: base64 HMAC-SHA256 of {URL-encoded-resourceURI} + "\n" + expiry, URL-encoded
+#define SAS_RESOURCE_URI_FORMAT "%s/devices/%s"
+#define SAS_TOKEN_FORMAT "SharedAccessSignature sr=%s&sig=%s&se=%lu"
+
+#define SAS_EXPIRY_MAX_LEN 20 // digits of an unsigned long
+#define SAS_B64_DIGEST_LEN 44 // base64 of a SHA-256 digest
+#define SAS_MAX_SIG_LEN (SAS_B64_DIGEST_LEN * 3) // if every character was escaped
+
+struct IotcSasToken {
+    IotcMutex lock;
+    IotcHmacSha256 hmac;
+    char *encoded_resource_uri;
+    unsigned int lifetime_s;
+    unsigned long expiry; // of the current token, zero if none was issued yet
+    char token[IOTC_SAS_TOKEN_MAX_LEN];
+};
+
+// Must be called with the lock held
+static void sas_issue(IotcSasToken *t, unsigned long now) {
+    char string_to_sign[IOTC_SAS_TOKEN_MAX_LEN];
+    unsigned char digest[IOTC_SHA256_SIZE];
+    char b64_digest[SAS_B64_DIGEST_LEN + 1];
+    char sig[SAS_MAX_SIG_LEN + 1];
+    const unsigned long expiry = now + t->lifetime_s;
+    const int len = snprintf(string_to_sign, sizeof(string_to_sign), "%s\n%lu", t->encoded_resource_uri, expiry);
+    if (!iotc_hmac_sha256_compute(&t->hmac, string_to_sign, (size_t) len, digest)) {
+        return; // keep the current token
+    }
+
+    const size_t b64_len = iotc_base64_encode(digest, sizeof(digest), b64_digest);
+    iotc_uri_encode(b64_digest, b64_len, sig);
+    snprintf(t->token, sizeof(t->token), SAS_TOKEN_FORMAT, t->encoded_resource_uri, sig, expiry);
+    t->expiry = expiry;
+}
+
+// Renewed once less than a quarter of the lifetime remains
+static bool sas_is_due(const IotcSasToken *t, unsigned long now) {
+    return 0 == t->expiry || now + t->lifetime_s / 4 >= t->expiry;
+}
+
+IotcSasToken *iotc_sas_token_create(const char *host, const char *client_id, const char *b64key,
+                                    unsigned int lifetime_s) {
+    unsigned char key[256];
+    if (!host || !client_id || !b64key) {
+        IOTC_ERROR("SAS token: Host, client ID and key are required!");
+        return NULL;
+    }
+    const long key_len = iotc_base64_decode(b64key, strlen(b64key), key, sizeof(key));
+    if (key_len <= 0) {
+        IOTC_ERROR("SAS token: The symmetric key is not valid base64!");
+        return NULL;
+    }
+    const size_t resource_uri_len = strlen(host) + strlen(client_id) + strlen(SAS_RESOURCE_URI_FORMAT);
+    if (sizeof(SAS_TOKEN_FORMAT) + 3 * resource_uri_len + SAS_MAX_SIG_LEN + SAS_EXPIRY_MAX_LEN
+        > IOTC_SAS_TOKEN_MAX_LEN) {
+        IOTC_ERROR("SAS token: Host and client ID are too long!");
+        return NULL;
+    }
+    IotcSasToken *t = calloc(1, sizeof(IotcSasToken));
+    char *resource_uri = malloc(resource_uri_len + 1);
+    if (t) {
+        t->encoded_resource_uri = malloc(3 * resource_uri_len + 1);
+    }
+    if (!t || !resource_uri || !t->encoded_resource_uri) {
+        IOTC_ERROR("SAS token: Out of memory!");
+        if (t) free(t->encoded_resource_uri);
+        free(resource_uri);
+        free(t);
+        return NULL;
+    }
+    sprintf(resource_uri, SAS_RESOURCE_URI_FORMAT, host, client_id);
+    iotc_uri_encode(resource_uri, strlen(resource_uri), t->encoded_resource_uri);
+    free(resource_uri);
+    const bool is_key_loaded = iotc_hmac_sha256_init(&t->hmac, key, (size_t) key_len);
+    memset(key, 0, sizeof(key));
+    if (!is_key_loaded) {
+        free(t->encoded_resource_uri);
+        free(t);
+        return NULL;
+    }
+    t->lifetime_s = lifetime_s > 0 ? lifetime_s : 1;
+    iotc_platform_mutex_init(&t->lock);
+    return t;
+}
+
+bool iotc_sas_token_get(IotcSasToken *t, char *buffer, size_t size) {
+    iotc_platform_mutex_lock(&t->lock);
+    const unsigned long now = (unsigned long) time(NULL);
+    if (sas_is_due(t, now)) {
+        sas_issue(t, now);
+    }
+    const size_t len = strlen(t->token);
+    const bool fits = len > 0 && len < size; // empty if the backend failed to issue the first one
+    if (fits) {
+        memcpy(buffer, t->token, len + 1);
+    }
+    iotc_platform_mutex_unlock(&t->lock);
+    return fits;
+}
+
+void iotc_sas_token_renew_due(IotcSasToken *t) {
+    iotc_platform_mutex_lock(&t->lock);
+    const unsigned long now = (unsigned long) time(NULL);
+    if (sas_is_due(t, now)) {
+        sas_issue(t, now);
+    }
+    iotc_platform_mutex_unlock(&t->lock);
+}
+
+void iotc_sas_token_destroy(IotcSasToken *t) {
+    if (!t) {
+        return;
+    }
+    iotc_platform_mutex_destroy(&t->lock);
+    free(t->encoded_resource_uri);
+    iotc_hmac_sha256_deinit(&t->hmac);
+    memset(t, 0, sizeof(IotcSasToken));
+    free(t);
+}
@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "iotc_platform.h"
+#include "iotc_sha256.h"
+
+// The SHA extensions path needs GCC or Clang for the target attribute and <cpuid.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(IOTC_SHA256_SCALAR_ONLY)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_blocks_scalar(uint32_t state[8], const unsigned char *data, size_t num_blocks) {
+    uint32_t w[64];
+    for (; num_blocks > 0; num_blocks--, data += IOTC_SHA256_BLOCK_SIZE) {
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t) data[i * 4] << 24) | ((uint32_t) data[i * 4 + 1] << 16)
+                   | ((uint32_t) data[i * 4 + 2] << 8) | (uint32_t) data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            const uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            const uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g))
+                                + k[i] + w[i];
+            const uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if SHA256_X86
+
+// Four rounds per step with the state kept as ABEF and CDGH, as the SHA extensions expect. The message
+// schedule for step i + 4 is computed from the four previous steps, in place of step i.
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_sha_ni(uint32_t state[8], const unsigned char *data, size_t num_blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xB1);
+    const __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1B);
+    __m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+    for (; num_blocks > 0; num_blocks--, data += IOTC_SHA256_BLOCK_SIZE) {
+        const __m128i abef_save = abef;
+        const __m128i cdgh_save = cdgh;
+        __m128i m[4];
+        for (int i = 0; i < 4; i++) {
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &data[i * 16]), byte_swap);
+        }
+        // unrolled so that m[] stays in registers
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            const __m128i wk = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *) &k[i * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+            if (i < 12) {
+                __m128i w = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+                m[i & 3] = _mm_sha256msg2_epu32(w, m[(i + 3) & 3]);
+            }
+        }
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+    const __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    const __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+static bool sha256_cpu_has_sha_ni(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return 0 != (ebx & (1u << 29)); // SHA in leaf 7, EBX
+}
+
+#endif // SHA256_X86
+
+static void (*sha256_blocks)(uint32_t state[8], const unsigned char *data, size_t num_blocks)
+    = sha256_blocks_scalar;
+static IotcOnce sha256_once = IOTC_ONCE_INIT;
+
+static void sha256_select_blocks(void) {
+#if SHA256_X86
+    if (sha256_cpu_has_sha_ni()) {
+        sha256_blocks = sha256_blocks_sha_ni;
+    }
+#endif
+}
+
+void iotc_sha256_init(IotcSha256 *s) {
+    iotc_platform_once(&sha256_once, sha256_select_blocks);
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(s->state, initial, sizeof(initial));
+    s->length = 0;
+    s->block_len = 0;
+}
+
+void iotc_sha256_update(IotcSha256 *s, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    s->length += len;
+    if (s->block_len > 0) {
+        const size_t space = IOTC_SHA256_BLOCK_SIZE - s->block_len;
+        const size_t n = len < space ? len : space;
+        memcpy(&s->block[s->block_len], p, n);
+        s->block_len += n;
+        p += n;
+        len -= n;
+        if (s->block_len < IOTC_SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_blocks(s->state, s->block, 1);
+        s->block_len = 0;
+    }
+    // whole blocks are hashed straight from the input
+    const size_t num_blocks = len / IOTC_SHA256_BLOCK_SIZE;
+    sha256_blocks(s->state, p, num_blocks);
+    p += num_blocks * IOTC_SHA256_BLOCK_SIZE;
+    len -= num_blocks * IOTC_SHA256_BLOCK_SIZE;
+    memcpy(s->block, p, len);
+    s->block_len = len;
+}
+
+void iotc_sha256_final(IotcSha256 *s, unsigned char digest[IOTC_SHA256_SIZE]) {
+    const uint64_t bit_length = s->length * 8;
+    s->block[s->block_len++] = 0x80;
+    if (s->block_len > IOTC_SHA256_BLOCK_SIZE - 8) {
+        memset(&s->block[s->block_len], 0, IOTC_SHA256_BLOCK_SIZE - s->block_len);
+        sha256_blocks(s->state, s->block, 1);
+        s->block_len = 0;
+    }
+    memset(&s->block[s->block_len], 0, IOTC_SHA256_BLOCK_SIZE - 8 - s->block_len);
+    for (int i = 0; i < 8; i++) {
+        s->block[IOTC_SHA256_BLOCK_SIZE - 1 - i] = (unsigned char) (bit_length >> (i * 8));
+    }
+    sha256_blocks(s->state, s->block, 1);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char) (s->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char) (s->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char) (s->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char) s->state[i];
+    }
+}
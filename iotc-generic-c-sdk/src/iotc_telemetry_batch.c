@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_platform.h"
+#include "iotc_telemetry_batch.h"
+
+// The serialized telemetry has all records in the "d" array: {"d":[{"dt":...,"d":{...}}, ...]}
+#define BATCH_ENVELOPE_START "{\"d\":["
+#define BATCH_ENVELOPE_END "]}"
+
+#define BATCH_ENVELOPE_START_LEN (sizeof(BATCH_ENVELOPE_START) - 1)
+#define BATCH_ENVELOPE_END_LEN (sizeof(BATCH_ENVELOPE_END) - 1)
+
+// Inserted at the start of records without a timestamp, in the same format as iotc-c-lib uses
+#define BATCH_TIMESTAMP_FORMAT "\"dt\":\"%04d-%02d-%02dT%02d:%02d:%02d.000Z\""
+#define BATCH_TIMESTAMP_LEN (sizeof("\"dt\":\"2024-01-01T00:00:00.000Z\"") - 1)
+
+#ifndef IOTC_BATCH_INITIAL_CAPACITY
+#define IOTC_BATCH_INITIAL_CAPACITY 1024
+#endif
+
+void iotc_batch_init(IotcTelemetryBatch *b, const IotConnectBatchConfig *config, IotcBatchFlushCallback flush_cb,
+                     void *context) {
+    memset(b, 0, sizeof(IotcTelemetryBatch));
+    if (config) {
+        b->config = *config;
+    }
+    b->flush_cb = flush_cb;
+    b->context = context;
+}
+
+bool iotc_batch_is_enabled(IotcTelemetryBatch *b) {
+    return b->config.max_records > 0 || b->config.max_size > 0 || b->config.max_latency_ms > 0;
+}
+
+// ensure that we can fit "needed" bytes in total
+static int batch_reserve(IotcTelemetryBatch *b, size_t needed) {
+    if (needed <= b->capacity) {
+        return IOTCL_SUCCESS;
+    }
+    size_t new_capacity = b->capacity ? b->capacity : IOTC_BATCH_INITIAL_CAPACITY;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    char *ptr = realloc(b->buffer, new_capacity);
+    if (!ptr) {
+        IOTC_ERROR("Out of memory while growing the telemetry batch!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    if (!b->buffer) {
+        memcpy(ptr, BATCH_ENVELOPE_START, BATCH_ENVELOPE_START_LEN);
+        b->len = BATCH_ENVELOPE_START_LEN;
+    }
+    b->buffer = ptr;
+    b->capacity = new_capacity;
+    return IOTCL_SUCCESS;
+}
+
+// Returns the length of the JSON object at the start of s, or zero if it is not a complete object.
+// has_dt is set if the object has a top level "dt" key.
+static size_t scan_record(const char *s, size_t len, bool *has_dt) {
+    int depth = 0;
+    bool in_string = false;
+    bool is_escaped = false;
+    bool is_key = false;
+    bool expect_key = false;
+    size_t key_start = 0;
+    *has_dt = false;
+    if (0 == len || s[0] != '{') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        const char c = s[i];
+        if (in_string) {
+            if (is_escaped) {
+                is_escaped = false;
+            } else if (c == '\\') {
+                is_escaped = true;
+            } else if (c == '"') {
+                in_string = false;
+                if (is_key && i - key_start == 2 && 0 == memcmp(&s[key_start], "dt", 2)) {
+                    *has_dt = true;
+                }
+            }
+            continue;
+        }
+        switch (c) {
+            case '"':
+                in_string = true;
+                is_key = expect_key;
+                expect_key = false;
+                key_start = i + 1;
+                break;
+            case '{':
+            case '[':
+                depth++;
+                expect_key = c == '{' && 1 == depth;
+                break;
+            case '}':
+            case ']':
+                if (0 == --depth) {
+                    return i + 1;
+                }
+                break;
+            case ',':
+                expect_key = 1 == depth;
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+// Skips the whitespace and the comma between records
+static size_t skip_separator(const char *s, size_t len, size_t pos) {
+    while (pos < len && (s[pos] == ',' || s[pos] == ' ' || s[pos] == '\n' || s[pos] == '\r'
+                         || s[pos] == '\t')) {
+        pos++;
+    }
+    return pos;
+}
+
+// Civil date from days since 1970-01-01. See http://howardhinnant.github.io/date_algorithms.html
+// Unlike gmtime(), this is thread safe on all platforms.
+static void format_timestamp(char *out, time_t t) {
+    long long secs = (long long) t;
+    long long days = secs / 86400;
+    long long rem = secs % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        days--;
+    }
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const long long doe = days - era * 146097;
+    const long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const long long mp = (5 * doy + 2) / 153;
+    const int day = (int) (doy - (153 * mp + 2) / 5 + 1);
+    const int month = (int) (mp < 10 ? mp + 3 : mp - 9);
+    const int year = (int) (yoe + era * 400 + (month <= 2));
+    snprintf(out, BATCH_TIMESTAMP_LEN + 1, BATCH_TIMESTAMP_FORMAT, year, month, day, (int) (rem / 3600),
+             (int) (rem / 60 % 60), (int) (rem % 60));
+}
+
+int iotc_batch_add(IotcTelemetryBatch *b, const char *json_str, time_t timestamp) {
+    const size_t json_len = strlen(json_str);
+    if (json_len < BATCH_ENVELOPE_START_LEN + BATCH_ENVELOPE_END_LEN
+        || 0 != strncmp(json_str, BATCH_ENVELOPE_START, BATCH_ENVELOPE_START_LEN)
+        || 0 != strcmp(&json_str[json_len - BATCH_ENVELOPE_END_LEN], BATCH_ENVELOPE_END)) {
+        IOTC_ERROR("Unable to batch telemetry. Unexpected message format: %s", json_str);
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    const char *records = &json_str[BATCH_ENVELOPE_START_LEN];
+    const size_t records_len = json_len - BATCH_ENVELOPE_START_LEN - BATCH_ENVELOPE_END_LEN;
+    if (0 == records_len) {
+        return IOTCL_SUCCESS; // nothing to add
+    }
+
+    // records without a timestamp would all get the time of the batch, so they get the time they were added
+    size_t added_len = records_len;
+    bool has_dt;
+    for (size_t pos = skip_separator(records, records_len, 0); pos < records_len;
+         pos = skip_separator(records, records_len, pos)) {
+        const size_t len = scan_record(&records[pos], records_len - pos, &has_dt);
+        if (0 == len) {
+            IOTC_ERROR("Unable to batch telemetry. Unexpected record format: %s", json_str);
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+        if (!has_dt) {
+            added_len += BATCH_TIMESTAMP_LEN + 1; // and a comma, unless the record is empty
+        }
+        pos += len;
+    }
+
+    // +1 for the comma separator
+    if (b->num_records > 0 && b->config.max_size > 0
+        && b->len + 1 + added_len + BATCH_ENVELOPE_END_LEN > b->config.max_size) {
+        iotc_batch_flush(b);
+    }
+
+    // reserve space for the separator, envelope end and NUL as well
+    int status = batch_reserve(b, b->len + 1 + added_len + BATCH_ENVELOPE_END_LEN + 1);
+    if (status) {
+        return status; // called function will print the error
+    }
+
+    char dt[BATCH_TIMESTAMP_LEN + 1];
+    format_timestamp(dt, timestamp);
+    for (size_t pos = skip_separator(records, records_len, 0); pos < records_len;
+         pos = skip_separator(records, records_len, pos)) {
+        const size_t len = scan_record(&records[pos], records_len - pos, &has_dt);
+        // a message with many records is split, so that no batch has more than max_records
+        if (b->config.max_records > 0 && b->num_records >= b->config.max_records) {
+            iotc_batch_flush(b);
+        }
+        if (0 == b->num_records) {
+            b->first_record_ms = iotc_platform_now_ms();
+        } else {
+            b->buffer[b->len++] = ',';
+        }
+        if (has_dt) {
+            memcpy(&b->buffer[b->len], &records[pos], len);
+            b->len += len;
+        } else {
+            b->buffer[b->len++] = '{';
+            memcpy(&b->buffer[b->len], dt, BATCH_TIMESTAMP_LEN);
+            b->len += BATCH_TIMESTAMP_LEN;
+            if (len > 2) {
+                b->buffer[b->len++] = ',';
+            }
+            memcpy(&b->buffer[b->len], &records[pos + 1], len - 1);
+            b->len += len - 1;
+        }
+        b->num_records++;
+        pos += len;
+    }
+
+    if (b->config.max_records > 0 && b->num_records >= b->config.max_records) {
+        iotc_batch_flush(b);
+    } else {
+        iotc_batch_poll(b);
+    }
+    return IOTCL_SUCCESS;
+}
+
+void iotc_batch_flush(IotcTelemetryBatch *b) {
+    if (0 == b->num_records) {
+        return;
+    }
+    // batch_reserve() always left room for this
+    memcpy(&b->buffer[b->len], BATCH_ENVELOPE_END, BATCH_ENVELOPE_END_LEN);
+    b->len += BATCH_ENVELOPE_END_LEN;
+    b->buffer[b->len] = 0;
+
+    if (b->flush_cb) {
+        b->flush_cb(b->context, b->buffer, b->len);
+    }
+
+    b->len = BATCH_ENVELOPE_START_LEN;
+    b->num_records = 0;
+}
+
+void iotc_batch_poll(IotcTelemetryBatch *b) {
+    if (0 == b->num_records || 0 == b->config.max_latency_ms) {
+        return;
+    }
+    if (iotc_platform_now_ms() - b->first_record_ms >= b->config.max_latency_ms) {
+        iotc_batch_flush(b);
+    }
+}
+
+void iotc_batch_deinit(IotcTelemetryBatch *b) {
+    free(b->buffer);
+    memset(b, 0, sizeof(IotcTelemetryBatch));
+}
@@ -3,7 +3,9 @@
  * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
  */
 
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "iotcl_util.h"
 #include "iotcl_dra_url.h"
@@ -12,36 +14,349 @@
 #include "iotc_log.h"
 #include "iotc_http_request.h"
 #include "iotc_device_client.h"
+#include "iotc_engine.h"
+#include "iotc_telemetry_batch.h"
+#include "iotc_offline_store.h"
+#include "iotc_c2d_dispatch.h"
+#include "iotc_compression.h"
+#include "iotc_rate_limiter.h"
+#include "iotc_link_estimator.h"
+#include "iotc_identity_cache.h"
+#include "iotc_dns_cache.h"
+#include "iotc_sas_token.h"
+#include "iotc_platform.h"
 #include "iotconnect.h"
 
-static IotConnectClientConfig config = {0};
-static bool is_config_valid = false;
+// C2D message types ("ct") of the IoTConnect 2.1 protocol that invoke application callbacks
+#define C2D_CT_COMMAND 0
+#define C2D_CT_OTA 1
 
-static int iotconnect_clone_client_config(IotConnectClientConfig* c) {
+#ifndef IOTC_DEFAULT_OFFLINE_STORE_SIZE
+#define IOTC_DEFAULT_OFFLINE_STORE_SIZE (1024 * 1024)
+#endif
+
+#ifndef IOTC_DEFAULT_RECONNECT_MIN_DELAY_MS
+#define IOTC_DEFAULT_RECONNECT_MIN_DELAY_MS 1000
+#endif
+
+#ifndef IOTC_DEFAULT_RECONNECT_MAX_DELAY_MS
+#define IOTC_DEFAULT_RECONNECT_MAX_DELAY_MS (2 * 60 * 1000)
+#endif
+
+#ifndef IOTC_DEFAULT_COMPRESSION_MIN_SIZE
+#define IOTC_DEFAULT_COMPRESSION_MIN_SIZE 128
+#endif
+
+#ifndef IOTC_DEFAULT_RATE_LIMIT_QUEUE_SIZE
+#define IOTC_DEFAULT_RATE_LIMIT_QUEUE_SIZE (64 * 1024)
+#endif
+
+#ifndef IOTC_DEFAULT_CONTROL_WEIGHT
+#define IOTC_DEFAULT_CONTROL_WEIGHT 4
+#endif
+
+#ifndef IOTC_DEFAULT_C2D_QUEUE_SIZE
+#define IOTC_DEFAULT_C2D_QUEUE_SIZE 16
+#endif
+
+#ifndef IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_RECORDS
+#define IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_RECORDS 100
+#endif
+
+#ifndef IOTC_DEFAULT_ADAPTIVE_MIN_BATCH_LATENCY_MS
+#define IOTC_DEFAULT_ADAPTIVE_MIN_BATCH_LATENCY_MS 100
+#endif
+
+#ifndef IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_LATENCY_MS
+#define IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_LATENCY_MS 10000
+#endif
+
+#ifndef IOTC_DEFAULT_IDENTITY_CACHE_TTL_S
+#define IOTC_DEFAULT_IDENTITY_CACHE_TTL_S (24 * 60 * 60)
+#endif
+
+#ifndef IOTC_DEFAULT_SAS_TOKEN_LIFETIME_S
+#define IOTC_DEFAULT_SAS_TOKEN_LIFETIME_S 60
+#endif
+
+#ifndef IOTC_DEFAULT_DNS_CACHE_TTL_S
+#define IOTC_DEFAULT_DNS_CACHE_TTL_S (5 * 60)
+#endif
+
+#define IOTC_MQTT_PORT "8883"
+
+#ifndef IOTC_DEFAULT_QOS0_MAX_LOSS_PCT
+#define IOTC_DEFAULT_QOS0_MAX_LOSS_PCT 5
+#endif
+
+// A sent message whose outcome has not been reported yet
+typedef struct {
+    IotConnectMessageId id;
+    uint64_t enqueued_us;
+    size_t size;
+    uint64_t store_seq; // non-zero while the message is waiting in the offline store
+    uint64_t sent_us; // when the message was last handed to the MQTT client
+    int qos;
+} PendingDelivery;
+
+// See IotConnectLaneConfig
+typedef enum {
+    LANE_CONTROL = 0,
+    LANE_TELEMETRY,
+    LANE_COUNT
+} OutboundLane;
+
+// A message waiting for the rate limiter
+typedef struct RateQueued {
+    struct RateQueued *next;
+    IotConnectMessageId id;
+    char *topic; // points into the same allocation, after the payload
+    size_t payload_len;
+    unsigned char payload[];
+} RateQueued;
+
+typedef struct {
+    RateQueued *head;
+    RateQueued *tail;
+    size_t num_messages;
+    size_t num_bytes;
+} RateLane;
+
+// See IotConnectConnectOp
+typedef enum {
+    OP_CREATE = 0, // iotconnect_client_start()
+    OP_CONNECT, // iotconnect_client_start_connect()
+    OP_RECONNECT // automatic reconnect, owned by the client
+} ConnectOpKind;
+
+struct IotConnectConnectOp {
+    ConnectOpKind kind;
+    IotConnectClient *client; // NULL once a failed create destroyed the client
+    IotcThread thread;
+    IotcMutex lock; // protects the fields below
+    IotConnectConnectPhase phase;
+    bool is_done;
+    int status;
+    IotcWakeup wakeup; // signalled on phase changes
+};
+
+// Each client represents one device
+struct IotConnectClient {
+    IotConnectClientConfig config;
+    IotConnectMqttIdentity mqtt; // this device's copy of the MQTT configuration from the identity response
+    bool is_identity_cached; // mqtt came from the identity cache and was not confirmed by connecting yet
+    IotcSasToken *sas_token; // for the mqtt identity with symmetric key authentication. Protected by library_lock.
+    IotConnectConnectOp *connect_op; // connecting in the background, if not NULL
+    IotcDeviceClient *device_client; // the client's own paho client, or
+    IotcEngineSession *engine_session; // a connection on the engine, if configured
+    IotcDispatcher *c2d_dispatcher; // runs command and OTA callbacks, unless they run on the receive thread
+    IotcTelemetryBatch telemetry_batch;
+    IotcCompressor *compressor; // for batched telemetry, if enabled
+    IotConnectMessageId batch_message_id; // assigned once the current batch has a record
+    uint64_t batch_enqueued_us;
+    IotConnectMessageId last_batch_message_id; // of the most recently flushed batch
+
+    // Protects the state below, which is accessed from both the application and the paho thread
+    IotcMutex state_lock;
+
+    IotcOfflineStore *offline_store;
+    bool is_draining; // only one thread can send stored messages at a time
+    char *drain_buffer; // stored message is copied here so that it can be sent without holding the lock
+    size_t drain_buffer_size;
+
+    bool is_reconnect_pending;
+    unsigned int reconnect_attempt;
+    uint64_t reconnect_at_ms;
+    uint32_t jitter_state; // xorshift state for the reconnect jitter. rand() is not thread safe.
+
+    IotcRateLimiter rate_limiter;
+    bool is_rate_draining; // only one thread can send rate limited messages at a time
+    RateLane rate_lanes[LANE_COUNT];
+    unsigned int control_streak; // control messages sent in a row while telemetry was waiting
+
+    IotcLinkEstimator link;
+
+    IotConnectMessageId next_message_id;
+    PendingDelivery *deliveries; // in the order the messages were sent or stored
+    size_t num_deliveries;
+    size_t deliveries_capacity;
+};
+
+// iotc-c-lib has a single process-wide configuration, which is shared by all clients.
+// It is initialized with the first client and deinitialized with the last one.
+// Identity responses overwrite its MQTT configuration, so that is done with the write lock held, and each client
+// keeps its own copy. Inbound messages are processed with the read lock held.
+static IotcOnce library_once = IOTC_ONCE_INIT;
+static IotcRwLock *library_lock = NULL;
+static int library_refcount = 0; // protected by library_lock
+static char *library_cpid = NULL;
+static char *library_duid = NULL;
+// Discovery and identity requests of all clients reuse its connections. Protected by library_lock.
+static IotcHttpContext *library_http = NULL;
+static bool library_is_dns_cached = false; // protected by library_lock
+
+// The read lock is not recursive on all platforms, but user callbacks invoked with it held can call back into the SDK
+static IOTC_THREAD_LOCAL int library_read_depth = 0;
+
+// The client whose callback is being invoked on this thread. iotc-c-lib callbacks have no context.
+static IOTC_THREAD_LOCAL IotConnectClient *current_client = NULL;
+
+// The client used by the iotconnect_sdk_* functions
+static IotConnectClient *default_client = NULL;
+static IotConnectConnectOp *default_op = NULL; // creating default_client with iotconnect_sdk_start()
+
+static IotConnectClient *enter_client(IotConnectClient *client) {
+    IotConnectClient *previous = current_client;
+    current_client = client;
+    return previous;
+}
+
+static void leave_client(IotConnectClient *previous) {
+    current_client = previous;
+}
+
+// Called on the thread that is connecting. The final phase is set once the op's thread is done.
+static void connect_op_set_phase(IotConnectConnectOp *op, IotConnectConnectPhase phase) {
+    if (IOTC_CP_CONNECTED == phase || IOTC_CP_FAILED == phase) {
+        return;
+    }
+    iotc_platform_mutex_lock(&op->lock);
+    op->phase = phase;
+    iotc_platform_wakeup_signal(&op->wakeup);
+    iotc_platform_mutex_unlock(&op->lock);
+}
+
+// Reports connect progress to the application, and to the op that is connecting the client
+static void report_phase(IotConnectClient *client, IotConnectConnectPhase phase) {
+    if (client->connect_op) {
+        connect_op_set_phase(client->connect_op, phase);
+    }
+    if (client->config.phase_cb) {
+        IotConnectClient *previous = enter_client(client);
+        client->config.phase_cb(phase);
+        leave_client(previous);
+    }
+}
+
+static void library_read_lock(void) {
+    if (0 == library_read_depth++) {
+        iotc_platform_rwlock_read_lock(library_lock);
+    }
+}
+
+static void library_read_unlock(void) {
+    if (0 == --library_read_depth) {
+        iotc_platform_rwlock_unlock(library_lock);
+    }
+}
+
+// Releases the read lock held by this thread while a command or OTA callback runs, so that a slow callback
+// does not hold up identity refreshes. Returns the depth for library_read_resume().
+static int library_read_suspend(void) {
+    const int depth = library_read_depth;
+    if (depth > 0) {
+        library_read_depth = 0;
+        iotc_platform_rwlock_unlock(library_lock);
+    }
+    return depth;
+}
+
+static void library_read_resume(int depth) {
+    if (depth > 0) {
+        iotc_platform_rwlock_read_lock(library_lock);
+        library_read_depth = depth;
+    }
+}
+
+static void free_mqtt_identity(IotConnectMqttIdentity *mqtt) {
+    if (mqtt->host) iotcl_free(mqtt->host);
+    if (mqtt->client_id) iotcl_free(mqtt->client_id);
+    if (mqtt->username) iotcl_free(mqtt->username);
+    if (mqtt->pub_rpt) iotcl_free(mqtt->pub_rpt);
+    if (mqtt->pub_ack) iotcl_free(mqtt->pub_ack);
+    if (mqtt->sub_c2d) iotcl_free(mqtt->sub_c2d);
+    memset(mqtt, 0, sizeof(IotConnectMqttIdentity));
+}
+
+// Must be called with the library write lock held, right after the identity response is applied to iotc-c-lib
+static int copy_mqtt_identity(IotConnectClient *client) {
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (!mc) {
+        return IOTCL_ERR_CONFIG_MISSING; // called function will print the error
+    }
+    free_mqtt_identity(&client->mqtt);
+    client->mqtt.host = iotcl_strdup(mc->host);
+    client->mqtt.client_id = iotcl_strdup(mc->client_id);
+    client->mqtt.username = iotcl_strdup(mc->username);
+    client->mqtt.pub_rpt = iotcl_strdup(mc->pub_rpt);
+    client->mqtt.pub_ack = iotcl_strdup(mc->pub_ack);
+    client->mqtt.sub_c2d = iotcl_strdup(mc->sub_c2d);
+    if ((!client->mqtt.host && mc->host)
+        || (!client->mqtt.client_id && mc->client_id)
+        || (!client->mqtt.username && mc->username)
+        || (!client->mqtt.pub_rpt && mc->pub_rpt)
+        || (!client->mqtt.pub_ack && mc->pub_ack)
+        || (!client->mqtt.sub_c2d && mc->sub_c2d)) {
+        IOTC_ERROR("Out of memory while copying MQTT configuration!");
+        free_mqtt_identity(&client->mqtt);
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    iotc_sas_token_destroy(client->sas_token);
+    client->sas_token = NULL;
+    if (IOTC_AT_SYMMETRIC_KEY == client->config.auth_info.type && client->config.auth_info.data.symmetric_key) {
+        // if this fails, the device client generates a token on each connect
+        client->sas_token = iotc_sas_token_create(client->mqtt.host, client->mqtt.client_id,
+                                                  client->config.auth_info.data.symmetric_key,
+                                                  client->config.sas_token_lifetime_s);
+    }
+    if (client->config.engine) {
+        // resolved in the background while the client is set up. Paho resolves the host itself.
+        iotc_dns_cache_prefetch(client->mqtt.host, IOTC_MQTT_PORT);
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int iotconnect_clone_client_config(IotConnectClientConfig *config, IotConnectClientConfig* c) {
     bool oom_error = false;
-    memcpy(&config, c, sizeof(IotConnectClientConfig));
-    config.cpid = iotcl_strdup(c->cpid);
-    config.env = iotcl_strdup(c->env);
-    config.duid = iotcl_strdup(c->duid);
-    config.auth_info.trust_store = iotcl_strdup(c->auth_info.trust_store);
+    memcpy(config, c, sizeof(IotConnectClientConfig));
+    config->cpid = iotcl_strdup(c->cpid);
+    config->env = iotcl_strdup(c->env);
+    config->duid = iotcl_strdup(c->duid);
+    config->auth_info.trust_store = iotcl_strdup(c->auth_info.trust_store);
+    config->offline_store_path = iotcl_strdup(c->offline_store_path);
+    config->identity_cache_path = iotcl_strdup(c->identity_cache_path);
 
-    if (!config.cpid && c->cpid) oom_error = true;
-    if (!config.env && c->env) oom_error = true;
-    if (!config.duid && c->duid) oom_error = true;
-    if (!config.auth_info.trust_store && c->auth_info.trust_store) { oom_error = true; }
+    if (!config->cpid && c->cpid) oom_error = true;
+    if (!config->env && c->env) oom_error = true;
+    if (!config->duid && c->duid) oom_error = true;
+    if (!config->auth_info.trust_store && c->auth_info.trust_store) { oom_error = true; }
+    if (!config->offline_store_path && c->offline_store_path) { oom_error = true; }
+    if (!config->identity_cache_path && c->identity_cache_path) { oom_error = true; }
+
+    if (c->compression.dictionary && c->compression.dictionary_len > 0) {
+        void *dictionary = malloc(c->compression.dictionary_len);
+        if (dictionary) {
+            memcpy(dictionary, c->compression.dictionary, c->compression.dictionary_len);
+        } else {
+            oom_error = true;
+        }
+        config->compression.dictionary = dictionary;
+    } else {
+        config->compression.dictionary = NULL;
+    }
 
     if (c->auth_info.type == IOTC_AT_X509) {
-        config.auth_info.data.cert_info.device_cert = iotcl_strdup(c->auth_info.data.cert_info.device_cert);
-        config.auth_info.data.cert_info.device_key = iotcl_strdup(c->auth_info.data.cert_info.device_key);
-        if (!config.auth_info.data.cert_info.device_cert && c->auth_info.data.cert_info.device_cert) {
+        config->auth_info.data.cert_info.device_cert = iotcl_strdup(c->auth_info.data.cert_info.device_cert);
+        config->auth_info.data.cert_info.device_key = iotcl_strdup(c->auth_info.data.cert_info.device_key);
+        if (!config->auth_info.data.cert_info.device_cert && c->auth_info.data.cert_info.device_cert) {
             oom_error = true;
         }
-        if (!config.auth_info.data.cert_info.device_key && c->auth_info.data.cert_info.device_key) {
+        if (!config->auth_info.data.cert_info.device_key && c->auth_info.data.cert_info.device_key) {
             oom_error = true;
         }
     } else if (c->auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
-        config.auth_info.data.symmetric_key = iotcl_strdup(c->auth_info.data.symmetric_key);
-        if (!config.auth_info.data.symmetric_key && c->auth_info.data.symmetric_key) {
+        config->auth_info.data.symmetric_key = iotcl_strdup(c->auth_info.data.symmetric_key);
+        if (!config->auth_info.data.symmetric_key && c->auth_info.data.symmetric_key) {
             oom_error = true;
         }
     }
@@ -71,81 +386,134 @@ static int validate_response(IotConnectHttpResponse *response) {
         dump_response("Unable to parse HTTP response.", response);
         return IOTCL_ERR_PARSING_ERROR;
     }
-    const char *json_start = strstr(response->data, "{");
-    if (NULL == json_start) {
+    if (response->json_start < 0) {
         dump_response("No json response from server.", response);
         return IOTCL_ERR_PARSING_ERROR;
     }
-    if (json_start != response->data) {
+    if (!response->is_json_complete) {
+        dump_response("Incomplete json response from server.", response);
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    if (response->json_start > 0) {
         dump_response("WARN: Expected JSON to start immediately in the returned data.", response);
     }
     return IOTCL_SUCCESS;
 }
 
-static int run_http_identity(IotConnectConnectionType ct, const char *cpid, const char *env, const char* duid) {
-    IotclDraUrlContext discovery_url = {0};
-    IotclDraUrlContext identity_url = {0};
-    int status;
-    switch (ct) {
+// Applies the identity response to iotc-c-lib and copies this device's MQTT configuration from it
+static int apply_identity_response(IotConnectClient *client, const char *json_str) {
+    iotc_platform_rwlock_write_lock(library_lock);
+    int status = iotcl_dra_identity_configure_library_mqtt(json_str);
+    if (!status) {
+        status = copy_mqtt_identity(client);
+    }
+    iotc_platform_rwlock_unlock(library_lock);
+
+    if (!status && client->config.connection_type == IOTC_CT_AWS && client->mqtt.username) {
+        // workaround for identity returning username for AWS.
+        // https://awspoc.iotconnect.io/support-info/2024036163515369
+        iotcl_free(client->mqtt.username);
+        client->mqtt.username = NULL;
+    }
+    return status;
+}
+
+// Identifies the device and environment that a cached identity response belongs to
+static char *identity_cache_key(IotConnectClient *client) {
+    const IotConnectClientConfig *c = &client->config;
+    const char *format = "%d/%s/%s/%s";
+    char *key = malloc((size_t) snprintf(NULL, 0, format, (int) c->connection_type, c->env, c->cpid, c->duid) + 1);
+    if (!key) {
+        IOTC_ERROR("Out of memory while building the identity cache key!");
+        return NULL;
+    }
+    sprintf(key, format, (int) c->connection_type, c->env, c->cpid, c->duid);
+    return key;
+}
+
+static void save_identity_response(IotConnectClient *client, const char *json_str) {
+    char *key = identity_cache_key(client);
+    if (key) {
+        iotc_identity_cache_save(client->config.identity_cache_path, key, json_str);
+        free(key);
+    }
+}
+
+static int init_discovery_url(const IotConnectClientConfig *c, IotclDraUrlContext *discovery_url) {
+    switch (c->connection_type) {
         case IOTC_CT_AWS:
         IOTC_INFO("Using AWS discovery URL...");
-            status = iotcl_dra_discovery_init_url_aws(&discovery_url, cpid, env);
-            break;
+            return iotcl_dra_discovery_init_url_aws(discovery_url, c->cpid, c->env);
         case IOTC_CT_AZURE:
         IOTC_INFO("Using Azure discovery URL...");
-            status = iotcl_dra_discovery_init_url_azure(&discovery_url, cpid, env);
-            break;
+            return iotcl_dra_discovery_init_url_azure(discovery_url, c->cpid, c->env);
         default:
-        IOTC_ERROR("Unknown connection type %d\n", ct);
+        IOTC_ERROR("Unknown connection type %d\n", c->connection_type);
             return IOTCL_ERR_BAD_VALUE;
     }
+}
+
+// Builds the device's identity URL from a validated discovery response
+static int build_identity_url(IotConnectClient *client, IotConnectHttpResponse *response,
+                              IotclDraUrlContext *discovery_url, IotclDraUrlContext *identity_url) {
+    int status = iotcl_dra_discovery_parse(identity_url, 0, response->data);
+    if (status) {
+        IOTC_ERROR("Error while parsing discovery response from %s", iotcl_dra_url_get_url(discovery_url));
+        dump_response(NULL, response);
+        return status;
+    }
+    return iotcl_dra_identity_build_url(identity_url, client->config.duid);
+}
+
+static int handle_identity_response(IotConnectClient *client, IotConnectHttpResponse *response,
+                                    IotclDraUrlContext *identity_url) {
+    int status = validate_response(response);
+    if (status) {
+        return status; // called function will print the error
+    }
+    status = apply_identity_response(client, response->data);
+    if (status) {
+        IOTC_ERROR("Error while parsing identity response from %s", iotcl_dra_url_get_url(identity_url));
+        dump_response(NULL, response);
+        return status;
+    }
+    client->is_identity_cached = false;
+    if (client->config.identity_cache_path) {
+        save_identity_response(client, response->data);
+    }
+    return IOTCL_SUCCESS;
+}
 
+static int run_http_identity(IotConnectClient *client) {
+    IotclDraUrlContext discovery_url = {0};
+    IotclDraUrlContext identity_url = {0};
+    int status = init_discovery_url(&client->config, &discovery_url);
     if (status) {
         return status; // called function will print the error
     }
 
     IotConnectHttpResponse response;
-    iotconnect_https_request(&response,
-                             iotcl_dra_url_get_url(&discovery_url),
-                             NULL
+    report_phase(client, IOTC_CP_DISCOVERY);
+    iotc_http_request(library_http,
+                      &response,
+                      iotcl_dra_url_get_url(&discovery_url),
+                      NULL
     );
     status = validate_response(&response);
     if (status) goto cleanup; // called function will print the error
 
-
-    status = iotcl_dra_discovery_parse(&identity_url, 0, response.data);
-    if (status) {
-        IOTC_ERROR("Error while parsing discovery response from %s", iotcl_dra_url_get_url(&discovery_url));
-        dump_response(NULL, &response);
-        goto cleanup;
-    }
+    status = build_identity_url(client, &response, &discovery_url, &identity_url);
+    if (status) goto cleanup; // called function will print the error
 
     iotconnect_free_https_response(&response);
 
-    status = iotcl_dra_identity_build_url(&identity_url, duid);
-    if (status) goto cleanup; // called function will print the error
-
-    iotconnect_https_request(&response,
-                             iotcl_dra_url_get_url(&identity_url),
-                             NULL
+    report_phase(client, IOTC_CP_IDENTITY);
+    iotc_http_request(library_http,
+                      &response,
+                      iotcl_dra_url_get_url(&identity_url),
+                      NULL
     );
-
-    status = validate_response(&response);
-    if (status) goto cleanup; // called function will print the error
-
-    status = iotcl_dra_identity_configure_library_mqtt(response.data);
-    if (status) {
-        IOTC_ERROR("Error while parsing identity response from %s", iotcl_dra_url_get_url(&identity_url));
-        dump_response(NULL, &response);
-        goto cleanup;
-    }
-
-    if (ct == IOTC_CT_AWS && iotcl_mqtt_get_config()->username) {
-        // workaround for identity returning username for AWS.
-        // https://awspoc.iotconnect.io/support-info/2024036163515369
-        iotcl_free(iotcl_mqtt_get_config()->username);
-        iotcl_mqtt_get_config()->username = NULL;
-    }
+    status = handle_identity_response(client, &response, &identity_url);
 
     cleanup:
     iotcl_dra_url_deinit(&discovery_url);
@@ -154,153 +522,1618 @@ static int run_http_identity(IotConnectConnectionType ct, const char *cpid, cons
     return status;
 }
 
-bool iotconnect_sdk_is_connected(void) {
-    return iotc_device_client_is_connected();
+// Applies the cached identity if it is fresh. Otherwise returns false, with the expired cached response,
+// if there is one, in *expired for use_expired_identity().
+static bool load_cached_identity(IotConnectClient *client, char **expired) {
+    const char *path = client->config.identity_cache_path;
+    *expired = NULL;
+    if (!path) {
+        return false;
+    }
+    char *key = identity_cache_key(client);
+    if (!key) {
+        return false; // called function will print the error
+    }
+    int64_t age_s = 0;
+    char *cached = iotc_identity_cache_load(path, key, &age_s);
+    free(key);
+    if (cached && age_s >= 0 && age_s < (int64_t) client->config.identity_cache_ttl_s) {
+        if (0 == apply_identity_response(client, cached)) {
+            IOTC_INFO("Using the cached identity from %lld seconds ago.", (long long) age_s);
+            client->is_identity_cached = true;
+            free(cached);
+            return true;
+        }
+        IOTC_WARN("Unable to use the cached identity. Requesting it again...");
+        iotc_identity_cache_remove(path);
+        free(cached);
+        cached = NULL;
+    }
+    *expired = cached;
+    return false;
+}
+
+// Falls back to the expired cached identity if the identity requests failed. Frees expired.
+static int use_expired_identity(IotConnectClient *client, char *expired, int status) {
+    if (status && expired && 0 == apply_identity_response(client, expired)) {
+        IOTC_WARN("Identity request failed. Using the expired cached identity.");
+        client->is_identity_cached = true;
+        status = IOTCL_SUCCESS;
+    }
+    free(expired);
+    return status;
+}
+
+// Uses the cached identity while it is fresh, and runs the identity requests otherwise.
+// An expired cached identity is used if the requests fail.
+static int load_identity(IotConnectClient *client) {
+    char *expired;
+    if (load_cached_identity(client, &expired)) {
+        return IOTCL_SUCCESS;
+    }
+    return use_expired_identity(client, expired, run_http_identity(client));
 }
 
 void iotconnect_sdk_init_config(IotConnectClientConfig *c) {
     memset(c, 0, sizeof(IotConnectClientConfig));
     c->qos = 1;
+    c->offline_store_size = IOTC_DEFAULT_OFFLINE_STORE_SIZE;
+    c->reconnect.min_delay_ms = IOTC_DEFAULT_RECONNECT_MIN_DELAY_MS;
+    c->reconnect.max_delay_ms = IOTC_DEFAULT_RECONNECT_MAX_DELAY_MS;
+    c->identity_cache_ttl_s = IOTC_DEFAULT_IDENTITY_CACHE_TTL_S;
+    c->dns_cache_ttl_s = IOTC_DEFAULT_DNS_CACHE_TTL_S;
+    c->sas_token_lifetime_s = IOTC_DEFAULT_SAS_TOKEN_LIFETIME_S;
+    c->compression.min_size = IOTC_DEFAULT_COMPRESSION_MIN_SIZE;
+    c->rate_limit.max_queued_bytes = IOTC_DEFAULT_RATE_LIMIT_QUEUE_SIZE;
+    c->lanes.control_weight = IOTC_DEFAULT_CONTROL_WEIGHT;
+    c->adaptive.min_batch_records = 1;
+    c->adaptive.max_batch_records = IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_RECORDS;
+    c->adaptive.min_batch_latency_ms = IOTC_DEFAULT_ADAPTIVE_MIN_BATCH_LATENCY_MS;
+    c->adaptive.max_batch_latency_ms = IOTC_DEFAULT_ADAPTIVE_MAX_BATCH_LATENCY_MS;
+    c->adaptive.qos0_max_loss_pct = IOTC_DEFAULT_QOS0_MAX_LOSS_PCT;
+    c->c2d.num_workers = 1;
+    c->c2d.queue_size = IOTC_DEFAULT_C2D_QUEUE_SIZE;
+    c->c2d.max_per_command = 1;
 }
 
-static void on_mqtt_c2d_message(const unsigned char *message, size_t message_len) {
-    if (config.verbose) {
-        IOTC_INFO("<: %.*s", (int) message_len, message);
-    }
+// Runs on a dispatch worker, or on the receive thread if dispatch is disabled
+static void process_c2d_message(void *context, const unsigned char *message, size_t message_len) {
+    IotConnectClient *client = (IotConnectClient *) context;
+    IotConnectClient *previous = enter_client(client);
+    library_read_lock();
     iotcl_c2d_process_event_with_length(message, message_len);
+    library_read_unlock();
+    leave_client(previous);
 }
 
-void iotconnect_sdk_mqtt_send_cb(const char *topic, const char *json_str) {
-    if (config.verbose) {
-        IOTC_INFO(">: %s",  json_str);
+// Returns the position after the JSON string that starts with the quote at p, or NULL if it does not end
+static const char *skip_json_string(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '"') {
+            return p + 1;
+        }
     }
-    iotc_device_client_send_message_qos(topic, json_str, config.qos);
+    return NULL;
 }
 
-int iotconnect_sdk_init(IotConnectClientConfig *c) {
-    int status;
-
-    // clear existing global config
-    iotconnect_sdk_deinit();
+// Finds the "ct" number and the "cmd" string among the top level fields of a C2D message in a single pass,
+// without building a tree, as this runs on the receive thread. cmd is not unescaped.
+// Returns false if the message is not a complete JSON object.
+static bool scan_c2d_fields(const char *message, size_t len, int *ct, const char **cmd, size_t *cmd_len) {
+    const char *p = message;
+    const char *const end = message + len;
+    const char *name = ""; // of the top level field being scanned
+    size_t name_len = 0;
+    bool is_value = false;
+    int depth = 0;
+    *ct = -1;
+    *cmd = NULL;
+    *cmd_len = 0;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    if (p == end || *p != '{') {
+        return false;
+    }
+    while (p < end) {
+        const char c = *p;
+        if (c == '"') {
+            const char *after = skip_json_string(p, end);
+            if (!after) {
+                return false;
+            }
+            if (1 == depth && !is_value) {
+                name = p + 1;
+                name_len = (size_t) (after - p) - 2;
+            } else if (1 == depth && 3 == name_len && 0 == memcmp(name, "cmd", 3)) {
+                *cmd = p + 1;
+                *cmd_len = (size_t) (after - p) - 2;
+            }
+            p = after;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (0 == --depth) {
+                return true;
+            }
+        } else if (1 == depth && c == ':') {
+            is_value = true;
+        } else if (1 == depth && c == ',') {
+            is_value = false;
+        } else if (1 == depth && is_value && c >= '0' && c <= '9' && 2 == name_len
+                   && 0 == memcmp(name, "ct", 2)) {
+            *ct = 0;
+            while (p < end && *p >= '0' && *p <= '9' && *ct < 1000) {
+                *ct = *ct * 10 + (*p++ - '0');
+            }
+            continue;
+        }
+        p++;
+    }
+    return false;
+}
 
-    if (iotconnect_clone_client_config(c)) {
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_OUT_OF_MEMORY; // called function will print the error
+// Limits command callbacks per command name. OTA updates count as one command, with the NULL key.
+static bool get_c2d_message_key(void *context, const char *message, size_t message_len, char **key) {
+    (void) context;
+    int ct;
+    const char *command;
+    size_t command_len;
+    *key = NULL;
+    if (!scan_c2d_fields(message, message_len, &ct, &command, &command_len)) {
+        return false; // iotc-c-lib will report the error
+    }
+    if (C2D_CT_OTA == ct) {
+        return true;
+    }
+    if (C2D_CT_COMMAND != ct) {
+        return false;
+    }
+    // the command name is followed by its arguments
+    size_t name_len = 0;
+    while (name_len < command_len && command[name_len] != ' ') {
+        name_len++;
     }
+    *key = malloc(name_len + 1);
+    if (!*key) {
+        return false;
+    }
+    if (name_len > 0) {
+        memcpy(*key, command, name_len);
+    }
+    (*key)[name_len] = 0;
+    return true;
+}
 
-    if (config.connection_type != IOTC_CT_AWS && config.connection_type != IOTC_CT_AZURE) {
-        IOTC_ERROR("Error: Device configuration is invalid. Must set connection type");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_MISSING_VALUE;
+static bool on_mqtt_c2d_message(void *context, const unsigned char *message, size_t message_len) {
+    IotConnectClient *client = (IotConnectClient *) context;
+    if (client->c2d_dispatcher) {
+        if (!iotc_dispatch_push(client->c2d_dispatcher, message, message_len)) {
+            return false; // the device client will offer it again
+        }
+    } else {
+        process_c2d_message(client, message, message_len);
     }
-    if (!config.env || !config.cpid || !config.duid) {
-        IOTC_ERROR("Error: Device configuration is invalid. Configuration values for env, cpid and duid are required.");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_MISSING_VALUE;
+    if (client->config.verbose) {
+        IOTC_INFO("<: %.*s", (int) message_len, message);
     }
-    if (config.auth_info.type != IOTC_AT_X509 &&
-        config.auth_info.type != IOTC_AT_SYMMETRIC_KEY
-            ) {
-        IOTC_ERROR("Error: Unsupported authentication type!");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_MISSING_VALUE;
+    return true;
+}
+
+static void on_command(IotclC2dEventData data) {
+    IotConnectClient *client = current_client;
+    if (!client || !client->config.cmd_cb) {
+        return;
     }
-    if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY && config.connection_type == IOTC_CT_AWS) {
-        IOTC_ERROR("Error: Symmetric key authentication is mot supported on AWS!");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_CONFIG_ERROR;
+    const int depth = library_read_suspend();
+    client->config.cmd_cb(data);
+    library_read_resume(depth);
+}
+
+static void on_ota(IotclC2dEventData data) {
+    IotConnectClient *client = current_client;
+    if (!client || !client->config.ota_cb) {
+        return;
     }
+    const int depth = library_read_suspend();
+    client->config.ota_cb(data);
+    library_read_resume(depth);
+}
 
-    if (!config.auth_info.trust_store) {
-        IOTC_ERROR("Error: Configuration server certificate is required.");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_CONFIG_MISSING;
+static bool transport_is_connected(IotConnectClient *client) {
+    if (client->engine_session) {
+        return iotc_engine_session_is_connected(client->engine_session);
     }
-    if (config.auth_info.type == IOTC_AT_X509 && (
-            !config.auth_info.data.cert_info.device_cert ||
-            !config.auth_info.data.cert_info.device_key)) {
-        IOTC_ERROR("Error: Configuration authentication info is invalid.");
-        iotconnect_sdk_deinit();
-        return IOTCL_ERR_CONFIG_MISSING;
-    } else if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY && (
-            !config.auth_info.data.symmetric_key ||
-            0 == strlen(config.auth_info.data.symmetric_key))) {
+    return iotc_device_client_is_connected(client->device_client);
+}
+
+static IotConnectMessageId next_message_id(IotConnectClient *client) {
+    iotc_platform_mutex_lock(&client->state_lock);
+    if (0 == ++client->next_message_id) {
+        client->next_message_id = 1; // zero is not a valid message ID
     }
+    IotConnectMessageId id = client->next_message_id;
+    iotc_platform_mutex_unlock(&client->state_lock);
+    return id;
+}
 
-    IotclClientConfig iotcl_cfg;
-    iotcl_init_client_config(&iotcl_cfg);
-    iotcl_cfg.device.cpid = config.cpid;
-    iotcl_cfg.device.duid = config.duid;
-    iotcl_cfg.device.instance_type = IOTCL_DCT_CUSTOM;
-    iotcl_cfg.mqtt_send_cb = iotconnect_sdk_mqtt_send_cb;
-    iotcl_cfg.events.cmd_cb = config.cmd_cb;
-    iotcl_cfg.events.ota_cb = config.ota_cb;
+// The state lock must be held
+static PendingDelivery *delivery_find(IotConnectClient *client, IotConnectMessageId id) {
+    for (size_t i = 0; i < client->num_deliveries; i++) {
+        if (client->deliveries[i].id == id) {
+            return &client->deliveries[i];
+        }
+    }
+    return NULL;
+}
 
-    if (c->verbose) {
-        status = iotcl_init_and_print_config(&iotcl_cfg);
-    } else {
-        status = iotcl_init(&iotcl_cfg);
+static int transport_send(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs, size_t num_bufs,
+                          IotConnectMessageId id) {
+    // the QOS was chosen when the message was sent, and the round trip is measured from here
+    int qos = client->config.qos;
+    iotc_platform_mutex_lock(&client->state_lock);
+    PendingDelivery *d = id ? delivery_find(client, id) : NULL;
+    if (d) {
+        d->sent_us = iotc_platform_now_us();
+        qos = d->qos;
     }
-    status = iotcl_init_and_print_config(&iotcl_cfg);
-    if (status) {
-        iotconnect_sdk_deinit();
-        return status; // called function will print errors
+    iotc_platform_mutex_unlock(&client->state_lock);
+
+    if (client->engine_session) {
+        return iotc_engine_session_send_message_iov(client->engine_session, topic, bufs, num_bufs, qos, id);
     }
+    return iotc_device_client_send_message_iov(client->device_client, topic, bufs, num_bufs, qos, id);
+}
 
-    status = run_http_identity(config.connection_type, config.cpid, config.env, config.duid);
-    if (status) {
-        iotcl_deinit();
-        return status; // called function will print errors
+// The state lock must be held
+static int delivery_add(IotConnectClient *client, IotConnectMessageId id, uint64_t enqueued_us, size_t size,
+                        int qos) {
+    if (client->num_deliveries == client->deliveries_capacity) {
+        size_t new_capacity = client->deliveries_capacity ? client->deliveries_capacity * 2 : 16;
+        PendingDelivery *ptr = realloc(client->deliveries, new_capacity * sizeof(PendingDelivery));
+        if (!ptr) {
+            IOTC_ERROR("Out of memory while tracking message delivery!");
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        client->deliveries = ptr;
+        client->deliveries_capacity = new_capacity;
     }
+    PendingDelivery *d = &client->deliveries[client->num_deliveries++];
+    d->id = id;
+    d->enqueued_us = enqueued_us;
+    d->size = size;
+    d->store_seq = 0;
+    d->sent_us = 0;
+    d->qos = qos;
+    return IOTCL_SUCCESS;
+}
 
-    IOTC_INFO("Identity response parsing successful.");
-    is_config_valid = true;
-    return status;
+// Removes the delivery, keeping the order of the rest. The state lock must be held.
+static void delivery_remove(IotConnectClient *client, PendingDelivery *d, PendingDelivery *removed) {
+    const size_t index = (size_t) (d - client->deliveries);
+    if (removed) {
+        *removed = *d;
+    }
+    memmove(d, d + 1, (client->num_deliveries - index - 1) * sizeof(PendingDelivery));
+    client->num_deliveries--;
 }
 
-int iotconnect_sdk_connect(void) {
-    if (!is_config_valid) {
-        IOTC_ERROR("iotconnect_sdk_connect called, but config is invalid!");
-        return IOTCL_ERR_CONFIG_MISSING;
+static void report_delivery(IotConnectClient *client, const PendingDelivery *d, bool is_delivered) {
+    IotConnectClient *previous = enter_client(client);
+    if (client->config.status_cb) {
+        client->config.status_cb(is_delivered ? IOTC_CS_MQTT_DELIVERED : IOTC_CS_MQTT_SEND_FAILED);
     }
-    IotConnectDeviceClientConfig dc;
-    dc.qos = config.qos;
-    dc.status_cb = config.status_cb;
-    dc.c2d_msg_cb = &on_mqtt_c2d_message;
-    dc.auth = &config.auth_info;
+    if (client->config.delivery_cb && d) {
+        IotConnectDeliveryReport report;
+        report.id = d->id;
+        report.is_delivered = is_delivered;
+        report.latency_us = iotc_platform_now_us() - d->enqueued_us;
+        report.size = d->size;
+        client->config.delivery_cb(&report);
+    }
+    leave_client(previous);
+}
 
-    int status = iotc_device_client_connect(&dc);
-    if (status) {
-        IOTC_ERROR("Failed to connect!");
-        iotconnect_sdk_deinit();
-        return status;
+static void on_mqtt_delivery(void *context, uint32_t message_id, bool is_delivered) {
+    IotConnectClient *client = (IotConnectClient *) context;
+    PendingDelivery d;
+    iotc_platform_mutex_lock(&client->state_lock);
+    PendingDelivery *found = message_id ? delivery_find(client, message_id) : NULL;
+    if (found) {
+        delivery_remove(client, found, &d);
+        // QOS 0 messages are reported as soon as they are sent, so they say nothing about the link
+        if (d.qos > 0 && d.sent_us) {
+            iotc_link_on_delivery(&client->link, is_delivered, iotc_platform_now_us() - d.sent_us, d.size);
+        }
     }
-    return 0;
+    iotc_platform_mutex_unlock(&client->state_lock);
+    // messages stored by a previous run do not have an ID
+    report_delivery(client, found ? &d : NULL, is_delivered);
 }
 
-void iotconnect_sdk_disconnect(void) {
-    IOTC_INFO("Disconnecting...");
-    if (0 == iotc_device_client_disconnect()) {
-        IOTC_INFO("Disconnected.");
+// Reports failure for stored messages that were dropped from the offline store to make room for new ones.
+// The oldest_seq is the seq of the oldest stored message, or zero if the store is empty.
+// The state lock must be held once, so that it can be released while reporting.
+static void report_dropped_deliveries(IotConnectClient *client, uint64_t oldest_seq) {
+    size_t i = 0;
+    while (i < client->num_deliveries) {
+        PendingDelivery *d = &client->deliveries[i];
+        if (0 == d->store_seq || (oldest_seq && d->store_seq >= oldest_seq)) {
+            i++;
+            continue;
+        }
+        PendingDelivery dropped;
+        delivery_remove(client, d, &dropped);
+        iotc_platform_mutex_unlock(&client->state_lock);
+        report_delivery(client, &dropped, false);
+        iotc_platform_mutex_lock(&client->state_lock);
+        i = 0; // the list may have changed while unlocked
     }
 }
 
-void iotconnect_sdk_deinit() {
+// Sends stored messages in order until the store is empty or sending fails
+static void drain_offline_store(IotConnectClient *client) {
+    IotcStoreRecord record;
+    if (!client->offline_store) {
+        return;
+    }
+
+    iotc_platform_mutex_lock(&client->state_lock);
+    if (client->is_draining) {
+        iotc_platform_mutex_unlock(&client->state_lock);
+        return;
+    }
+    client->is_draining = true;
+    while (transport_is_connected(client) && iotc_store_peek(client->offline_store, &record)) {
+        report_dropped_deliveries(client, record.seq);
+        if (!iotc_store_peek(client->offline_store, &record)) {
+            break; // the reporting callbacks may have changed the store
+        }
+        if (client->rate_lanes[LANE_CONTROL].head) {
+            break; // let the rate limited control messages go first. Will continue on poll.
+        }
+        if (iotc_rate_is_enabled(&client->rate_limiter)
+            && !iotc_rate_take(&client->rate_limiter, record.payload_len)) {
+            break; // will continue on poll
+        }
+        IotConnectMessageId id = 0;
+        for (size_t i = 0; i < client->num_deliveries; i++) {
+            if (client->deliveries[i].store_seq == record.seq) {
+                id = client->deliveries[i].id;
+                break;
+            }
+        }
+
+        const size_t topic_len = strlen(record.topic) + 1;
+        const size_t needed = topic_len + record.payload_len;
+        if (needed > client->drain_buffer_size) {
+            char *ptr = realloc(client->drain_buffer, needed);
+            if (!ptr) {
+                IOTC_ERROR("Out of memory while sending stored messages!");
+                break;
+            }
+            client->drain_buffer = ptr;
+            client->drain_buffer_size = needed;
+        }
+        memcpy(client->drain_buffer, record.topic, topic_len);
+        memcpy(&client->drain_buffer[topic_len], record.payload, record.payload_len);
+        iotc_platform_mutex_unlock(&client->state_lock);
+
+        IotConnectBuffer buf = {&client->drain_buffer[topic_len], record.payload_len};
+        int status = transport_send(client, client->drain_buffer, &buf, 1, id);
+
+        iotc_platform_mutex_lock(&client->state_lock);
+        if (status) {
+            break; // will retry on the next connect or poll
+        }
+        iotc_store_pop(client->offline_store, record.seq);
+        PendingDelivery *d = id ? delivery_find(client, id) : NULL;
+        if (d) {
+            d->store_seq = 0; // now waiting for acknowledgement
+        }
+    }
+    if (client->offline_store && 0 == iotc_store_count(client->offline_store)) {
+        report_dropped_deliveries(client, 0);
+    }
+    client->is_draining = false;
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
 
-    iotcl_deinit();
+static int offline_store_send(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs,
+                              size_t num_bufs, IotConnectMessageId id, OutboundLane lane) {
+    int status;
+    bool is_store_empty = true;
 
-    is_config_valid = false;
-    if (config.cpid) iotcl_free(config.cpid);
-    if (config.env) iotcl_free(config.env);
-    if (config.duid) iotcl_free(config.duid);
+    // preserve the original order of telemetry by sending stored messages first.
+    // Control messages skip ahead of the backlog while connected.
+    if (LANE_TELEMETRY == lane) {
+        drain_offline_store(client);
+        iotc_platform_mutex_lock(&client->state_lock);
+        is_store_empty = (0 == iotc_store_count(client->offline_store));
+        iotc_platform_mutex_unlock(&client->state_lock);
+    }
 
-    if (config.auth_info.trust_store) iotcl_free(config.auth_info.trust_store);
+    if (is_store_empty && transport_is_connected(client)) {
+        status = transport_send(client, topic, bufs, num_bufs, id);
+        if (0 == status || transport_is_connected(client)) {
+            return status; // sent, or failed for a reason other than losing the connection
+        }
+    }
 
-    if (config.auth_info.type == IOTC_AT_X509) {
-        if (config.auth_info.data.cert_info.device_cert) iotcl_free(config.auth_info.data.cert_info.device_cert);
-        if (config.auth_info.data.cert_info.device_key) iotcl_free(config.auth_info.data.cert_info.device_key);
-    } else if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
-        if (config.auth_info.data.symmetric_key) iotcl_free(config.auth_info.data.symmetric_key);
+    uint64_t seq = 0;
+    iotc_platform_mutex_lock(&client->state_lock);
+    status = iotc_store_push(client->offline_store, topic, bufs, num_bufs, &seq);
+    PendingDelivery *d = status ? NULL : delivery_find(client, id);
+    if (d) {
+        d->store_seq = seq;
     }
-    memset(&config, 0, sizeof(IotConnectClientConfig));
-}
\ No newline at end of file
+    iotc_platform_mutex_unlock(&client->state_lock);
+    return status;
+}
+
+static void report_delivery_failed(IotConnectClient *client, IotConnectMessageId id) {
+    PendingDelivery d;
+    iotc_platform_mutex_lock(&client->state_lock);
+    PendingDelivery *found = delivery_find(client, id);
+    if (found) {
+        delivery_remove(client, found, &d);
+    }
+    iotc_platform_mutex_unlock(&client->state_lock);
+    if (found) {
+        report_delivery(client, &d, false);
+    }
+}
+
+// Set while sending rate limited messages, as callbacks from there must not block on a full queue
+static IOTC_THREAD_LOCAL bool is_draining_rate_queue = false;
+
+// Picks the lane to send from next. The state lock must be held.
+static OutboundLane rate_pick_lane(IotConnectClient *client) {
+    if (!client->rate_lanes[LANE_CONTROL].head) {
+        return LANE_TELEMETRY;
+    }
+    if (!client->rate_lanes[LANE_TELEMETRY].head || IOTC_LS_WEIGHTED != client->config.lanes.scheduling) {
+        return LANE_CONTROL;
+    }
+    if (client->control_streak >= client->config.lanes.control_weight) {
+        return LANE_TELEMETRY;
+    }
+    return LANE_CONTROL;
+}
+
+// Sends queued messages, in order within each lane, for as long as the rate limiter allows it
+static void drain_rate_queue(IotConnectClient *client) {
+    iotc_platform_mutex_lock(&client->state_lock);
+    if (client->is_rate_draining) {
+        iotc_platform_mutex_unlock(&client->state_lock);
+        return;
+    }
+    client->is_rate_draining = true;
+    for (;;) {
+        const OutboundLane lane = rate_pick_lane(client);
+        RateLane *l = &client->rate_lanes[lane];
+        if (!l->head || !iotc_rate_take(&client->rate_limiter, l->head->payload_len)) {
+            break;
+        }
+        RateQueued *q = l->head;
+        l->head = q->next;
+        if (!l->head) {
+            l->tail = NULL;
+        }
+        l->num_messages--;
+        l->num_bytes -= q->payload_len;
+        if (LANE_CONTROL == lane && client->rate_lanes[LANE_TELEMETRY].head) {
+            client->control_streak++;
+        } else {
+            client->control_streak = 0;
+        }
+        iotc_platform_mutex_unlock(&client->state_lock);
+
+        IotConnectBuffer buf = {q->payload, q->payload_len};
+        int status;
+        is_draining_rate_queue = true;
+        if (client->offline_store) {
+            status = offline_store_send(client, q->topic, &buf, 1, q->id, lane);
+        } else {
+            status = transport_send(client, q->topic, &buf, 1, q->id);
+        }
+        if (status) {
+            report_delivery_failed(client, q->id); // the caller was already told that it was sent
+        }
+        is_draining_rate_queue = false;
+        free(q);
+
+        iotc_platform_mutex_lock(&client->state_lock);
+    }
+    client->is_rate_draining = false;
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
+
+// Queues a copy of the message for drain_rate_queue(). Blocks while the queue is full.
+static int rate_queue_push(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs,
+                           size_t num_bufs, IotConnectMessageId id, size_t size, OutboundLane lane) {
+    const size_t topic_len = strlen(topic) + 1;
+    RateQueued *q = malloc(sizeof(RateQueued) + size + topic_len);
+    if (!q) {
+        IOTC_ERROR("Out of memory while queueing a rate limited message!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    q->next = NULL;
+    q->id = id;
+    q->payload_len = size;
+    size_t offset = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        if (bufs[i].len > 0) {
+            memcpy(&q->payload[offset], bufs[i].data, bufs[i].len);
+            offset += bufs[i].len;
+        }
+    }
+    q->topic = (char *) &q->payload[size];
+    memcpy(q->topic, topic, topic_len);
+
+    const size_t max_queued_bytes = client->config.rate_limit.max_queued_bytes;
+    RateLane *l = &client->rate_lanes[lane];
+    iotc_platform_mutex_lock(&client->state_lock);
+    // a message larger than the queue can still be queued once the queue is empty
+    while (l->head && l->num_bytes + size > max_queued_bytes && !is_draining_rate_queue) {
+        const size_t head_len = l->head->payload_len;
+        const uint64_t delay_us = iotc_rate_delay_us(&client->rate_limiter, head_len);
+        iotc_platform_mutex_unlock(&client->state_lock);
+        if (delay_us > 0) {
+            iotc_platform_sleep_ms((unsigned int) ((delay_us + 999) / 1000));
+        }
+        drain_rate_queue(client);
+        iotc_platform_mutex_lock(&client->state_lock);
+    }
+    if (l->tail) {
+        l->tail->next = q;
+    } else {
+        l->head = q;
+    }
+    l->tail = q;
+    l->num_messages++;
+    l->num_bytes += size;
+    iotc_platform_mutex_unlock(&client->state_lock);
+    return IOTCL_SUCCESS;
+}
+
+// All outbound messages end up here. If this returns success, the outcome will be reported for the id.
+static int send_message(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs, size_t num_bufs,
+                        IotConnectMessageId id, uint64_t enqueued_us, OutboundLane lane) {
+    size_t size = 0;
+    for (size_t i = 0; i < num_bufs; i++) {
+        size += bufs[i].len;
+    }
+    iotc_platform_mutex_lock(&client->state_lock);
+    // only telemetry and raw messages can be downgraded to QOS 0
+    const int qos = LANE_TELEMETRY == lane ? iotc_link_telemetry_qos(&client->link, client->config.qos)
+                                           : client->config.qos;
+    int status = delivery_add(client, id, enqueued_us, size, qos);
+    iotc_platform_mutex_unlock(&client->state_lock);
+    if (status) {
+        return status; // called function will print the error
+    }
+
+    if (iotc_rate_is_enabled(&client->rate_limiter)) {
+        status = rate_queue_push(client, topic, bufs, num_bufs, id, size, lane);
+        if (!status) {
+            drain_rate_queue(client);
+        }
+    } else if (client->offline_store) {
+        status = offline_store_send(client, topic, bufs, num_bufs, id, lane);
+    } else {
+        status = transport_send(client, topic, bufs, num_bufs, id);
+    }
+
+    if (status) {
+        // the caller gets the error, so the outcome will not be reported
+        iotc_platform_mutex_lock(&client->state_lock);
+        PendingDelivery *d = delivery_find(client, id);
+        if (d) {
+            delivery_remove(client, d, NULL);
+        }
+        iotc_platform_mutex_unlock(&client->state_lock);
+    }
+    return status;
+}
+
+static int send_json(IotConnectClient *client, const char *topic, const char *json_str, size_t json_len,
+                     IotConnectMessageId id, uint64_t enqueued_us, OutboundLane lane) {
+    IotConnectBuffer buf = {json_str, json_len};
+    if (client->config.verbose) {
+        IOTC_INFO(">: %.*s", (int) json_len, json_str);
+    }
+    return send_message(client, topic, &buf, 1, id, enqueued_us, lane);
+}
+
+// iotc-c-lib sends to topics from its own MQTT configuration, which can belong to a different device
+static const char *client_topic(IotConnectClient *client, const char *topic) {
+    const char *ret = topic;
+    library_read_lock();
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (mc && mc->pub_ack && client->mqtt.pub_ack && 0 == strcmp(topic, mc->pub_ack)) {
+        ret = client->mqtt.pub_ack;
+    } else if (mc && mc->pub_rpt && client->mqtt.pub_rpt && 0 == strcmp(topic, mc->pub_rpt)) {
+        ret = client->mqtt.pub_rpt;
+    }
+    library_read_unlock();
+    return ret;
+}
+
+// Set while sending a message from iotc-c-lib, whose failure is reported as a failed delivery
+static IOTC_THREAD_LOCAL bool is_sending_library_message = false;
+
+void iotconnect_sdk_mqtt_send_cb(const char *topic, const char *json_str) {
+    // current_client is set while in a command or OTA callback, which is where acknowledgements are sent from
+    IotConnectClient *client = current_client ? current_client : default_client;
+    if (!client) {
+        IOTC_ERROR("Unable to send a message from iotc-c-lib. There is no client to send it with!");
+        return;
+    }
+    topic = client_topic(client, topic);
+    // acknowledgements, and anything else that is not telemetry, go into the control lane
+    const bool is_telemetry = client->mqtt.pub_rpt && 0 == strcmp(topic, client->mqtt.pub_rpt);
+    const OutboundLane lane = is_telemetry ? LANE_TELEMETRY : LANE_CONTROL;
+    PendingDelivery d;
+    d.id = next_message_id(client);
+    d.enqueued_us = iotc_platform_now_us();
+    d.size = strlen(json_str);
+    is_sending_library_message = true;
+    int status = send_json(client, topic, json_str, d.size, d.id, d.enqueued_us, lane);
+    is_sending_library_message = false;
+    if (status) {
+        // iotc-c-lib does not take a return value, so report it like a message that was not delivered
+        IOTC_ERROR("Failed to send a message from iotc-c-lib, status %d", status);
+        report_delivery(client, &d, false);
+    }
+}
+
+int iotconnect_client_send_raw(IotConnectClient *client, const char *topic, const void *payload, size_t payload_len,
+                               IotConnectMessageId *id) {
+    IotConnectBuffer buf = {payload, payload_len};
+    return iotconnect_client_send_raw_iov(client, topic, &buf, 1, id);
+}
+
+int iotconnect_client_send_raw_iov(IotConnectClient *client, const char *topic, const IotConnectBuffer *bufs,
+                                   size_t num_bufs, IotConnectMessageId *id) {
+    IotConnectMessageId message_id = next_message_id(client);
+    int status = send_message(client, topic, bufs, num_bufs, message_id, iotc_platform_now_us(),
+                              LANE_TELEMETRY);
+    if (id) {
+        *id = status ? 0 : message_id;
+    }
+    return status;
+}
+
+static void on_telemetry_batch_flush(void *context, const char *json_str, size_t json_len) {
+    IotConnectClient *client = (IotConnectClient *) context;
+    PendingDelivery d;
+    d.id = client->batch_message_id ? client->batch_message_id : next_message_id(client);
+    d.enqueued_us = client->batch_message_id ? client->batch_enqueued_us : iotc_platform_now_us();
+    d.size = json_len;
+    client->batch_message_id = 0;
+    client->last_batch_message_id = d.id;
+    const unsigned char *compressed;
+    size_t compressed_len;
+    int status;
+    if (client->compressor
+        && iotc_compressor_compress(client->compressor, json_str, json_len, &compressed, &compressed_len)) {
+        if (client->config.verbose) {
+            IOTC_INFO(">: %.*s (compressed to %lu bytes)", (int) json_len, json_str, (unsigned long) compressed_len);
+        }
+        IotConnectBuffer buf = {compressed, compressed_len};
+        d.size = compressed_len;
+        status = send_message(client, client->mqtt.pub_rpt, &buf, 1, d.id, d.enqueued_us, LANE_TELEMETRY);
+    } else {
+        status = send_json(client, client->mqtt.pub_rpt, json_str, json_len, d.id, d.enqueued_us,
+                           LANE_TELEMETRY);
+    }
+    if (status) {
+        // the records were already accepted, so report the failure
+        report_delivery(client, &d, false);
+    }
+}
+
+// Applies the batch limits of adaptive batching. Only the application thread uses the batch.
+static void update_batch_limits(IotConnectClient *client) {
+    if (!iotc_link_is_enabled(&client->link)) {
+        return;
+    }
+    iotc_platform_mutex_lock(&client->state_lock);
+    iotc_link_apply_batch_limits(&client->link, &client->telemetry_batch.config);
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
+
+int iotconnect_client_send_telemetry(IotConnectClient *client, IotclMessageHandle message, IotConnectMessageId *id) {
+    library_read_lock();
+    char *json_str = iotcl_telemetry_create_serialized_string(message, false);
+    library_read_unlock();
+    if (!json_str) {
+        return IOTCL_ERR_FAILED; // called function will print the error
+    }
+    int status;
+    IotConnectMessageId message_id = 0;
+    update_batch_limits(client);
+    if (iotc_batch_is_enabled(&client->telemetry_batch)) {
+        status = iotc_batch_add(&client->telemetry_batch, json_str, time(NULL));
+        if (!status && client->telemetry_batch.num_records > 0) {
+            if (!client->batch_message_id) {
+                client->batch_message_id = next_message_id(client);
+                client->batch_enqueued_us = iotc_platform_now_us();
+            }
+            message_id = client->batch_message_id;
+        } else if (!status) {
+            message_id = client->last_batch_message_id; // the record was sent right away
+        }
+    } else {
+        message_id = next_message_id(client);
+        status = send_json(client, client->mqtt.pub_rpt, json_str, strlen(json_str), message_id,
+                           iotc_platform_now_us(), LANE_TELEMETRY);
+    }
+    iotcl_telemetry_destroy_serialized(json_str);
+    if (id) {
+        *id = status ? 0 : message_id;
+    }
+    return status;
+}
+
+void iotconnect_client_flush_telemetry(IotConnectClient *client) {
+    iotc_batch_flush(&client->telemetry_batch);
+}
+
+static void cancel_reconnect(IotConnectClient *client) {
+    iotc_platform_mutex_lock(&client->state_lock);
+    client->is_reconnect_pending = false;
+    client->reconnect_attempt = 0;
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
+
+// Waits for a background reconnect, so that the client can be connected, disconnected or destroyed
+static void stop_reconnect(IotConnectClient *client) {
+    IotConnectConnectOp *op = client->connect_op;
+    if (op && OP_RECONNECT == op->kind) {
+        iotconnect_connect_op_finish(op, NULL);
+    }
+    cancel_reconnect(client);
+}
+
+// Exponential backoff with jitter. Each attempt waits between half and the full backoff delay,
+// so that a fleet of devices that lost connection at the same time does not reconnect all at once.
+static void schedule_reconnect(IotConnectClient *client) {
+    const IotConnectReconnectConfig *rc = &client->config.reconnect;
+    iotc_platform_mutex_lock(&client->state_lock);
+    // without a cap, the delay stops growing before it would overflow
+    const unsigned int max_delay_ms = rc->max_delay_ms > 0 ? rc->max_delay_ms : UINT_MAX / 2;
+    unsigned int delay_ms = rc->min_delay_ms;
+    for (unsigned int i = 0; i < client->reconnect_attempt && delay_ms < max_delay_ms; i++) {
+        delay_ms = delay_ms > UINT_MAX / 2 ? UINT_MAX : delay_ms * 2;
+    }
+    if (delay_ms > max_delay_ms) {
+        delay_ms = max_delay_ms;
+    }
+    uint32_t x = client->jitter_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    client->jitter_state = x;
+    delay_ms = delay_ms / 2 + (unsigned int) (x % (delay_ms / 2 + 1));
+    client->reconnect_at_ms = iotc_platform_now_ms() + delay_ms;
+    client->reconnect_attempt++;
+    client->is_reconnect_pending = true;
+    iotc_platform_mutex_unlock(&client->state_lock);
+    IOTC_INFO("Reconnecting in %u ms...", delay_ms);
+}
+
+static void on_mqtt_status(void *context, IotConnectMqttStatus status) {
+    IotConnectClient *client = (IotConnectClient *) context;
+    if (status == IOTC_CS_MQTT_SEND_FAILED && is_sending_library_message) {
+        return; // iotconnect_sdk_mqtt_send_cb() reports it along with the message
+    }
+    // the device client only reports disconnects that were not requested with iotconnect_client_disconnect()
+    if (status == IOTC_CS_MQTT_DISCONNECTED && client->config.reconnect.min_delay_ms > 0) {
+        schedule_reconnect(client);
+    }
+    if (client->config.status_cb) {
+        IotConnectClient *previous = enter_client(client);
+        client->config.status_cb(status);
+        leave_client(previous);
+    }
+}
+
+static void on_mqtt_phase(void *context, IotConnectConnectPhase phase) {
+    report_phase((IotConnectClient *) context, phase);
+}
+
+static int device_client_connect(IotConnectClient *client) {
+    IotConnectDeviceClientConfig dc;
+    dc.qos = client->config.qos;
+    dc.max_inflight = client->config.max_inflight;
+    dc.status_cb = on_mqtt_status;
+    dc.delivery_cb = on_mqtt_delivery;
+    dc.phase_cb = on_mqtt_phase;
+    dc.c2d_msg_cb = &on_mqtt_c2d_message;
+    dc.auth = &client->config.auth_info;
+    dc.mqtt = &client->mqtt;
+    dc.sas_token = client->sas_token;
+    dc.context = client;
+    int status;
+    if (client->engine_session) {
+        status = iotc_engine_session_connect(client->engine_session, &dc);
+    } else {
+        status = iotc_device_client_connect(client->device_client, &dc);
+    }
+    if (!status && client->config.verbose) {
+        IOTC_INFO("Connected with %s TLS handshake.",
+                  iotconnect_client_is_tls_resumed(client) ? "an abbreviated" : "a full");
+    }
+    return status;
+}
+
+// Reconnects with MQTT configuration from the last identity response and only repeats
+// the discovery and identity HTTP requests if the broker rejects it.
+static int reconnect_client(IotConnectClient *client) {
+    IOTC_INFO("Reconnecting...");
+    int status = device_client_connect(client);
+    if (IOTC_DEVICE_CLIENT_ERR_REJECTED == status) {
+        IOTC_WARN("Connection was rejected. Refreshing device identity...");
+        if (0 == run_http_identity(client)) {
+            status = device_client_connect(client);
+        }
+    }
+    if (status) {
+        schedule_reconnect(client);
+        report_phase(client, IOTC_CP_FAILED);
+        return status;
+    }
+    cancel_reconnect(client);
+    drain_offline_store(client);
+    report_phase(client, IOTC_CP_CONNECTED);
+    return IOTCL_SUCCESS;
+}
+
+static void library_create_lock(void) {
+    library_lock = iotc_platform_rwlock_create();
+}
+
+static int library_acquire(IotConnectClient *client) {
+    int status = IOTCL_SUCCESS;
+    iotc_platform_once(&library_once, library_create_lock);
+    if (!library_lock) {
+        IOTC_ERROR("Unable to create the library lock!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+
+    iotc_platform_rwlock_write_lock(library_lock);
+    if (library_refcount > 0) {
+        library_refcount++;
+        iotc_platform_rwlock_unlock(library_lock);
+        return IOTCL_SUCCESS;
+    }
+
+    // the library keeps the device values of the first client, but they are not used after the identity response
+    library_cpid = iotcl_strdup(client->config.cpid);
+    library_duid = iotcl_strdup(client->config.duid);
+    if (!library_cpid || !library_duid) {
+        IOTC_ERROR("Out of memory while initializing the library!");
+        status = IOTCL_ERR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+    library_http = iotc_http_context_create();
+    if (!library_http) {
+        status = IOTCL_ERR_FAILED; // called function will print the error
+        goto cleanup;
+    }
+    if (client->config.dns_cache_ttl_s > 0) {
+        status = iotc_dns_cache_acquire(client->config.dns_cache_ttl_s);
+        if (status) {
+            goto cleanup; // called function will print the error
+        }
+        library_is_dns_cached = true;
+    }
+
+    IotclClientConfig iotcl_cfg;
+    iotcl_init_client_config(&iotcl_cfg);
+    iotcl_cfg.device.cpid = library_cpid;
+    iotcl_cfg.device.duid = library_duid;
+    iotcl_cfg.device.instance_type = IOTCL_DCT_CUSTOM;
+    iotcl_cfg.mqtt_send_cb = iotconnect_sdk_mqtt_send_cb;
+    iotcl_cfg.events.cmd_cb = on_command;
+    iotcl_cfg.events.ota_cb = on_ota;
+
+    if (client->config.verbose) {
+        status = iotcl_init_and_print_config(&iotcl_cfg);
+    } else {
+        status = iotcl_init(&iotcl_cfg);
+    }
+
+    cleanup:
+    if (status) {
+        if (library_cpid) iotcl_free(library_cpid);
+        if (library_duid) iotcl_free(library_duid);
+        library_cpid = NULL;
+        library_duid = NULL;
+        iotc_http_context_destroy(library_http);
+        library_http = NULL;
+        if (library_is_dns_cached) {
+            iotc_dns_cache_release();
+            library_is_dns_cached = false;
+        }
+    } else {
+        library_refcount = 1;
+    }
+    iotc_platform_rwlock_unlock(library_lock);
+    return status;
+}
+
+static void library_release(void) {
+    iotc_platform_rwlock_write_lock(library_lock);
+    if (library_refcount > 0 && 0 == --library_refcount) {
+        iotcl_deinit();
+        iotcl_free(library_cpid);
+        iotcl_free(library_duid);
+        library_cpid = NULL;
+        library_duid = NULL;
+        iotc_http_context_destroy(library_http);
+        library_http = NULL;
+        if (library_is_dns_cached) {
+            iotc_dns_cache_release();
+            library_is_dns_cached = false;
+        }
+    }
+    iotc_platform_rwlock_unlock(library_lock);
+}
+
+static int validate_config(IotConnectClientConfig *config) {
+    if (config->connection_type != IOTC_CT_AWS && config->connection_type != IOTC_CT_AZURE) {
+        IOTC_ERROR("Error: Device configuration is invalid. Must set connection type");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if (!config->env || !config->cpid || !config->duid) {
+        IOTC_ERROR("Error: Device configuration is invalid. Configuration values for env, cpid and duid are required.");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if (config->auth_info.type != IOTC_AT_X509 &&
+        config->auth_info.type != IOTC_AT_SYMMETRIC_KEY
+            ) {
+        IOTC_ERROR("Error: Unsupported authentication type!");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if (config->auth_info.type == IOTC_AT_SYMMETRIC_KEY && config->connection_type == IOTC_CT_AWS) {
+        IOTC_ERROR("Error: Symmetric key authentication is mot supported on AWS!");
+        return IOTCL_ERR_CONFIG_ERROR;
+    }
+
+    if (!config->auth_info.trust_store) {
+        IOTC_ERROR("Error: Configuration server certificate is required.");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    if (config->auth_info.type == IOTC_AT_X509 && (
+            !config->auth_info.data.cert_info.device_cert ||
+            !config->auth_info.data.cert_info.device_key)) {
+        IOTC_ERROR("Error: Configuration authentication info is invalid.");
+        return IOTCL_ERR_CONFIG_MISSING;
+    } else if (config->auth_info.type == IOTC_AT_SYMMETRIC_KEY && (
+            !config->auth_info.data.symmetric_key ||
+            0 == strlen(config->auth_info.data.symmetric_key))) {
+    }
+    return IOTCL_SUCCESS;
+}
+
+static void free_client_config(IotConnectClientConfig *config) {
+    if (config->cpid) iotcl_free(config->cpid);
+    if (config->env) iotcl_free(config->env);
+    if (config->duid) iotcl_free(config->duid);
+
+    if (config->auth_info.trust_store) iotcl_free(config->auth_info.trust_store);
+    if (config->offline_store_path) iotcl_free(config->offline_store_path);
+    if (config->identity_cache_path) iotcl_free(config->identity_cache_path);
+    free((void *) config->compression.dictionary);
+
+    if (config->auth_info.type == IOTC_AT_X509) {
+        if (config->auth_info.data.cert_info.device_cert) iotcl_free(config->auth_info.data.cert_info.device_cert);
+        if (config->auth_info.data.cert_info.device_key) iotcl_free(config->auth_info.data.cert_info.device_key);
+    } else if (config->auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
+        if (config->auth_info.data.symmetric_key) iotcl_free(config->auth_info.data.symmetric_key);
+    }
+    memset(config, 0, sizeof(IotConnectClientConfig));
+}
+
+// Creates the client up to the point where it needs its identity
+static int client_prepare(IotConnectClientConfig *c, IotConnectClient **client_out) {
+    int status;
+
+    *client_out = NULL;
+    IotConnectClient *client = calloc(1, sizeof(IotConnectClient));
+    if (!client) {
+        IOTC_ERROR("Out of memory while creating the client!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    iotc_platform_mutex_init(&client->state_lock);
+    // clients created at the same time get different sequences
+    client->jitter_state = (uint32_t) (iotc_platform_now_us() ^ (uintptr_t) client) | 1;
+    iotc_rate_init(&client->rate_limiter, &c->rate_limit);
+    iotc_link_init(&client->link, &c->adaptive, &c->batch);
+
+    if (iotconnect_clone_client_config(&client->config, c)) {
+        free_client_config(&client->config);
+        iotc_platform_mutex_destroy(&client->state_lock);
+        free(client);
+        return IOTCL_ERR_OUT_OF_MEMORY; // called function will print the error
+    }
+
+    status = validate_config(&client->config);
+    if (status) {
+        free_client_config(&client->config);
+        iotc_platform_mutex_destroy(&client->state_lock);
+        free(client);
+        return status; // called function will print the error
+    }
+
+    status = library_acquire(client);
+    if (status) {
+        free_client_config(&client->config);
+        iotc_platform_mutex_destroy(&client->state_lock);
+        free(client);
+        return status; // called function will print errors
+    }
+
+    // from this point on, the client can be cleaned up with iotconnect_client_destroy()
+    *client_out = client;
+    return IOTCL_SUCCESS;
+}
+
+// Completes the client once it has its identity
+static int client_finish(IotConnectClient *client) {
+    int status = IOTCL_SUCCESS;
+    IOTC_INFO("Identity response parsing successful.");
+    if (iotc_link_is_enabled(&client->link)) {
+        iotc_link_apply_batch_limits(&client->link, &client->config.batch);
+    }
+    iotc_batch_init(&client->telemetry_batch, &client->config.batch, on_telemetry_batch_flush, client);
+    if (client->config.compression.enabled) {
+        client->compressor = iotc_compressor_create(&client->config.compression);
+        if (!client->compressor) {
+            return IOTCL_ERR_CONFIG_ERROR; // called function will print the error
+        }
+    }
+
+    if (client->config.engine) {
+        client->engine_session = iotc_engine_session_create(client->config.engine);
+    } else {
+        client->device_client = iotc_device_client_create();
+    }
+    if (!client->device_client && !client->engine_session) {
+        return IOTCL_ERR_OUT_OF_MEMORY; // called function will print the error
+    }
+
+    if (client->config.c2d.num_workers > 0) {
+        client->c2d_dispatcher = iotc_dispatch_create(&client->config.c2d, process_c2d_message,
+                                                      get_c2d_message_key, client);
+        if (!client->c2d_dispatcher) {
+            return IOTCL_ERR_FAILED; // called function will print the error
+        }
+    }
+
+    if (client->config.offline_store_path) {
+        client->offline_store = iotc_store_open(client->config.offline_store_path, client->config.offline_store_size);
+        if (!client->offline_store) {
+            return IOTCL_ERR_CONFIG_ERROR; // called function will print the error
+        }
+    }
+    return status;
+}
+
+// Gets the identity of a prepared client and completes it. Destroys the client if that fails.
+static int client_load(IotConnectClient *client) {
+    int status = load_identity(client);
+    if (!status) {
+        status = client_finish(client);
+    }
+    if (status) {
+        report_phase(client, IOTC_CP_FAILED);
+        iotconnect_client_destroy(client);
+    }
+    return status; // called functions will print errors
+}
+
+int iotconnect_client_create(IotConnectClientConfig *c, IotConnectClient **client_out) {
+    IotConnectClient *client;
+    *client_out = NULL;
+    int status = client_prepare(c, &client);
+    if (status) {
+        return status; // called function will print errors
+    }
+    status = client_load(client);
+    if (!status) {
+        *client_out = client;
+    }
+    return status;
+}
+
+// Progress of one client in iotconnect_client_create_many()
+typedef struct {
+    int status;
+    bool needs_request; // no fresh cached identity
+    char *expired; // expired cached identity response
+    size_t discovery_index;
+    size_t identity_index;
+    IotclDraUrlContext identity_url;
+} BatchIdentity;
+
+// Discovery for the device matches the discovery of the other device, if they share the environment and CPID
+static bool is_same_discovery(const IotConnectClientConfig *a, const IotConnectClientConfig *b) {
+    return a->connection_type == b->connection_type && 0 == strcmp(a->env, b->env) && 0 == strcmp(a->cpid, b->cpid);
+}
+
+int iotconnect_client_create_many(IotConnectClientConfig *configs, size_t num_configs, IotConnectClient **clients,
+                                  unsigned int max_concurrent) {
+    int status = IOTCL_SUCCESS;
+    size_t num_discovery = 0;
+    size_t num_identity = 0;
+    for (size_t i = 0; i < num_configs; i++) {
+        clients[i] = NULL;
+    }
+    BatchIdentity *batch = calloc(num_configs, sizeof(BatchIdentity));
+    IotclDraUrlContext *discovery_urls = calloc(num_configs, sizeof(IotclDraUrlContext));
+    IotcHttpRequest *discovery = calloc(num_configs, sizeof(IotcHttpRequest));
+    IotcHttpRequest *identity = calloc(num_configs, sizeof(IotcHttpRequest));
+    if (!batch || !discovery_urls || !discovery || !identity) {
+        IOTC_ERROR("Out of memory while creating clients!");
+        status = IOTCL_ERR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    // one discovery request for each environment and CPID
+    for (size_t i = 0; i < num_configs; i++) {
+        BatchIdentity *b = &batch[i];
+        b->status = client_prepare(&configs[i], &clients[i]);
+        if (b->status || load_cached_identity(clients[i], &b->expired)) {
+            continue;
+        }
+        b->needs_request = true;
+        b->discovery_index = num_discovery;
+        for (size_t j = 0; j < i; j++) {
+            if (batch[j].needs_request && !batch[j].status
+                && is_same_discovery(&clients[j]->config, &clients[i]->config)) {
+                b->discovery_index = batch[j].discovery_index;
+                break;
+            }
+        }
+        if (b->discovery_index == num_discovery) {
+            b->status = init_discovery_url(&clients[i]->config, &discovery_urls[num_discovery]);
+            if (b->status) {
+                continue; // called function will print the error
+            }
+            discovery[num_discovery].url = iotcl_dra_url_get_url(&discovery_urls[num_discovery]);
+            num_discovery++;
+        }
+    }
+    iotc_http_request_many(library_http, discovery, num_discovery, max_concurrent);
+
+    // then the identity requests for all devices that need them
+    for (size_t i = 0; i < num_discovery; i++) {
+        discovery[i].status = validate_response(&discovery[i].response);
+    }
+    for (size_t i = 0; i < num_configs; i++) {
+        BatchIdentity *b = &batch[i];
+        if (b->status || !b->needs_request) {
+            continue;
+        }
+        b->status = discovery[b->discovery_index].status;
+        if (!b->status) {
+            b->status = build_identity_url(clients[i], &discovery[b->discovery_index].response,
+                                           &discovery_urls[b->discovery_index], &b->identity_url);
+        }
+        if (!b->status) {
+            b->identity_index = num_identity;
+            identity[num_identity++].url = iotcl_dra_url_get_url(&b->identity_url);
+        }
+    }
+    iotc_http_request_many(library_http, identity, num_identity, max_concurrent);
+
+    for (size_t i = 0; i < num_configs; i++) {
+        BatchIdentity *b = &batch[i];
+        if (!clients[i]) {
+            status = status ? status : b->status;
+            continue;
+        }
+        if (b->needs_request) {
+            if (!b->status) {
+                b->status = handle_identity_response(clients[i], &identity[b->identity_index].response,
+                                                     &b->identity_url);
+            }
+            b->status = use_expired_identity(clients[i], b->expired, b->status);
+            b->expired = NULL;
+        }
+        if (!b->status) {
+            b->status = client_finish(clients[i]);
+        }
+        if (b->status) {
+            iotconnect_client_destroy(clients[i]);
+            clients[i] = NULL;
+            status = status ? status : b->status;
+        }
+    }
+
+    cleanup:
+    for (size_t i = 0; batch && i < num_configs; i++) {
+        iotcl_dra_url_deinit(&batch[i].identity_url);
+        free(batch[i].expired);
+    }
+    for (size_t i = 0; i < num_discovery; i++) {
+        iotcl_dra_url_deinit(&discovery_urls[i]);
+        iotconnect_free_https_response(&discovery[i].response);
+    }
+    for (size_t i = 0; i < num_identity; i++) {
+        iotconnect_free_https_response(&identity[i].response);
+    }
+    free(batch);
+    free(discovery_urls);
+    free(discovery);
+    free(identity);
+    return status;
+}
+
+int iotconnect_client_connect(IotConnectClient *client) {
+    stop_reconnect(client);
+    int status = device_client_connect(client);
+    if (status && client->is_identity_cached) {
+        // the device may have been moved or its settings changed since the identity was cached
+        // If the requests fail as well, the link is probably down, so the cache is kept for the next attempt.
+        IOTC_WARN("Unable to connect with the cached identity. Requesting it again...");
+        if (0 == run_http_identity(client)) {
+            status = device_client_connect(client);
+        }
+    }
+    if (status) {
+        IOTC_ERROR("Failed to connect!");
+        report_phase(client, IOTC_CP_FAILED);
+        return status;
+    }
+    client->is_identity_cached = false;
+    drain_offline_store(client);
+    report_phase(client, IOTC_CP_CONNECTED);
+    return 0;
+}
+
+static void connect_op_run(void *arg) {
+    IotConnectConnectOp *op = (IotConnectConnectOp *) arg;
+    int status;
+    switch (op->kind) {
+        case OP_CREATE:
+            status = client_load(op->client);
+            if (!status) {
+                status = iotconnect_client_connect(op->client);
+                if (status) {
+                    iotconnect_client_destroy(op->client);
+                }
+            }
+            if (status) {
+                op->client = NULL;
+            }
+            break;
+        case OP_CONNECT:
+            status = iotconnect_client_connect(op->client);
+            break;
+        default:
+            status = reconnect_client(op->client);
+            break;
+    }
+    iotc_platform_mutex_lock(&op->lock);
+    op->status = status;
+    op->phase = status ? IOTC_CP_FAILED : IOTC_CP_CONNECTED;
+    op->is_done = true;
+    iotc_platform_wakeup_signal(&op->wakeup);
+    iotc_platform_mutex_unlock(&op->lock);
+}
+
+static void connect_op_free(IotConnectConnectOp *op) {
+    iotc_platform_wakeup_destroy(&op->wakeup);
+    iotc_platform_mutex_destroy(&op->lock);
+    free(op);
+}
+
+static int connect_op_start(IotConnectClient *client, ConnectOpKind kind, IotConnectConnectOp **op_out) {
+    *op_out = NULL;
+    if (client->connect_op) {
+        IOTC_ERROR("The client is already connecting!");
+        return IOTCL_ERR_FAILED;
+    }
+    IotConnectConnectOp *op = calloc(1, sizeof(IotConnectConnectOp));
+    if (!op) {
+        IOTC_ERROR("Out of memory while starting to connect!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    op->kind = kind;
+    op->client = client;
+    op->phase = IOTC_CP_IDLE;
+    iotc_platform_mutex_init(&op->lock);
+    iotc_platform_wakeup_init(&op->wakeup);
+    client->connect_op = op; // before the thread starts reporting phases
+    if (iotc_platform_thread_create(&op->thread, connect_op_run, op)) {
+        IOTC_ERROR("Unable to start the connect thread!");
+        client->connect_op = NULL;
+        connect_op_free(op);
+        return IOTCL_ERR_FAILED;
+    }
+    *op_out = op;
+    return IOTCL_SUCCESS;
+}
+
+static bool connect_op_is_done(IotConnectConnectOp *op) {
+    iotc_platform_mutex_lock(&op->lock);
+    bool ret = op->is_done;
+    iotc_platform_mutex_unlock(&op->lock);
+    return ret;
+}
+
+int iotconnect_client_start(IotConnectClientConfig *c, IotConnectConnectOp **op) {
+    IotConnectClient *client;
+    *op = NULL;
+    int status = client_prepare(c, &client);
+    if (status) {
+        return status; // called function will print errors
+    }
+    status = connect_op_start(client, OP_CREATE, op);
+    if (status) {
+        iotconnect_client_destroy(client);
+    }
+    return status;
+}
+
+int iotconnect_client_start_connect(IotConnectClient *client, IotConnectConnectOp **op) {
+    stop_reconnect(client);
+    return connect_op_start(client, OP_CONNECT, op);
+}
+
+IotConnectConnectPhase iotconnect_connect_op_step(IotConnectConnectOp *op) {
+    iotc_platform_mutex_lock(&op->lock);
+    iotc_platform_wakeup_clear(&op->wakeup);
+    IotConnectConnectPhase phase = op->phase;
+    iotc_platform_mutex_unlock(&op->lock);
+    return phase;
+}
+
+int iotconnect_connect_op_get_fd(IotConnectConnectOp *op) {
+    return iotc_platform_wakeup_get_fd(&op->wakeup);
+}
+
+int iotconnect_connect_op_finish(IotConnectConnectOp *op, IotConnectClient **client) {
+    iotc_platform_thread_join(&op->thread);
+    const int status = op->status;
+    if (op->client) {
+        op->client->connect_op = NULL;
+    }
+    if (client) {
+        *client = op->client;
+    }
+    connect_op_free(op);
+    return status;
+}
+
+// Reconnects in the background, so that polling does not block while the client connects
+static void service_reconnect(IotConnectClient *client) {
+    IotConnectConnectOp *op = client->connect_op;
+    if (op) {
+        if (OP_RECONNECT == op->kind && connect_op_is_done(op)) {
+            iotconnect_connect_op_finish(op, NULL); // the op already scheduled the next attempt if it failed
+        }
+        return;
+    }
+    iotc_platform_mutex_lock(&client->state_lock);
+    bool is_due = client->is_reconnect_pending && iotc_platform_now_ms() >= client->reconnect_at_ms;
+    iotc_platform_mutex_unlock(&client->state_lock);
+    if (is_due && connect_op_start(client, OP_RECONNECT, &op)) {
+        schedule_reconnect(client); // called function will print the error
+    }
+}
+
+void iotconnect_client_poll(IotConnectClient *client) {
+    library_read_lock();
+    if (client->sas_token) {
+        iotc_sas_token_renew_due(client->sas_token); // so that connecting does not have to
+    }
+    library_read_unlock();
+    if (client->device_client) {
+        iotc_device_client_poll(client->device_client);
+    }
+    service_reconnect(client);
+    update_batch_limits(client);
+    iotc_batch_poll(&client->telemetry_batch);
+    drain_rate_queue(client);
+    drain_offline_store(client);
+}
+
+bool iotconnect_client_is_connected(IotConnectClient *client) {
+    return transport_is_connected(client);
+}
+
+void iotconnect_client_get_rate_limit_status(IotConnectClient *client, IotConnectRateLimitStatus *status) {
+    iotc_platform_mutex_lock(&client->state_lock);
+    iotc_rate_get_fill(&client->rate_limiter, &status->message_fill, &status->byte_fill);
+    status->queued_messages = 0;
+    status->queued_bytes = 0;
+    for (int i = 0; i < LANE_COUNT; i++) {
+        status->queued_messages += client->rate_lanes[i].num_messages;
+        status->queued_bytes += client->rate_lanes[i].num_bytes;
+    }
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
+
+void iotconnect_client_get_link_estimate(IotConnectClient *client, IotConnectLinkEstimate *estimate) {
+    iotc_platform_mutex_lock(&client->state_lock);
+    *estimate = client->link.estimate;
+    iotc_platform_mutex_unlock(&client->state_lock);
+}
+
+bool iotconnect_client_is_tls_resumed(IotConnectClient *client) {
+    if (client->engine_session) {
+        return iotc_engine_session_is_tls_resumed(client->engine_session);
+    }
+    return iotc_device_client_is_tls_resumed(client->device_client);
+}
+
+void iotconnect_client_disconnect(IotConnectClient *client) {
+    stop_reconnect(client);
+    iotc_batch_flush(&client->telemetry_batch);
+    IOTC_INFO("Disconnecting...");
+    int status;
+    if (client->engine_session) {
+        status = iotc_engine_session_disconnect(client->engine_session);
+    } else {
+        status = iotc_device_client_disconnect(client->device_client);
+    }
+    if (0 == status) {
+        IOTC_INFO("Disconnected.");
+    }
+}
+
+void *iotconnect_client_get_user_data(IotConnectClient *client) {
+    return client->config.user_data;
+}
+
+IotConnectClient *iotconnect_client_get_current(void) {
+    return current_client;
+}
+
+void iotconnect_client_destroy(IotConnectClient *client) {
+    if (!client) {
+        return;
+    }
+    stop_reconnect(client);
+    for (int i = 0; i < LANE_COUNT; i++) {
+        RateLane *l = &client->rate_lanes[i];
+        if (l->head) {
+            IOTC_WARN("Discarding %lu rate limited messages", (unsigned long) l->num_messages);
+        }
+        while (l->head) {
+            RateQueued *q = l->head;
+            l->head = q->next;
+            report_delivery_failed(client, q->id);
+            free(q);
+        }
+    }
+    if (client->device_client || client->engine_session) {
+        if (transport_is_connected(client)) {
+            iotconnect_client_disconnect(client);
+        }
+        // callbacks that are still running may send acknowledgements
+        iotc_dispatch_destroy(client->c2d_dispatcher);
+        iotc_device_client_destroy(client->device_client);
+        iotc_engine_session_destroy(client->engine_session);
+    }
+    iotc_batch_deinit(&client->telemetry_batch);
+    iotc_compressor_destroy(client->compressor);
+    if (client->offline_store) {
+        iotc_store_close(client->offline_store);
+    }
+    free(client->drain_buffer);
+    free(client->deliveries);
+    free_mqtt_identity(&client->mqtt);
+    iotc_sas_token_destroy(client->sas_token);
+    library_release();
+    free_client_config(&client->config);
+    iotc_platform_mutex_destroy(&client->state_lock);
+    free(client);
+}
+
+// The functions below operate on a single default client
+
+bool iotconnect_sdk_is_connected(void) {
+    return default_client && iotconnect_client_is_connected(default_client);
+}
+
+int iotconnect_sdk_init(IotConnectClientConfig *c) {
+    // clear existing global config
+    iotconnect_sdk_deinit();
+    return iotconnect_client_create(c, &default_client);
+}
+
+int iotconnect_sdk_connect(void) {
+    if (!default_client) {
+        IOTC_ERROR("iotconnect_sdk_connect called, but config is invalid!");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    int status = iotconnect_client_connect(default_client);
+    if (status) {
+        iotconnect_sdk_deinit();
+    }
+    return status;
+}
+
+int iotconnect_sdk_start(IotConnectClientConfig *c) {
+    // clear existing global config
+    iotconnect_sdk_deinit();
+    return iotconnect_client_start(c, &default_op);
+}
+
+IotConnectConnectPhase iotconnect_sdk_step(void) {
+    if (!default_op) {
+        return iotconnect_sdk_is_connected() ? IOTC_CP_CONNECTED : IOTC_CP_IDLE;
+    }
+    IotConnectConnectPhase phase = iotconnect_connect_op_step(default_op);
+    if (IOTC_CP_CONNECTED == phase || IOTC_CP_FAILED == phase) {
+        IotConnectConnectOp *op = default_op;
+        default_op = NULL;
+        iotconnect_connect_op_finish(op, &default_client); // the op printed the error if it failed
+    }
+    return phase;
+}
+
+int iotconnect_sdk_get_connect_fd(void) {
+    return default_op ? iotconnect_connect_op_get_fd(default_op) : -1;
+}
+
+void iotconnect_sdk_disconnect(void) {
+    if (default_client) {
+        iotconnect_client_disconnect(default_client);
+    }
+}
+
+int iotconnect_sdk_send_telemetry(IotclMessageHandle message) {
+    if (!default_client) {
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    return iotconnect_client_send_telemetry(default_client, message, NULL);
+}
+
+void iotconnect_sdk_flush_telemetry(void) {
+    if (default_client) {
+        iotconnect_client_flush_telemetry(default_client);
+    }
+}
+
+int iotconnect_sdk_send_raw(const char *topic, const void *payload, size_t payload_len) {
+    if (!default_client) {
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    return iotconnect_client_send_raw(default_client, topic, payload, payload_len, NULL);
+}
+
+int iotconnect_sdk_send_raw_iov(const char *topic, const IotConnectBuffer *bufs, size_t num_bufs) {
+    if (!default_client) {
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    return iotconnect_client_send_raw_iov(default_client, topic, bufs, num_bufs, NULL);
+}
+
+void iotconnect_sdk_poll(void) {
+    if (default_client) {
+        iotconnect_client_poll(default_client);
+    }
+}
+
+void iotconnect_sdk_deinit(void) {
+    if (default_op) {
+        IotConnectConnectOp *op = default_op;
+        default_op = NULL;
+        iotconnect_connect_op_finish(op, &default_client);
+    }
+    IotConnectClient *client = default_client;
+    default_client = NULL;
+    iotconnect_client_destroy(client);
+}
@@ -3,12 +3,15 @@
  * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "iotcl.h"
 #include "iotconnect.h"
+#include "iotc_ota_download.h"
+#include "iotc_engine.h"
 
 #include "app_config.h"
 
@@ -72,7 +75,43 @@ static bool app_needs_ota_update(const char *version) {
     return strcmp(APP_VERSION, version) < 0;
 }
 
-// This sample OTA handling only checks the version and verifies if the firmware needs an update but does not download.
+static void on_ota_progress(void *context, uint64_t downloaded, uint64_t total) {
+    (void) context;
+    if (total) {
+        printf("OTA: %llu/%llu bytes\r", (unsigned long long) downloaded, (unsigned long long) total);
+    }
+}
+
+// Downloads the image to a file named after the version. Installing it is up to the application.
+static bool app_download_ota(const char *url, const char *version) {
+    char file_path[64];
+    snprintf(file_path, sizeof(file_path), "ota-image-%s.bin", version);
+    for (char *c = &file_path[sizeof("ota-image-") - 1]; *c; c++) {
+        if (!isalnum((unsigned char) *c) && *c != '.' && *c != '-') {
+            *c = '_'; // the version comes from the cloud, so keep it from being a path
+        }
+    }
+    IotcOtaDownloadConfig config;
+    IotcOtaDownloadResult result;
+    iotc_ota_download_init_config(&config);
+    config.url = url;
+    config.file_path = file_path;
+    // continue an image of this version left incomplete by a previous attempt. The SDK checks with the server
+    // that the image has not changed since.
+    config.resume_file = true;
+    config.progress_cb = on_ota_progress;
+    if (iotc_ota_download(&config, &result)) {
+        return false;
+    }
+    printf("\nDownloaded %llu bytes to %s. SHA-256: ", (unsigned long long) result.size, file_path);
+    for (int i = 0; i < IOTC_SHA256_SIZE; i++) {
+        printf("%02x", result.sha256[i]);
+    }
+    printf("\n");
+    return true;
+}
+
+// This sample OTA handling checks the version and downloads the firmware if needed, but does not install it.
 static void on_ota(IotclC2dEventData data) {
     const char *message = NULL;
     const char *url = iotcl_c2d_get_ota_url(data, 0);
@@ -87,8 +126,8 @@ static void on_ota(IotclC2dEventData data) {
             message = "Version is matching";
         } else if (app_needs_ota_update(version)) {
             printf("OTA update is required for version %s.\n", version);
-            success = false;
-            message = "Not implemented";
+            success = app_download_ota(url, version);
+            message = success ? NULL : "Download failed";
         } else {
             printf("Device firmware version %s is newer than OTA version %s. Sending failure\n", APP_VERSION,
                    version);
@@ -123,7 +162,7 @@ static void publish_telemetry() {
     iotcl_telemetry_set_number(msg, "coordinate.x", (double) rand() / RAND_MAX * 10.0);
     iotcl_telemetry_set_number(msg, "coordinate.y", (double) rand() / RAND_MAX * 10.0);
 
-    iotcl_mqtt_send_telemetry(msg, false);
+    iotconnect_sdk_send_telemetry(msg);
     iotcl_telemetry_destroy(msg);
 }
 
@@ -193,6 +232,18 @@ int main(int argc, char *argv[]) {
     config.ota_cb = on_ota;
     config.cmd_cb = on_command;
 
+#ifdef __linux__
+    // The engine caches the TLS session, so each reconnect in the loop below can resume it.
+    // With verbose set, the SDK logs whether each connect had "an abbreviated" or "a full" TLS handshake.
+    // Paho always does a full handshake.
+    IotcEngineConfig engine_config = {1};
+    config.engine = iotc_engine_create(&engine_config);
+    if (!config.engine) {
+        printf("Unable to create the engine\n");
+        return -1;
+    }
+#endif
+
     // initialize random seed for the telemetry test
     srand((unsigned int) time(NULL));
 
@@ -220,6 +271,9 @@ int main(int argc, char *argv[]) {
     }
 
     iotconnect_sdk_deinit();
+#ifdef __linux__
+    iotc_engine_destroy(config.engine);
+#endif
 
     printf("Basic sample demo is complete. Exiting.\n");
     return 0;